@@ -0,0 +1,177 @@
+#include "bench.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+void bench_default_config(BenchConfig* config) {
+  *config = (BenchConfig){.repetitions = BENCH_DEFAULT_REPETITIONS,
+                          .warmup_ms = BENCH_DEFAULT_WARMUP_MS,
+                          .batch_ms = BENCH_DEFAULT_BATCH_MS,
+                          .filter = nullptr};
+}
+
+static uint64_t timed_run(const Benchmark* benchmark, uint64_t iterations) {
+  if (benchmark->setup != nullptr)
+    benchmark->setup(benchmark->context);
+  uint64_t start_ns = monotonic_ns();
+  benchmark->run(benchmark->context, iterations);
+  uint64_t elapsed_ns = monotonic_ns() - start_ns;
+  if (benchmark->teardown != nullptr)
+    benchmark->teardown(benchmark->context);
+  return elapsed_ns;
+}
+
+static int32_t compare_doubles(const void* a, const void* b) {
+  double lhs = *(const double*)a;
+  double rhs = *(const double*)b;
+  return (lhs > rhs) - (lhs < rhs);
+}
+
+bool bench_run(const BenchConfig* config,
+               const Benchmark* benchmark,
+               BenchResult* result) {
+  if (config->filter != nullptr &&
+      strstr(benchmark->name, config->filter) == nullptr)
+    return false;
+
+  // Warm up caches, the allocator and the CPU clock, doubling the batch
+  // until the warmup time is spent; the last batch calibrates the count
+  uint64_t iterations = 1;
+  uint64_t elapsed_ns = timed_run(benchmark, iterations);
+  uint64_t warmup_ns = elapsed_ns;
+  while (warmup_ns < config->warmup_ms * 1'000'000) {
+    iterations *= 2;
+    elapsed_ns = timed_run(benchmark, iterations);
+    warmup_ns += elapsed_ns;
+  }
+  double ns_per_op = (double)elapsed_ns / iterations;
+  iterations =
+      (uint64_t)(config->batch_ms * 1e6 / (ns_per_op > 1 ? ns_per_op : 1));
+  if (iterations == 0)
+    iterations = 1;
+
+  uint64_t repetitions = config->repetitions;
+  if (repetitions > BENCH_MAX_REPETITIONS)
+    repetitions = BENCH_MAX_REPETITIONS;
+  double samples[BENCH_MAX_REPETITIONS];
+  double sum = 0;
+  for (uint64_t i = 0; i < repetitions; i++) {
+    samples[i] = (double)timed_run(benchmark, iterations) / iterations;
+    sum += samples[i];
+  }
+  qsort(samples, repetitions, sizeof(double), compare_doubles);
+
+  double mean = sum / repetitions;
+  double variance = 0;
+  for (uint64_t i = 0; i < repetitions; i++) {
+    variance += (samples[i] - mean) * (samples[i] - mean);
+  }
+  *result = (BenchResult){
+      .name = benchmark->name,
+      .iterations = iterations,
+      .repetitions = repetitions,
+      .min_ns = samples[0],
+      .median_ns = (repetitions % 2)
+                       ? samples[repetitions / 2]
+                       : (samples[repetitions / 2 - 1] +
+                          samples[repetitions / 2]) / 2,
+      .mean_ns = mean,
+      .stddev_ns = repetitions > 1 ? sqrt(variance / (repetitions - 1)) : 0,
+      .max_ns = samples[repetitions - 1]};
+  return true;
+}
+
+void bench_print_header(FILE* out) {
+  fprintf(out, "%-32s %12s %12s %12s %12s %8s %10s\n", "benchmark",
+          "median ns", "mean ns", "min ns", "max ns", "cv %", "iters");
+}
+
+void bench_print_result(FILE* out, const BenchResult* result) {
+  fprintf(out, "%-32s %12.1f %12.1f %12.1f %12.1f %8.2f %10lu\n",
+          result->name, result->median_ns, result->mean_ns, result->min_ns,
+          result->max_ns,
+          result->mean_ns > 0 ? 100.0 * result->stddev_ns / result->mean_ns
+                              : 0.0,
+          result->iterations);
+  fflush(out);
+}
+
+void bench_write_json(FILE* out,
+                      const char* label,
+                      const BenchConfig* config,
+                      const BenchResult* results,
+                      size_t n_results) {
+#ifdef __OPTIMIZE__
+  bool optimized = true;
+#else
+  bool optimized = false;
+#endif
+#ifdef __SANITIZE_ADDRESS__
+  bool sanitized = true;
+#else
+  bool sanitized = false;
+#endif
+  // One benchmark per line, which bench_compare relies on
+  fprintf(out,
+          "{\"label\": \"%s\", \"optimized\": %s, \"asan\": %s, "
+          "\"repetitions\": %lu, \"batch_ms\": %lu,\n \"benchmarks\": [\n",
+          label ? label : "", optimized ? "true" : "false",
+          sanitized ? "true" : "false", config->repetitions, config->batch_ms);
+  for (size_t i = 0; i < n_results; i++) {
+    const BenchResult* result = &results[i];
+    fprintf(out,
+            "  {\"name\": \"%s\", \"iterations\": %lu, \"repetitions\": %lu, "
+            "\"median_ns\": %.2f, \"mean_ns\": %.2f, \"stddev_ns\": %.2f, "
+            "\"min_ns\": %.2f, \"max_ns\": %.2f}%s\n",
+            result->name, result->iterations, result->repetitions,
+            result->median_ns, result->mean_ns, result->stddev_ns,
+            result->min_ns, result->max_ns, i + 1 < n_results ? "," : "");
+  }
+  fprintf(out, "]}\n");
+}
+
+size_t bench_compare(FILE* out,
+                     const char* baseline_path,
+                     const BenchResult* results,
+                     size_t n_results,
+                     double threshold_percent) {
+  FILE* baseline = fopen(baseline_path, "r");
+  if (baseline == nullptr) {
+    perror("fopen baseline");
+    return 0;
+  }
+
+  fprintf(out, "\n%-32s %12s %12s %9s\n", "benchmark", "baseline ns",
+          "current ns", "change");
+  size_t regressions = 0;
+  char* line = nullptr;
+  size_t capacity = 0;
+  while (getline(&line, &capacity, baseline) > 0) {
+    char* name = strstr(line, "\"name\": \"");
+    char* median = strstr(line, "\"median_ns\": ");
+    if (name == nullptr || median == nullptr)
+      continue;
+    name += strlen("\"name\": \"");
+    char* name_end = strchr(name, '"');
+    if (name_end == nullptr)
+      continue;
+    *name_end = '\0';
+    double baseline_ns = strtod(median + strlen("\"median_ns\": "), nullptr);
+
+    for (size_t i = 0; i < n_results; i++) {
+      if (strcmp(results[i].name, name) != 0)
+        continue;
+      double change = baseline_ns > 0
+                          ? 100.0 * (results[i].median_ns - baseline_ns) /
+                                baseline_ns
+                          : 0.0;
+      bool regressed = change > threshold_percent;
+      regressions += regressed;
+      fprintf(out, "%-32s %12.1f %12.1f %+8.1f%%%s\n", name, baseline_ns,
+              results[i].median_ns, change, regressed ? "  REGRESSION" : "");
+    }
+  }
+  free(line);
+  fclose(baseline);
+  return regressions;
+}
@@ -0,0 +1,63 @@
+#ifndef BENCH_BENCH_H
+#define BENCH_BENCH_H
+#include <helper.h>
+#include <stdio.h>
+
+#define BENCH_DEFAULT_REPETITIONS 10
+#define BENCH_DEFAULT_WARMUP_MS 100
+#define BENCH_DEFAULT_BATCH_MS 20
+#define BENCH_MAX_REPETITIONS 1000
+#define BENCH_REGRESSION_THRESHOLD 10.0  // percent slower than the baseline
+
+// setup and teardown run outside the timed region, once per repetition;
+// run performs `iterations` operations
+typedef struct {
+  const char* name;
+  void (*setup)(void* context);
+  void (*run)(void* context, uint64_t iterations);
+  void (*teardown)(void* context);
+  void* context;
+} Benchmark;
+
+typedef struct {
+  uint64_t repetitions;
+  uint64_t warmup_ms;
+  uint64_t batch_ms;
+  const char* filter;  // substring of the names to run, nullptr for all
+} BenchConfig;
+
+typedef struct {
+  const char* name;
+  uint64_t iterations;  // per repetition
+  uint64_t repetitions;
+  double min_ns;        // per operation
+  double median_ns;
+  double mean_ns;
+  double stddev_ns;
+  double max_ns;
+} BenchResult;
+
+void bench_default_config(BenchConfig* config);
+
+// Warms up, picks an iteration count that fills the batch time, then times
+// the repetitions. Returns false when the name does not match the filter.
+bool bench_run(const BenchConfig* config,
+               const Benchmark* benchmark,
+               BenchResult* result);
+
+void bench_print_header(FILE* out);
+void bench_print_result(FILE* out, const BenchResult* result);
+void bench_write_json(FILE* out,
+                      const char* label,
+                      const BenchConfig* config,
+                      const BenchResult* results,
+                      size_t n_results);
+
+// Compares median times against a JSON file written by bench_write_json;
+// returns the number of benchmarks slower than the threshold
+size_t bench_compare(FILE* out,
+                     const char* baseline_path,
+                     const BenchResult* results,
+                     size_t n_results,
+                     double threshold_percent);
+#endif
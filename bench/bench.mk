@@ -0,0 +1,10 @@
+BENCH_SRCS := $(wildcard bench/*.c)
+BENCH_OBJS := $(BENCH_SRCS:.c=.o)
+SERVER_LIB_OBJS := $(filter-out server/pa3_server.o,$(SERVER_OBJS))
+
+pa3_bench: LDFLAGS += -largon2 -pthread -lm
+pa3_bench: $(BENCH_OBJS) $(SERVER_LIB_OBJS) $(COMMON_OBJS)
+	$(CC) $(CFLAGS) -o $@ $^ $(LDFLAGS)
+
+clean_pa3_bench:
+	rm -f $(BENCH_OBJS) pa3_bench bench.json
@@ -0,0 +1,565 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "../server/helper.h"
+#include "bench.h"
+
+// Microbenchmarks of the server building blocks, linked against the server
+// objects (everything but pa3_server.o)
+
+#define BENCH_USERS_SMALL 1'000
+#define BENCH_USERS_LARGE 10'000
+#define BENCH_NAME_POOL (1 << 16)
+#define BENCH_PASSWORD "correct horse battery staple"
+#define BENCH_MAX_RESULTS 64
+
+atomic_bool sigint_received = false;
+
+static char bench_names[BENCH_NAME_POOL][24];
+
+static void make_names() {
+  for (size_t i = 0; i < BENCH_NAME_POOL; i++) {
+    snprintf(bench_names[i], sizeof(bench_names[i]), "user%zu", i);
+  }
+}
+
+// Users-related benchmarks
+typedef struct {
+  Users users;
+  size_t n_users;
+  bool hit;
+} UsersContext;
+
+static const PasswordRecord not_a_real_hash = {0};
+
+static void fill_users(Users* users, size_t n_users) {
+  setup_users(users);
+  for (size_t i = 0; i < n_users; i++) {
+    add_user(users, bench_names[i], &not_a_real_hash);
+  }
+}
+
+static void run_find_user(void* context, uint64_t iterations) {
+  UsersContext* ctx = context;
+  // A stride that is coprime with the pool visits every user
+  size_t index = 0;
+  ssize_t found = 0;
+  for (uint64_t i = 0; i < iterations; i++) {
+    index = (index + 7919) % BENCH_NAME_POOL;
+    const char* name =
+        ctx->hit ? bench_names[index % ctx->n_users]
+                 : bench_names[ctx->n_users + index % (BENCH_NAME_POOL -
+                                                       ctx->n_users)];
+    found += find_user(&ctx->users, name);
+  }
+  __asm__ volatile("" : : "r"(found));
+}
+
+static void setup_add_user(void* context) {
+  setup_users(&((UsersContext*)context)->users);
+}
+
+// add_user refuses names it has, and a run outlasts the name pool
+static void run_add_user(void* context, uint64_t iterations) {
+  UsersContext* ctx = context;
+  char username[32];
+  for (uint64_t i = 0; i < iterations; i++) {
+    snprintf(username, sizeof(username), "added%lu", i);
+    add_user(&ctx->users, username, &not_a_real_hash);
+  }
+}
+
+static void teardown_add_user(void* context) {
+  free_users(&((UsersContext*)context)->users);
+}
+
+// Password-related benchmarks
+static PasswordRecord bench_hash;
+static PasswordRecord bench_stale_hash;  // other argon2 params
+
+static void run_hash_password(void* context, uint64_t iterations) {
+  (void)context;
+  PasswordRecord password;
+  for (uint64_t i = 0; i < iterations; i++) {
+    hash_password(BENCH_PASSWORD, &password);
+  }
+}
+
+static void run_validate_password(void* context, uint64_t iterations) {
+  (void)context;
+  for (uint64_t i = 0; i < iterations; i++) {
+    if (!validate_password(BENCH_PASSWORD, &bench_hash)) {
+      fprintf(stderr, "validate_password rejected its own hash\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+// Handler benchmarks: the benchmark user sits behind BENCH_USERS_SMALL
+// other users, like a server that has been up for a while
+typedef struct {
+  Users users;
+  Seat* seats;
+  ServerStats stats;
+  Waitlist waitlist;
+  size_t user_index;
+  size_t next_new_user;
+  char token[RESUME_TOKEN_LENGTH + 1];
+} HandlerContext;
+
+static HandlerContext handler_context;
+
+static void setup_handlers(HandlerContext* ctx) {
+  fill_users(&ctx->users, BENCH_USERS_SMALL);
+  ctx->user_index = add_user(&ctx->users, "bench", &bench_hash);
+  user_at(&ctx->users, ctx->user_index)->logged_in = true;
+  ctx->seats = default_seats();
+  stats_init(&ctx->stats, 1);
+  waitlist_init(&ctx->waitlist, NUM_SEATS, 1);
+  listing_cache_init(&listing_cache);
+
+  // Seat 100 belongs to someone else, seats 91-99 to the benchmark user
+  ctx->seats[99].user_who_booked = strdup(bench_names[0]);
+  for (int i = 90; i < 99; i++) {
+    ctx->seats[i].user_who_booked = strdup("bench");
+  }
+}
+
+static void teardown_handlers(HandlerContext* ctx) {
+  for (int i = 0; i < NUM_SEATS; i++) {
+    pthread_mutex_destroy(&ctx->seats[i].mutex);
+    free((void*)ctx->seats[i].user_who_booked);
+  }
+  free(ctx->seats);
+  free_users(&ctx->users);
+  stats_free(&ctx->stats);
+  waitlist_free(&ctx->waitlist);
+  listing_cache_free(&listing_cache);
+}
+
+static int32_t call_handler(Action action,
+                            const char* username,
+                            const char* data) {
+  Request request = {.action = action,
+                     .username = (char*)username,
+                     .username_length = strlen(username),
+                     .data = (char*)data,
+                     .data_size = data ? strlen(data) : 0};
+  Response response;
+  default_response(&response);
+  Session session = {0};
+  int32_t code = handle_request(&request, &response, &handler_context.users,
+                                handler_context.seats, &handler_context.stats,
+                                &handler_context.waitlist, &session);
+  free_response(&response);
+  return code;
+}
+
+static void expect_code(int32_t code, int32_t expected, const char* what) {
+  if (code != expected) {
+    fprintf(stderr, "%s returned %d, expected %d\n", what, code, expected);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void run_login_existing(void* context, uint64_t iterations) {
+  HandlerContext* ctx = context;
+  for (uint64_t i = 0; i < iterations; i++) {
+    user_at(&ctx->users, ctx->user_index)->logged_in = false;
+    expect_code(call_handler(ACTION_LOGIN, "bench", BENCH_PASSWORD),
+                LOGIN_ERROR_SUCCESS, "login");
+  }
+}
+
+// Every login finds a hash made with other parameters and replaces it
+static void run_login_rehash(void* context, uint64_t iterations) {
+  HandlerContext* ctx = context;
+  User* user = user_at(&ctx->users, ctx->user_index);
+  for (uint64_t i = 0; i < iterations; i++) {
+    *user_password(&ctx->users, ctx->user_index) = bench_stale_hash;
+    user->logged_in = false;
+    expect_code(call_handler(ACTION_LOGIN, "bench", BENCH_PASSWORD),
+                LOGIN_ERROR_SUCCESS, "login");
+  }
+}
+
+// New users stay; with the name index later handlers do not slow down
+// for them
+static void setup_login_new(void* context) {
+  HandlerContext* ctx = context;
+  ctx->next_new_user = ctx->users.size;
+}
+
+static void run_login_new(void* context, uint64_t iterations) {
+  HandlerContext* ctx = context;
+  char username[32];
+  for (uint64_t i = 0; i < iterations; i++) {
+    snprintf(username, sizeof(username), "new%zu", ctx->next_new_user++);
+    expect_code(call_handler(ACTION_LOGIN, username, BENCH_PASSWORD),
+                LOGIN_ERROR_SUCCESS, "login");
+  }
+}
+
+// Takes the token of one real login; resuming with it skips argon2
+static void setup_resume(void* context) {
+  HandlerContext* ctx = context;
+  user_at(&ctx->users, ctx->user_index)->logged_in = false;
+  Request request = {.action = ACTION_LOGIN,
+                     .username = (char*)"bench",
+                     .username_length = strlen("bench"),
+                     .data = (char*)BENCH_PASSWORD,
+                     .data_size = strlen(BENCH_PASSWORD)};
+  Response response;
+  default_response(&response);
+  Session session = {0};
+  expect_code(handle_request(&request, &response, &ctx->users, ctx->seats,
+                             &ctx->stats, &ctx->waitlist, &session),
+              LOGIN_ERROR_SUCCESS, "login");
+  expect_code(response.data_size, RESUME_TOKEN_LENGTH, "token size");
+  memcpy(ctx->token, response.data, RESUME_TOKEN_LENGTH);
+  ctx->token[RESUME_TOKEN_LENGTH] = '\0';
+  free_response(&response);
+}
+
+static void run_resume(void* context, uint64_t iterations) {
+  HandlerContext* ctx = context;
+  for (uint64_t i = 0; i < iterations; i++) {
+    user_at(&ctx->users, ctx->user_index)->logged_in = false;
+    expect_code(call_handler(ACTION_RESUME, "bench", ctx->token),
+                RESUME_ERROR_SUCCESS, "resume");
+  }
+}
+
+static void run_book_cancel(void* context, uint64_t iterations) {
+  (void)context;
+  char seat[8];
+  for (uint64_t i = 0; i < iterations; i++) {
+    snprintf(seat, sizeof(seat), "%lu", i % 90 + 1);
+    expect_code(call_handler(ACTION_BOOK, "bench", seat), BOOK_ERROR_SUCCESS,
+                "book");
+    expect_code(call_handler(ACTION_CANCEL_BOOKING, "bench", seat),
+                CANCEL_BOOKING_ERROR_SUCCESS, "cancel");
+  }
+}
+
+static void run_book_unavailable(void* context, uint64_t iterations) {
+  (void)context;
+  for (uint64_t i = 0; i < iterations; i++) {
+    expect_code(call_handler(ACTION_BOOK, "bench", "100"),
+                BOOK_ERROR_SEAT_UNAVAILABLE, "book");
+  }
+}
+
+static void run_confirm_available(void* context, uint64_t iterations) {
+  (void)context;
+  for (uint64_t i = 0; i < iterations; i++) {
+    call_handler(ACTION_CONFIRM_BOOKING, "bench", "available");
+  }
+}
+
+// Every listing follows a seat change, so none is served from the cache
+static void run_confirm_available_changed(void* context, uint64_t iterations) {
+  (void)context;
+  for (uint64_t i = 0; i < iterations; i++) {
+    listing_cache_invalidate(&listing_cache);
+    call_handler(ACTION_CONFIRM_BOOKING, "bench", "available");
+  }
+}
+
+static void run_confirm_booked(void* context, uint64_t iterations) {
+  (void)context;
+  for (uint64_t i = 0; i < iterations; i++) {
+    call_handler(ACTION_CONFIRM_BOOKING, "bench", "booked");
+  }
+}
+
+static void run_query(void* context, uint64_t iterations) {
+  (void)context;
+  char seat[8];
+  for (uint64_t i = 0; i < iterations; i++) {
+    snprintf(seat, sizeof(seat), "%lu", i % NUM_SEATS + 1);
+    expect_code(call_handler(ACTION_QUERY, "bench", seat),
+                QUERY_ERROR_SUCCESS, "query");
+  }
+}
+
+static void run_logout(void* context, uint64_t iterations) {
+  HandlerContext* ctx = context;
+  for (uint64_t i = 0; i < iterations; i++) {
+    user_at(&ctx->users, ctx->user_index)->logged_in = true;
+    expect_code(call_handler(ACTION_LOGOUT, "bench", nullptr),
+                LOGOUT_ERROR_SUCCESS, "logout");
+  }
+  user_at(&ctx->users, ctx->user_index)->logged_in = true;
+}
+
+static void run_stats(void* context, uint64_t iterations) {
+  (void)context;
+  for (uint64_t i = 0; i < iterations; i++) {
+    call_handler(ACTION_STATS, "", nullptr);
+  }
+}
+
+// Framing benchmarks
+static Request framing_request = {.action = ACTION_BOOK,
+                                  .username = "bench",
+                                  .username_length = 5,
+                                  .data = "42",
+                                  .data_size = 2};
+
+static void run_encode_request(void* context, uint64_t iterations) {
+  (void)context;
+  uint8_t frame[64];
+  for (uint64_t i = 0; i < iterations; i++) {
+    encode_request(&framing_request, frame);
+    __asm__ volatile("" : : "r"(frame) : "memory");
+  }
+}
+
+static void run_decode_response_header(void* context, uint64_t iterations) {
+  (void)context;
+  uint8_t header[RESPONSE_HEADER_SIZE] = {0};
+  Response response;
+  for (uint64_t i = 0; i < iterations; i++) {
+    header[0] = (uint8_t)i;
+    decode_response_header(header, &response);
+    __asm__ volatile("" : : "r"(&response) : "memory");
+  }
+}
+
+typedef struct {
+  int32_t fds[2];  // client end, server end
+} SocketContext;
+
+static void setup_socket_pair(void* context) {
+  SocketContext* ctx = context;
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, ctx->fds) < 0) {
+    perror("socketpair");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void teardown_socket_pair(void* context) {
+  SocketContext* ctx = context;
+  close(ctx->fds[0]);
+  close(ctx->fds[1]);
+}
+
+// Client write, receive_request, send_response and client read, all on
+// one thread; the frames are small enough to sit in the socket buffers
+static void run_socket_round_trip(void* context, uint64_t iterations) {
+  SocketContext* ctx = context;
+  uint8_t frame[64];
+  size_t frame_size = request_frame_size(&framing_request);
+  encode_request(&framing_request, frame);
+  uint8_t header[RESPONSE_HEADER_SIZE];
+
+  for (uint64_t i = 0; i < iterations; i++) {
+    sigint_safe_write_all(ctx->fds[0], frame, frame_size);
+
+    Request request;
+    default_request(&request);
+    if (!receive_request(ctx->fds[1], &request)) {
+      fprintf(stderr, "receive_request failed\n");
+      exit(EXIT_FAILURE);
+    }
+    Response response;
+    default_response(&response);
+    response.code = BOOK_ERROR_SUCCESS;
+    send_response(ctx->fds[1], &response);
+    free_request(&request);
+
+    sigint_safe_read_all(ctx->fds[0], header, sizeof(header));
+  }
+}
+
+// Poll set benchmarks
+typedef struct {
+  ThreadData* data_arr;
+  int32_t n_workers;
+} PollSetContext;
+
+static void setup_poll_sets(PollSetContext* ctx, int32_t n_workers) {
+  ctx->n_workers = n_workers;
+  ctx->data_arr = calloc(n_workers, sizeof(ThreadData));
+  max_clients_per_thread = SIZE_MAX;
+  for (int32_t i = 0; i < n_workers; i++) {
+    ctx->data_arr[i].poll_set = create_poll_set(-1);
+    // Uneven load so the minimum moves around
+    ctx->data_arr[i].poll_set->size = 1 + (i * 37) % 500;
+  }
+}
+
+static void teardown_poll_sets(PollSetContext* ctx) {
+  for (int32_t i = 0; i < ctx->n_workers; i++)
+    free_poll_set(ctx->data_arr[i].poll_set);
+  free(ctx->data_arr);
+}
+
+static void run_find_suitable_pollset(void* context, uint64_t iterations) {
+  PollSetContext* ctx = context;
+  ssize_t found = 0;
+  for (uint64_t i = 0; i < iterations; i++) {
+    found += find_suitable_pollset(ctx->data_arr, ctx->n_workers);
+  }
+  __asm__ volatile("" : : "r"(found));
+}
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [-r repetitions] [-w warmup ms] [-b batch ms] "
+          "[-f filter]\n"
+          "          [-o json file|-] [-l label] [-c baseline json] "
+          "[-t threshold %%]\n",
+          program);
+}
+
+int main(int argc, char* argv[]) {
+  BenchConfig config;
+  bench_default_config(&config);
+  const char* json_path = nullptr;
+  const char* label = nullptr;
+  const char* baseline_path = nullptr;
+  double threshold = BENCH_REGRESSION_THRESHOLD;
+
+  int32_t opt;
+  while ((opt = getopt(argc, argv, "r:w:b:f:o:l:c:t:")) != -1) {
+    switch (opt) {
+      case 'r':
+        config.repetitions = strtoull(optarg, nullptr, 10);
+        break;
+      case 'w':
+        config.warmup_ms = strtoull(optarg, nullptr, 10);
+        break;
+      case 'b':
+        config.batch_ms = strtoull(optarg, nullptr, 10);
+        break;
+      case 'f':
+        config.filter = optarg;
+        break;
+      case 'o':
+        json_path = optarg;
+        break;
+      case 'l':
+        label = optarg;
+        break;
+      case 'c':
+        baseline_path = optarg;
+        break;
+      case 't':
+        threshold = strtod(optarg, nullptr);
+        break;
+      default:
+        print_usage(argv[0]);
+        return 1;
+    }
+  }
+  if (optind != argc || config.repetitions == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+#if !defined(__OPTIMIZE__) || defined(__SANITIZE_ADDRESS__)
+  fprintf(stderr,
+          "warning: built without optimization or with ASan, only compare "
+          "against runs of the same build\n");
+#endif
+
+  make_names();
+  hash_password(BENCH_PASSWORD, &bench_hash);
+  HashParams stale_params = hash_params;
+  stale_params.time_cost++;
+  hash_password_with(&stale_params, BENCH_PASSWORD, &bench_stale_hash);
+
+  UsersContext users_small_hit = {.n_users = BENCH_USERS_SMALL, .hit = true};
+  UsersContext users_small_miss = {.n_users = BENCH_USERS_SMALL, .hit = false};
+  UsersContext users_large_hit = {.n_users = BENCH_USERS_LARGE, .hit = true};
+  UsersContext users_large_miss = {.n_users = BENCH_USERS_LARGE, .hit = false};
+  fill_users(&users_small_hit.users, BENCH_USERS_SMALL);
+  users_small_miss.users = users_small_hit.users;
+  fill_users(&users_large_hit.users, BENCH_USERS_LARGE);
+  users_large_miss.users = users_large_hit.users;
+  UsersContext add_user_context = {0};
+
+  setup_handlers(&handler_context);
+  SocketContext socket_context;
+  PollSetContext poll_sets_small;
+  PollSetContext poll_sets_large;
+  setup_poll_sets(&poll_sets_small, 8);
+  setup_poll_sets(&poll_sets_large, 64);
+
+  HandlerContext* handlers = &handler_context;
+  const Benchmark benchmarks[] = {
+      {"find_user/hit/1k", nullptr, run_find_user, nullptr, &users_small_hit},
+      {"find_user/miss/1k", nullptr, run_find_user, nullptr, &users_small_miss},
+      {"find_user/hit/10k", nullptr, run_find_user, nullptr, &users_large_hit},
+      {"find_user/miss/10k", nullptr, run_find_user, nullptr,
+       &users_large_miss},
+      {"add_user", setup_add_user, run_add_user, teardown_add_user,
+       &add_user_context},
+      {"hash_password", nullptr, run_hash_password, nullptr, nullptr},
+      {"validate_password", nullptr, run_validate_password, nullptr, nullptr},
+      {"handle/login_existing", nullptr, run_login_existing, nullptr,
+       handlers},
+      {"handle/login_rehash", nullptr, run_login_rehash, nullptr, handlers},
+      {"handle/login_new", setup_login_new, run_login_new, nullptr, handlers},
+      {"handle/resume", setup_resume, run_resume, nullptr, handlers},
+      {"handle/book+cancel", nullptr, run_book_cancel, nullptr, handlers},
+      {"handle/book_unavailable", nullptr, run_book_unavailable, nullptr,
+       handlers},
+      {"handle/confirm_available", nullptr, run_confirm_available, nullptr,
+       handlers},
+      {"handle/confirm_available_changed", nullptr,
+       run_confirm_available_changed, nullptr, handlers},
+      {"handle/confirm_booked", nullptr, run_confirm_booked, nullptr,
+       handlers},
+      {"handle/query", nullptr, run_query, nullptr, handlers},
+      {"handle/logout", nullptr, run_logout, nullptr, handlers},
+      {"handle/stats", nullptr, run_stats, nullptr, handlers},
+      {"frame/encode_request", nullptr, run_encode_request, nullptr, nullptr},
+      {"frame/decode_response_header", nullptr, run_decode_response_header,
+       nullptr, nullptr},
+      {"frame/socketpair_round_trip", setup_socket_pair,
+       run_socket_round_trip, teardown_socket_pair, &socket_context},
+      {"find_suitable_pollset/8", nullptr, run_find_suitable_pollset, nullptr,
+       &poll_sets_small},
+      {"find_suitable_pollset/64", nullptr, run_find_suitable_pollset,
+       nullptr, &poll_sets_large},
+  };
+  size_t n_benchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+  BenchResult results[BENCH_MAX_RESULTS];
+  size_t n_results = 0;
+  bench_print_header(stdout);
+  for (size_t i = 0; i < n_benchmarks && n_results < BENCH_MAX_RESULTS; i++) {
+    if (bench_run(&config, &benchmarks[i], &results[n_results]))
+      bench_print_result(stdout, &results[n_results++]);
+  }
+
+  if (json_path != nullptr) {
+    bool to_stdout = strcmp(json_path, "-") == 0;
+    FILE* out = to_stdout ? stdout : fopen(json_path, "w");
+    if (out == nullptr) {
+      perror("fopen");
+      return 1;
+    }
+    bench_write_json(out, label, &config, results, n_results);
+    if (!to_stdout)
+      fclose(out);
+  }
+
+  size_t regressions = 0;
+  if (baseline_path != nullptr)
+    regressions =
+        bench_compare(stdout, baseline_path, results, n_results, threshold);
+
+  teardown_poll_sets(&poll_sets_small);
+  teardown_poll_sets(&poll_sets_large);
+  teardown_handlers(&handler_context);
+  free_users(&users_small_hit.users);
+  free_users(&users_large_hit.users);
+  return regressions == 0 ? 0 : 1;
+}
@@ -1,7 +1,7 @@
 CLIENT_SRCS := $(wildcard client/*.c)
 CLIENT_OBJS := $(CLIENT_SRCS:.c=.o)
 
-pa3_client: LDFLAGS += -ledit
+pa3_client: LDFLAGS += -ledit -pthread
 
 pa3_client: $(CLIENT_OBJS) $(COMMON_OBJS)
 	$(CC) $(CFLAGS) -o $@ $^ $(LDFLAGS)
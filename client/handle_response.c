@@ -11,6 +11,11 @@ LoginErrorCode handle_login_response(const Request* request,
   switch (response->code) {
     case LOGIN_ERROR_SUCCESS:
       printf("User %s logged in successfully!\n", request->username);
+      // pa3_router answers with one token per shard, concatenated
+      if (response->data_size > 0 &&
+          response->data_size % RESUME_TOKEN_LENGTH == 0)
+        printf("Resume token: %.*s\n", (int)response->data_size,
+               (const char*)response->data);
       *active_user = strdup(request->username);
       break;
     case LOGIN_ERROR_ACTIVE_USER:
@@ -148,6 +153,30 @@ int32_t handle_logout_response(const Request* request,
   return response->code;
 }
 
+int32_t handle_resume_response(const Request* request,
+                               const Response* response,
+                               const char** active_user) {
+  switch (response->code) {
+    case RESUME_ERROR_SUCCESS:
+      printf("User %s resumed their session!\n", request->username);
+      *active_user = strdup(request->username);
+      break;
+    case RESUME_ERROR_INVALID_TOKEN:
+      printf("Invalid resume token for user %s!\n", request->username);
+      break;
+    case RESUME_ERROR_EXPIRED:
+      printf("Resume token of user %s has expired, please log in!\n",
+             request->username);
+      break;
+    case RESUME_ERROR_NO_DATA:
+      printf("Please enter your resume token!\n");
+      break;
+    default:
+      fprintf(stderr, "Unknown resume error code: %d\n", response->code);
+  }
+  return response->code;
+}
+
 int32_t handle_query_response(const Request* request,
                               const Response* response) {
   switch (response->code) {
@@ -180,10 +209,97 @@ int32_t handle_query_response(const Request* request,
   return response->code;
 }
 
+int32_t handle_stats_response(const Response* response) {
+  switch (response->code) {
+    case STATS_ERROR_SUCCESS:
+      fwrite(response->data, 1, response->data_size, stdout);
+      break;
+    default:
+      fprintf(stderr, "Unknown stats error code: %d\n", response->code);
+  }
+  return response->code;
+}
+
+int32_t handle_waitlist_response(const Request* request,
+                                 const Response* response) {
+  switch (response->code) {
+    case WAITLIST_ERROR_SUCCESS:
+      printf("User %s is on the waitlist for seat %s!\n", request->username,
+             request->data);
+      break;
+    case WAITLIST_ERROR_USER_NOT_LOGGED_IN:
+      printf("User %s is not logged in!\n", request->username);
+      break;
+    case WAITLIST_ERROR_SEAT_OUT_OF_RANGE:
+      printf("Seat %s is out of range [1,100]!\n", request->data);
+      break;
+    case WAITLIST_ERROR_NO_DATA:
+      printf("Please enter a seat number or range to wait for!\n");
+      break;
+    case WAITLIST_ERROR_SEAT_ASSIGNED:
+      if (response->data_size == sizeof(pa3_seat_t))
+        printf("Seat %lu was free and is now booked by user %s!\n",
+               *(const pa3_seat_t*)response->data, request->username);
+      break;
+    case WAITLIST_ERROR_TOO_MANY_TICKETS:
+      printf("User %s is already waiting for too many seats!\n",
+             request->username);
+      break;
+    case WAITLIST_ERROR_SEAT_HELD:
+      printf("User %s has already booked a seat of %s!\n",
+             request->username, request->data);
+      break;
+    default:
+      fprintf(stderr, "Unknown waitlist error code: %d\n", response->code);
+  }
+  return response->code;
+}
+
+int32_t handle_batch_book_response(const Request* request,
+                                   const Response* response) {
+  switch (response->code) {
+    case BATCH_BOOK_ERROR_SUCCESS:
+      printf("Seats %s were booked successfully by user %s!\n", request->data,
+             request->username);
+      break;
+    case BATCH_BOOK_ERROR_USER_NOT_LOGGED_IN:
+      printf("User %s is not logged in!\n", request->username);
+      break;
+    case BATCH_BOOK_ERROR_SEAT_UNAVAILABLE:
+      printf("Some of seats %s are unavailable, none were booked!\n",
+             request->data);
+      break;
+    case BATCH_BOOK_ERROR_SEAT_OUT_OF_RANGE:
+      printf("Seats %s are not a list of seats in [1,100]!\n", request->data);
+      break;
+    case BATCH_BOOK_ERROR_NO_DATA:
+      printf("Please enter the seats to book, separated by commas!\n");
+      break;
+    default:
+      fprintf(stderr, "Unknown batch book error code: %d\n", response->code);
+  }
+  return response->code;
+}
+
+void handle_waitlist_notice(const Response* response) {
+  if (response->data_size == sizeof(pa3_seat_t))
+    printf("Seat %lu was canceled and is now booked for you!\n",
+           *(const pa3_seat_t*)response->data);
+}
+
 int32_t handle_response(Action action,
                         const Request* request,
                         const Response* response,
                         const char** active_user) {
+  if (response->code == RATE_LIMIT_ERROR_THROTTLED) {
+    printf("Too many requests, please try again later!\n");
+    return response->code;
+  }
+  if (response->code == SHARD_ERROR_WRONG_SHARD) {
+    printf("This server does not own that seat, connect to pa3_router!\n");
+    return response->code;
+  }
+
   switch (action) {
     case ACTION_LOGIN:
       return handle_login_response(request, response, active_user);
@@ -197,6 +313,14 @@ int32_t handle_response(Action action,
       return handle_logout_response(request, response, active_user);
     case ACTION_QUERY:
       return handle_query_response(request, response);
+    case ACTION_STATS:
+      return handle_stats_response(response);
+    case ACTION_WAITLIST:
+      return handle_waitlist_response(request, response);
+    case ACTION_BATCH_BOOK:
+      return handle_batch_book_response(request, response);
+    case ACTION_RESUME:
+      return handle_resume_response(request, response, active_user);
     default:
       fprintf(stderr, "Invalid action received: %d\n", action);
       return -1;
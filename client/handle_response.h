@@ -7,4 +7,7 @@ int32_t handle_response(Action action,
                         const Request* request,
                         const Response* response,
                         const char** active_user);
+
+// Prints a WAITLIST_NOTICE_SEAT_ASSIGNED frame, which answers no request
+void handle_waitlist_notice(const Response* response);
 #endif
\ No newline at end of file
@@ -1,10 +1,18 @@
+#include <arpa/inet.h>
 #include <ctype.h>
 #include <helper.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <pa3_error.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include <argon2.h>
+#include "handle_response.h"
 
 
 Action to_action(const char* action_str) {
@@ -36,6 +44,14 @@ Action to_action(const char* action_str) {
     action = ACTION_LOGOUT;
   } else if (strcmp(action_str_copy, "query") == 0) {
     action = ACTION_QUERY;
+  } else if (strcmp(action_str_copy, "stats") == 0) {
+    action = ACTION_STATS;
+  } else if (strcmp(action_str_copy, "waitlist") == 0) {
+    action = ACTION_WAITLIST;
+  } else if (strcmp(action_str_copy, "batchbook") == 0) {
+    action = ACTION_BATCH_BOOK;
+  } else if (strcmp(action_str_copy, "resume") == 0) {
+    action = ACTION_RESUME;
   }
   free(action_str_copy);
   return action;
@@ -65,7 +81,12 @@ ParsingError parse_request(Request* request,
       parsing_error = PARSING_INVALID_ACTION;
       goto cleanup_error;
     }
-    if (request->action != ACTION_LOGIN) {
+    // Server statistics are not tied to a user
+    if (request->action == ACTION_STATS)
+      goto cleanup;
+    bool logs_in =
+        request->action == ACTION_LOGIN || request->action == ACTION_RESUME;
+    if (!logs_in) {
       if (active_user == nullptr || *active_user == nullptr) {
         fprintf(stderr, "User is not logged in!\n");
         parsing_error = PARSING_NOT_LOGGED_IN;
@@ -97,7 +118,8 @@ ParsingError parse_request(Request* request,
     goto cleanup_error;
   }
 
-  if (request->action == ACTION_LOGIN) {
+  // Login and resume take a user, then its password or resume token
+  if (request->action == ACTION_LOGIN || request->action == ACTION_RESUME) {
     request->username = strdup(token);
     request->username_length = strlen(token);
     // *active_user = strdup(request->username);
@@ -113,7 +135,9 @@ ParsingError parse_request(Request* request,
     request->data_size = strlen(token);
     goto cleanup;
   } else {
-    fprintf(stderr, "Please enter your password!\n");
+    fprintf(stderr, request->action == ACTION_RESUME
+                        ? "Please enter your resume token!\n"
+                        : "Please enter your password!\n");
     parsing_error = PARSING_NO_DATA;
   }
 
@@ -131,4 +155,115 @@ void free_input(char** input) {
   free(*input);
 
   *input = nullptr;
-}
\ No newline at end of file
+}
+
+int32_t get_socket(char* hostname, uint64_t port) {
+  int32_t sockfd;
+  struct sockaddr_in servaddr;
+
+  if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+    perror("socket creation failed");
+    exit(EXIT_FAILURE);
+  }
+
+  memset(&servaddr, 0, sizeof(servaddr));
+  servaddr.sin_family = AF_INET;
+  servaddr.sin_port = htons(port);
+
+  if (inet_pton(AF_INET, hostname, &servaddr.sin_addr) <= 0) {
+    perror("inet_pton failed");
+    exit(EXIT_FAILURE);
+  }
+
+  // FIXED: Added missing comparison
+  if (connect(sockfd, (struct sockaddr*)&servaddr, sizeof(servaddr)) < 0) {
+    perror("connect failed");
+    exit(EXIT_FAILURE);
+  }
+
+  int32_t nodelay = 1;
+  setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+  return sockfd;
+}
+
+int32_t get_unix_socket(const char* socket_path) {
+  int32_t sockfd;
+  struct sockaddr_un servaddr;
+
+  memset(&servaddr, 0, sizeof(servaddr));
+  servaddr.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(servaddr.sun_path)) {
+    fprintf(stderr, "Socket path is too long: %s\n", socket_path);
+    exit(EXIT_FAILURE);
+  }
+  strcpy(servaddr.sun_path, socket_path);
+
+  if ((sockfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+    perror("socket creation failed");
+    exit(EXIT_FAILURE);
+  }
+
+  if (connect(sockfd, (struct sockaddr*)&servaddr, sizeof(servaddr)) < 0) {
+    perror("connect failed");
+    exit(EXIT_FAILURE);
+  }
+
+  return sockfd;
+}
+
+void send_request(int32_t sockfd, Request* request) {
+  // Send the whole frame with one syscall (and one segment under TCP_NODELAY)
+  struct iovec request_iov[5] = {
+      {.iov_base = &request->action, .iov_len = sizeof(Action)},
+      {.iov_base = &request->username_length, .iov_len = sizeof(uint64_t)},
+      {.iov_base = request->username, .iov_len = request->username_length},
+      {.iov_base = &request->data_size, .iov_len = sizeof(uint64_t)},
+      {.iov_base = request->data, .iov_len = request->data_size}};
+
+  if (sigint_safe_writev_all(sockfd, request_iov, 5) < 0) {
+    perror("write request failed");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void receive_frame(int32_t sockfd, Response* response) {
+  default_response(response);
+  // Receive response code
+  if (sigint_safe_read_all(sockfd, &response->code, sizeof(int32_t)) <= 0) {
+    perror("read response code failed");
+    exit(EXIT_FAILURE);
+  }
+
+  // Receive data size
+  if (sigint_safe_read_all(sockfd, &response->data_size, sizeof(uint64_t)) <= 0) {
+    perror("read data size failed");
+    exit(EXIT_FAILURE);
+  }
+
+  // Receive data if exists
+  if (response->data_size > 0) {
+    response->data = malloc(response->data_size);
+    if (response->data == nullptr) {
+      perror("malloc for response data failed");
+      exit(EXIT_FAILURE);
+    }
+
+    if (sigint_safe_read_all(sockfd, response->data, response->data_size) <= 0) {
+      perror("read data failed");
+      exit(EXIT_FAILURE);
+    }
+  } else {
+    response->data = nullptr;
+  }
+}
+
+void receive_response(int32_t sockfd, Response* response) {
+  // Waitlist notices can arrive ahead of the response
+  receive_frame(sockfd, response);
+  while (response->code == WAITLIST_NOTICE_SEAT_ASSIGNED) {
+    handle_waitlist_notice(response);
+    free_response(response);
+    receive_frame(sockfd, response);
+  }
+}
@@ -7,4 +7,9 @@ ParsingError parse_request(Request* request,
                            const char* input,
                            const char** active_user);
 void free_input(char** input);
+
+int32_t get_socket(char* hostname, uint64_t port);
+int32_t get_unix_socket(const char* socket_path);
+void send_request(int32_t sockfd, Request* request);
+void receive_response(int32_t sockfd, Response* response);
 #endif
@@ -0,0 +1,495 @@
+#include "loadgen.h"
+#include <getopt.h>
+#include <histogram.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "helper.h"
+
+#define LOADGEN_PASSWORD "bench"
+#define LOADGEN_MAX_BOOKED 32
+#define LOADGEN_IDLE_POLL_MS 100
+
+static const char* op_names[LOADGEN_N_OPS] = {"login", "book", "cancel",
+                                              "query", "confirm"};
+
+typedef struct {
+  int32_t fd;
+  char username[32];
+  char data[32];
+  Request request;
+  bool busy;
+  bool logging_out;  // first half of a login op (logout, then login)
+  LoadgenOp op;
+  uint64_t start_ns;
+  uint32_t booked[LOADGEN_MAX_BOOKED];
+  size_t n_booked;
+} LoadgenConnection;
+
+typedef struct {
+  const LoadgenConfig* config;
+  pthread_barrier_t* barrier;
+  LoadgenConnection* connections;
+  size_t n_connections;
+  uint64_t rng;
+  Histogram histograms[LOADGEN_N_OPS];
+  uint64_t errors[LOADGEN_N_OPS];
+} LoadgenThread;
+
+static uint64_t next_random(uint64_t* state) {
+  // xorshift64*
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static double next_unit(uint64_t* state) {
+  return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int32_t connect_to_server(const LoadgenConfig* config) {
+  if (config->socket_path != nullptr)
+    return get_unix_socket(config->socket_path);
+  return get_socket(config->hostname, config->port);
+}
+
+static void set_request(LoadgenConnection* conn, Action action,
+                        const char* data) {
+  default_request(&conn->request);
+  conn->request.action = action;
+  conn->request.username = conn->username;
+  conn->request.username_length = strlen(conn->username);
+  if (data != nullptr) {
+    snprintf(conn->data, sizeof(conn->data), "%s", data);
+    conn->request.data = conn->data;
+    conn->request.data_size = strlen(conn->data);
+  }
+}
+
+// Request and connection buffers are borrowed, so only the response is freed
+static int32_t round_trip(LoadgenConnection* conn) {
+  Response response;
+  send_request(conn->fd, &conn->request);
+  receive_response(conn->fd, &response);
+  free_response(&response);
+  return response.code;
+}
+
+static LoadgenOp pick_op(LoadgenThread* thread) {
+  const uint32_t* mix = thread->config->mix;
+  uint32_t total = 0;
+  for (int i = 0; i < LOADGEN_N_OPS; i++) {
+    total += mix[i];
+  }
+
+  uint32_t pick = next_random(&thread->rng) % total;
+  for (int i = 0; i < LOADGEN_N_OPS; i++) {
+    if (pick < mix[i])
+      return i;
+    pick -= mix[i];
+  }
+  return LOADGEN_OP_QUERY;
+}
+
+static uint32_t pick_seat(LoadgenThread* thread) {
+  const LoadgenConfig* config = thread->config;
+  if (config->hot_seats > 0 && next_unit(&thread->rng) < config->hot_fraction)
+    return 1 + next_random(&thread->rng) % config->hot_seats;
+  return 1 + next_random(&thread->rng) % config->n_seats;
+}
+
+static void issue(LoadgenThread* thread, LoadgenConnection* conn,
+                  uint64_t start_ns) {
+  char seat[24];
+  conn->op = pick_op(thread);
+  conn->start_ns = start_ns;
+  conn->busy = true;
+  conn->logging_out = false;
+
+  switch (conn->op) {
+    case LOADGEN_OP_LOGIN:
+      set_request(conn, ACTION_LOGOUT, nullptr);
+      conn->logging_out = true;
+      break;
+    case LOADGEN_OP_BOOK:
+      snprintf(seat, sizeof(seat), "%u", pick_seat(thread));
+      set_request(conn, ACTION_BOOK, seat);
+      break;
+    case LOADGEN_OP_CANCEL:
+      // Cancel our own booking when we have one, a random seat otherwise
+      if (conn->n_booked > 0) {
+        size_t i = next_random(&thread->rng) % conn->n_booked;
+        snprintf(seat, sizeof(seat), "%u", conn->booked[i]);
+        conn->booked[i] = conn->booked[--conn->n_booked];
+      } else {
+        snprintf(seat, sizeof(seat), "%u", pick_seat(thread));
+      }
+      set_request(conn, ACTION_CANCEL_BOOKING, seat);
+      break;
+    case LOADGEN_OP_QUERY:
+      snprintf(seat, sizeof(seat), "%u", pick_seat(thread));
+      set_request(conn, ACTION_QUERY, seat);
+      break;
+    case LOADGEN_OP_CONFIRM:
+      set_request(conn, ACTION_CONFIRM_BOOKING,
+                  (next_random(&thread->rng) & 1) ? "available" : "booked");
+      break;
+    default:
+      break;
+  }
+  send_request(conn->fd, &conn->request);
+}
+
+// Returns true when the operation is complete
+static bool complete(LoadgenThread* thread, LoadgenConnection* conn,
+                     bool record) {
+  Response response;
+  receive_response(conn->fd, &response);
+  free_response(&response);
+
+  if (conn->logging_out) {
+    conn->logging_out = false;
+    set_request(conn, ACTION_LOGIN, LOADGEN_PASSWORD);
+    send_request(conn->fd, &conn->request);
+    return false;
+  }
+
+  if (conn->op == LOADGEN_OP_BOOK && response.code == BOOK_ERROR_SUCCESS &&
+      conn->n_booked < LOADGEN_MAX_BOOKED) {
+    conn->booked[conn->n_booked++] = strtoul(conn->data, nullptr, 10);
+  }
+
+  conn->busy = false;
+  if (record) {
+    histogram_record(&thread->histograms[conn->op],
+                     monotonic_ns() - conn->start_ns);
+    if (response.code != 0)
+      thread->errors[conn->op]++;
+  }
+  return true;
+}
+
+static void* loadgen_thread_func(void* arg) {
+  LoadgenThread* thread = (LoadgenThread*)arg;
+  const LoadgenConfig* config = thread->config;
+
+  for (size_t i = 0; i < thread->n_connections; i++) {
+    LoadgenConnection* conn = &thread->connections[i];
+    conn->fd = connect_to_server(config);
+    set_request(conn, ACTION_LOGIN, LOADGEN_PASSWORD);
+    int32_t code = round_trip(conn);
+    if (code != LOGIN_ERROR_SUCCESS) {
+      fprintf(stderr, "Load generator login for %s failed with code %d\n",
+              conn->username, code);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  pthread_barrier_wait(thread->barrier);
+
+  uint64_t start_ns = monotonic_ns();
+  uint64_t end_ns = start_ns + (uint64_t)(config->duration_s * 1e9);
+
+  // Open loop: requests are due on a fixed schedule, and latency is measured
+  // from the intended send time so a stalled server cannot hide its backlog
+  bool open_loop = config->rate > 0;
+  uint64_t interval_ns =
+      open_loop ? (uint64_t)(1e9 * config->n_threads / config->rate) : 0;
+  uint64_t next_due_ns = start_ns;
+
+  struct pollfd* fds = calloc(thread->n_connections, sizeof(struct pollfd));
+  size_t* fd_conn = calloc(thread->n_connections, sizeof(size_t));
+
+  uint64_t now_ns;
+  while (!sigint_received && (now_ns = monotonic_ns()) < end_ns) {
+    for (size_t i = 0; i < thread->n_connections; i++) {
+      LoadgenConnection* conn = &thread->connections[i];
+      if (conn->busy)
+        continue;
+      if (!open_loop) {
+        issue(thread, conn, now_ns);
+      } else if (next_due_ns <= now_ns) {
+        issue(thread, conn, next_due_ns);
+        next_due_ns += interval_ns;
+      }
+    }
+
+    size_t n_fds = 0;
+    for (size_t i = 0; i < thread->n_connections; i++) {
+      if (!thread->connections[i].busy)
+        continue;
+      fds[n_fds].fd = thread->connections[i].fd;
+      fds[n_fds].events = POLLIN;
+      fd_conn[n_fds++] = i;
+    }
+
+    uint64_t timeout_ns = LOADGEN_IDLE_POLL_MS * 1'000'000ULL;
+    if (open_loop) {
+      timeout_ns = next_due_ns > now_ns ? next_due_ns - now_ns : 0;
+    }
+    struct timespec timeout = {.tv_sec = timeout_ns / 1'000'000'000,
+                               .tv_nsec = timeout_ns % 1'000'000'000};
+    if (ppoll(fds, n_fds, &timeout, nullptr) <= 0)
+      continue;
+
+    for (size_t i = 0; i < n_fds; i++) {
+      if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+        complete(thread, &thread->connections[fd_conn[i]], true);
+    }
+  }
+
+  // Drain in-flight operations without recording them, then log out
+  for (size_t i = 0; i < thread->n_connections; i++) {
+    LoadgenConnection* conn = &thread->connections[i];
+    while (conn->busy) {
+      complete(thread, conn, false);
+    }
+    set_request(conn, ACTION_LOGOUT, nullptr);
+    round_trip(conn);
+    close(conn->fd);
+  }
+
+  free(fds);
+  free(fd_conn);
+  return nullptr;
+}
+
+static bool parse_mix(const char* spec, uint32_t* mix) {
+  memset(mix, 0, sizeof(uint32_t) * LOADGEN_N_OPS);
+  char* spec_copy = strdup(spec);
+  char* saveptr;
+  bool ok = true;
+  uint32_t total = 0;
+
+  for (char* token = strtok_r(spec_copy, ",", &saveptr); token != nullptr;
+       token = strtok_r(nullptr, ",", &saveptr)) {
+    char* weight = strchr(token, '=');
+    if (weight == nullptr) {
+      ok = false;
+      break;
+    }
+    *weight++ = '\0';
+
+    int op = 0;
+    while (op < LOADGEN_N_OPS && strcmp(op_names[op], token) != 0) {
+      op++;
+    }
+    if (op == LOADGEN_N_OPS) {
+      ok = false;
+      break;
+    }
+    mix[op] = strtoul(weight, nullptr, 10);
+    total += mix[op];
+  }
+
+  free(spec_copy);
+  return ok && total > 0;
+}
+
+static void print_usage() {
+  fprintf(stderr,
+          "usage: pa3_client <address> --bench [-c connections] [-t threads] "
+          "[-d seconds]\n"
+          "                  [-r requests/s (0 = closed loop)] "
+          "[-m login=1,book=4,cancel=2,query=8,confirm=1]\n"
+          "                  [-k hot_fraction:hot_seats] [-s seats] "
+          "[-o json file|-]\n");
+}
+
+static void write_json(FILE* out, const LoadgenConfig* config, double elapsed_s,
+                       const Histogram* histograms, const uint64_t* errors) {
+  fprintf(out,
+          "{\"connections\": %d, \"threads\": %d, \"duration_s\": %.3f, "
+          "\"mode\": \"%s\", \"target_rate\": %.1f, \"ops\": {",
+          config->n_connections, config->n_threads, elapsed_s,
+          config->rate > 0 ? "open" : "closed", config->rate);
+  for (int i = 0; i <= LOADGEN_N_OPS; i++) {
+    const Histogram* h = &histograms[i];
+    fprintf(out,
+            "%s\"%s\": {\"requests\": %lu, \"errors\": %lu, "
+            "\"throughput\": %.1f, \"mean_us\": %.2f, \"p50_us\": %.2f, "
+            "\"p99_us\": %.2f, \"p999_us\": %.2f, \"max_us\": %.2f}",
+            i > 0 ? ", " : "", i < LOADGEN_N_OPS ? op_names[i] : "total",
+            h->total, errors[i], h->total / elapsed_s, histogram_mean(h) / 1e3,
+            histogram_percentile(h, 50.0) / 1e3,
+            histogram_percentile(h, 99.0) / 1e3,
+            histogram_percentile(h, 99.9) / 1e3, h->max / 1e3);
+  }
+  fprintf(out, "}}\n");
+}
+
+static void print_report(const LoadgenConfig* config, double elapsed_s,
+                         const Histogram* histograms, const uint64_t* errors) {
+  printf("Ran %.2f s with %d connections on %d threads, ", elapsed_s,
+         config->n_connections, config->n_threads);
+  if (config->rate > 0)
+    printf("open loop at %.0f requests/s\n", config->rate);
+  else
+    printf("closed loop\n");
+
+  printf("%-8s %10s %8s %10s %9s %9s %9s %9s %9s\n", "op", "requests",
+         "errors", "req/s", "mean us", "p50 us", "p99 us", "p999 us",
+         "max us");
+  for (int i = 0; i <= LOADGEN_N_OPS; i++) {
+    const Histogram* h = &histograms[i];
+    if (h->total == 0 && i < LOADGEN_N_OPS)
+      continue;
+    printf("%-8s %10lu %8lu %10.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+           i < LOADGEN_N_OPS ? op_names[i] : "total", h->total, errors[i],
+           h->total / elapsed_s, histogram_mean(h) / 1e3,
+           histogram_percentile(h, 50.0) / 1e3,
+           histogram_percentile(h, 99.0) / 1e3,
+           histogram_percentile(h, 99.9) / 1e3, h->max / 1e3);
+  }
+}
+
+int32_t loadgen_main(int32_t argc,
+                     char* argv[],
+                     char* hostname,
+                     uint64_t port,
+                     const char* socket_path) {
+  LoadgenConfig config = {.hostname = hostname,
+                          .port = port,
+                          .socket_path = socket_path,
+                          .n_connections = 16,
+                          .n_threads = 4,
+                          .duration_s = 10.0,
+                          .rate = 0.0,
+                          .mix = {1, 4, 2, 8, 1},
+                          .hot_fraction = 0.0,
+                          .hot_seats = 0,
+                          .n_seats = 100,
+                          .json_path = nullptr};
+
+  int32_t opt;
+  while ((opt = getopt(argc, argv, "c:t:d:r:m:k:s:o:")) != -1) {
+    switch (opt) {
+      case 'c':
+        config.n_connections = strtol(optarg, nullptr, 10);
+        break;
+      case 't':
+        config.n_threads = strtol(optarg, nullptr, 10);
+        break;
+      case 'd':
+        config.duration_s = strtod(optarg, nullptr);
+        break;
+      case 'r':
+        config.rate = strtod(optarg, nullptr);
+        break;
+      case 'm':
+        if (!parse_mix(optarg, config.mix)) {
+          fprintf(stderr, "Invalid workload mix: %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 'k':
+        if (sscanf(optarg, "%lf:%u", &config.hot_fraction,
+                   &config.hot_seats) != 2) {
+          fprintf(stderr, "Invalid hot-seat skew: %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 's':
+        config.n_seats = strtoul(optarg, nullptr, 10);
+        break;
+      case 'o':
+        config.json_path = optarg;
+        break;
+      default:
+        print_usage();
+        return 1;
+    }
+  }
+
+  if (optind != argc || config.n_connections <= 0 || config.n_threads <= 0 ||
+      config.duration_s <= 0 || config.n_seats == 0 ||
+      config.hot_seats > config.n_seats) {
+    print_usage();
+    return 1;
+  }
+  if (config.n_threads > config.n_connections)
+    config.n_threads = config.n_connections;
+
+  LoadgenConnection* connections =
+      calloc(config.n_connections, sizeof(LoadgenConnection));
+  LoadgenThread* threads = calloc(config.n_threads, sizeof(LoadgenThread));
+  pthread_t* tids = malloc(sizeof(pthread_t) * config.n_threads);
+  pthread_barrier_t barrier;
+  pthread_barrier_init(&barrier, nullptr, config.n_threads + 1);
+
+  for (int i = 0; i < config.n_connections; i++) {
+    snprintf(connections[i].username, sizeof(connections[i].username),
+             "bench%d_%d", getpid(), i);
+  }
+
+  // Connections are split into contiguous, near-equal runs per thread
+  size_t first = 0;
+  for (int i = 0; i < config.n_threads; i++) {
+    size_t count = config.n_connections / config.n_threads +
+                   (i < config.n_connections % config.n_threads);
+    threads[i].config = &config;
+    threads[i].barrier = &barrier;
+    threads[i].connections = &connections[first];
+    threads[i].n_connections = count;
+    threads[i].rng = 0x9E3779B97F4A7C15ULL * (i + 1) ^ getpid();
+    for (int j = 0; j < LOADGEN_N_OPS; j++) {
+      histogram_init(&threads[i].histograms[j]);
+    }
+    first += count;
+  }
+
+  for (int i = 0; i < config.n_threads; i++) {
+    pthread_create(&tids[i], nullptr, loadgen_thread_func, &threads[i]);
+  }
+
+  // Every connection is logged in once the barrier opens
+  pthread_barrier_wait(&barrier);
+  uint64_t start_ns = monotonic_ns();
+
+  for (int i = 0; i < config.n_threads; i++) {
+    pthread_join(tids[i], nullptr);
+  }
+  double elapsed_s = (monotonic_ns() - start_ns) / 1e9;
+  if (elapsed_s > config.duration_s)
+    elapsed_s = config.duration_s;
+
+  // Index LOADGEN_N_OPS holds the totals across all operations
+  Histogram* merged = malloc(sizeof(Histogram) * (LOADGEN_N_OPS + 1));
+  uint64_t errors[LOADGEN_N_OPS + 1] = {0};
+  for (int j = 0; j <= LOADGEN_N_OPS; j++) {
+    histogram_init(&merged[j]);
+  }
+  for (int i = 0; i < config.n_threads; i++) {
+    for (int j = 0; j < LOADGEN_N_OPS; j++) {
+      histogram_merge(&merged[j], &threads[i].histograms[j]);
+      histogram_merge(&merged[LOADGEN_N_OPS], &threads[i].histograms[j]);
+      errors[j] += threads[i].errors[j];
+      errors[LOADGEN_N_OPS] += threads[i].errors[j];
+    }
+  }
+
+  print_report(&config, elapsed_s, merged, errors);
+  if (config.json_path != nullptr) {
+    bool to_stdout = strcmp(config.json_path, "-") == 0;
+    FILE* out = to_stdout ? stdout : fopen(config.json_path, "w");
+    if (out == nullptr) {
+      perror("fopen failed");
+    } else {
+      write_json(out, &config, elapsed_s, merged, errors);
+      if (!to_stdout)
+        fclose(out);
+    }
+  }
+
+  pthread_barrier_destroy(&barrier);
+  free(merged);
+  free(tids);
+  free(threads);
+  free(connections);
+  return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef CLIENT_LOADGEN_H
+#define CLIENT_LOADGEN_H
+#include <helper.h>
+
+typedef enum {
+  LOADGEN_OP_LOGIN,
+  LOADGEN_OP_BOOK,
+  LOADGEN_OP_CANCEL,
+  LOADGEN_OP_QUERY,
+  LOADGEN_OP_CONFIRM,
+  LOADGEN_N_OPS
+} LoadgenOp;
+
+typedef struct {
+  char* hostname;
+  uint64_t port;
+  const char* socket_path;
+  int32_t n_connections;
+  int32_t n_threads;
+  double duration_s;
+  double rate;  // total requests per second, 0 means closed loop
+  uint32_t mix[LOADGEN_N_OPS];
+  double hot_fraction;
+  uint32_t hot_seats;
+  uint32_t n_seats;
+  const char* json_path;
+} LoadgenConfig;
+
+// argv[0] is "--bench", the remaining arguments are load generator options
+int32_t loadgen_main(int32_t argc,
+                     char* argv[],
+                     char* hostname,
+                     uint64_t port,
+                     const char* socket_path);
+#endif
@@ -0,0 +1,262 @@
+#include "replay.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "handle_response.h"
+#include "helper.h"
+#include "trace.h"
+
+typedef struct {
+  int32_t fd;
+  size_t start;
+  size_t end;
+  uint8_t data[REPLAY_BUFFER_SIZE];
+} ReplayBuffer;
+
+typedef struct {
+  Request* requests;
+  size_t window;
+  size_t head;
+  size_t count;
+} InFlight;
+
+static bool read_buffered(ReplayBuffer* in, void* dst, size_t count) {
+  uint8_t* dst_bytes = dst;
+  while (count > 0) {
+    if (in->start == in->end) {
+      ssize_t n_read = sigint_safe_read(in->fd, in->data, REPLAY_BUFFER_SIZE);
+      if (n_read <= 0)
+        return false;
+      in->start = 0;
+      in->end = n_read;
+    }
+    size_t n_copy = in->end - in->start;
+    if (n_copy > count)
+      n_copy = count;
+    memcpy(dst_bytes, in->data + in->start, n_copy);
+    in->start += n_copy;
+    dst_bytes += n_copy;
+    count -= n_copy;
+  }
+  return true;
+}
+
+static void receive_response_buffered(ReplayBuffer* in, Response* response) {
+  default_response(response);
+  if (!read_buffered(in, &response->code, sizeof(int32_t))) {
+    perror("read response code failed");
+    exit(EXIT_FAILURE);
+  }
+
+  if (!read_buffered(in, &response->data_size, sizeof(uint64_t))) {
+    perror("read data size failed");
+    exit(EXIT_FAILURE);
+  }
+
+  if (response->data_size > 0) {
+    response->data = malloc(response->data_size);
+    if (response->data == nullptr) {
+      perror("malloc for response data failed");
+      exit(EXIT_FAILURE);
+    }
+
+    if (!read_buffered(in, response->data, response->data_size)) {
+      perror("read data failed");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+// Appends whatever has arrived to in, without waiting for more
+static void receive_available(ReplayBuffer* in) {
+  if (in->start > 0) {
+    memmove(in->data, in->data + in->start, in->end - in->start);
+    in->end -= in->start;
+    in->start = 0;
+  }
+  if (in->end == REPLAY_BUFFER_SIZE)
+    return;
+  ssize_t n_read = recv(in->fd, in->data + in->end,
+                        REPLAY_BUFFER_SIZE - in->end, MSG_DONTWAIT);
+  if (n_read == 0) {
+    fprintf(stderr, "Server closed the connection\n");
+    exit(EXIT_FAILURE);
+  }
+  if (n_read < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+      return;
+    perror("read response failed");
+    exit(EXIT_FAILURE);
+  }
+  in->end += n_read;
+}
+
+// True when the next frame is buffered whole, or has filled the buffer:
+// the server sends a frame in one go once it has started it, so reading
+// the rest of one does not wait on the requests still to be written
+static bool frame_buffered(const ReplayBuffer* in) {
+  size_t available = in->end - in->start;
+  if (available < RESPONSE_HEADER_SIZE)
+    return false;
+  if (available == REPLAY_BUFFER_SIZE)
+    return true;
+  uint64_t data_size;
+  memcpy(&data_size, in->data + in->start + sizeof(int32_t),
+         sizeof(uint64_t));
+  return available - RESPONSE_HEADER_SIZE >= data_size;
+}
+
+// Handles the next frame, a response or a waitlist notice
+static void complete_next(InFlight* in_flight,
+                          ReplayBuffer* in,
+                          const char** active_user) {
+  Response response;
+  receive_response_buffered(in, &response);
+  if (response.code == WAITLIST_NOTICE_SEAT_ASSIGNED) {
+    handle_waitlist_notice(&response);
+    free_response(&response);
+    return;
+  }
+  if (in_flight->count == 0) {
+    fprintf(stderr, "Response to no request received\n");
+    exit(EXIT_FAILURE);
+  }
+  Request* request = &in_flight->requests[in_flight->head];
+  handle_response(request->action, request, &response, active_user);
+  free_response(&response);
+  in_flight->head = (in_flight->head + 1) % in_flight->window;
+  in_flight->count--;
+}
+
+// Responses arrive in request order, so the oldest in-flight request owns
+// the next response. Requests are views into the trace, nothing to free.
+static void complete_oldest(InFlight* in_flight,
+                            ReplayBuffer* in,
+                            const char** active_user) {
+  size_t count = in_flight->count;
+  while (in_flight->count == count)
+    complete_next(in_flight, in, active_user);
+}
+
+// The server blocks sending responses nobody reads, so while requests are
+// written the responses already there are read too; otherwise a large
+// window fills both socket buffers and neither side moves
+static void flush_requests(ReplayBuffer* out,
+                           InFlight* in_flight,
+                           ReplayBuffer* in,
+                           const char** active_user) {
+  size_t start = 0;
+  while (start < out->end) {
+    struct pollfd pfd = {.fd = out->fd, .events = POLLIN | POLLOUT};
+    if (poll(&pfd, 1, -1) < 0) {
+      if (errno == EINTR && !sigint_received)
+        continue;
+      perror("poll failed");
+      exit(EXIT_FAILURE);
+    }
+    if (pfd.revents & POLLIN) {
+      receive_available(in);
+      while (frame_buffered(in))
+        complete_next(in_flight, in, active_user);
+      continue;
+    }
+    if (pfd.revents & (POLLERR | POLLHUP)) {
+      fprintf(stderr, "Server closed the connection\n");
+      exit(EXIT_FAILURE);
+    }
+    if (pfd.revents & POLLOUT) {
+      ssize_t n_sent = send(out->fd, out->data + start, out->end - start,
+                            MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (n_sent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+          continue;
+        perror("write request failed");
+        exit(EXIT_FAILURE);
+      }
+      start += n_sent;
+    }
+  }
+  out->end = 0;
+}
+
+static void drain(InFlight* in_flight,
+                  ReplayBuffer* out,
+                  ReplayBuffer* in,
+                  const char** active_user) {
+  flush_requests(out, in_flight, in, active_user);
+  while (in_flight->count > 0) {
+    complete_oldest(in_flight, in, active_user);
+  }
+}
+
+static void queue_request(ReplayBuffer* out,
+                          Request* request,
+                          InFlight* in_flight,
+                          ReplayBuffer* in,
+                          const char** active_user) {
+  size_t frame_size = request_frame_size(request);
+  if (frame_size > REPLAY_BUFFER_SIZE - out->end)
+    flush_requests(out, in_flight, in, active_user);
+  if (frame_size > REPLAY_BUFFER_SIZE) {
+    // Sent blocking, so nothing may be left unread first
+    drain(in_flight, out, in, active_user);
+    send_request(out->fd, request);
+    return;
+  }
+  encode_request(request, out->data + out->end);
+  out->end += frame_size;
+}
+
+bool replay_file(int32_t sockfd,
+                 const char* path,
+                 size_t window,
+                 const char** active_user) {
+  TraceFile trace;
+  if (!trace_open(&trace, path))
+    return false;
+
+  InFlight in_flight = {.requests = malloc(sizeof(Request) * window),
+                        .window = window,
+                        .head = 0,
+                        .count = 0};
+  ReplayBuffer* out = calloc(1, sizeof(ReplayBuffer));
+  ReplayBuffer* in = calloc(1, sizeof(ReplayBuffer));
+  out->fd = sockfd;
+  in->fd = sockfd;
+
+  char* line;
+  while ((line = trace_next_line(&trace)) != nullptr && !sigint_received) {
+    Request request;
+    ParsingError parsing_error =
+        parse_request_view(&request, line, active_user);
+    if (parsing_error != PARSING_SUCCESS)
+      continue;
+
+    if (in_flight.count == window) {
+      flush_requests(out, &in_flight, in, active_user);
+      // Flushing may have completed some already
+      if (in_flight.count == window)
+        complete_oldest(&in_flight, in, active_user);
+    }
+    queue_request(out, &request, &in_flight, in, active_user);
+    in_flight.requests[(in_flight.head + in_flight.count) % window] = request;
+    in_flight.count++;
+
+    // Parsing the following lines depends on the active user, which only
+    // login, resume and logout responses can change
+    if (request.action == ACTION_LOGIN || request.action == ACTION_RESUME ||
+        request.action == ACTION_LOGOUT)
+      drain(&in_flight, out, in, active_user);
+  }
+  drain(&in_flight, out, in, active_user);
+
+  trace_close(&trace);
+  free(in);
+  free(out);
+  free(in_flight.requests);
+  return true;
+}
@@ -0,0 +1,14 @@
+#ifndef CLIENT_REPLAY_H
+#define CLIENT_REPLAY_H
+#include <helper.h>
+
+#define REPLAY_DEFAULT_WINDOW 1
+#define REPLAY_MAX_WINDOW 65536
+#define REPLAY_BUFFER_SIZE 65536
+
+// Replays a request file keeping up to window requests in flight
+bool replay_file(int32_t sockfd,
+                 const char* path,
+                 size_t window,
+                 const char** active_user);
+#endif
@@ -0,0 +1,235 @@
+#include "trace.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "helper.h"
+
+// Non-regular files (pipes, /dev/stdin) cannot be mapped and are read into
+// one buffer instead
+static bool read_whole_file(TraceFile* trace, int32_t fd) {
+  size_t capacity = 1 << 16;
+  trace->data = malloc(capacity + 1);
+  trace->size = 0;
+  for (;;) {
+    if (trace->size == capacity) {
+      capacity *= 2;
+      trace->data = realloc(trace->data, capacity + 1);
+    }
+    ssize_t n_read =
+        sigint_safe_read(fd, trace->data + trace->size, capacity - trace->size);
+    if (n_read < 0) {
+      perror("read failed");
+      free(trace->data);
+      return false;
+    }
+    if (n_read == 0)
+      break;
+    trace->size += n_read;
+  }
+  trace->data[trace->size] = '\0';
+  return true;
+}
+
+bool trace_open(TraceFile* trace, const char* path) {
+  *trace = (TraceFile){0};
+
+  int32_t fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror("open failed");
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    bool ok = read_whole_file(trace, fd);
+    close(fd);
+    return ok;
+  }
+
+  // A private writable mapping lets lines be NUL-terminated in place
+  trace->size = st.st_size;
+  trace->data = mmap(nullptr, trace->size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                     fd, 0);
+  close(fd);
+  if (trace->data == MAP_FAILED) {
+    perror("mmap failed");
+    return false;
+  }
+  trace->mapped = true;
+  madvise(trace->data, trace->size, MADV_SEQUENTIAL);
+  return true;
+}
+
+char* trace_next_line(TraceFile* trace) {
+  if (trace->offset >= trace->size)
+    return nullptr;
+
+  char* line = trace->data + trace->offset;
+  size_t remaining = trace->size - trace->offset;
+  char* newline = memchr(line, '\n', remaining);
+  if (newline != nullptr) {
+    *newline = '\0';
+    trace->offset += newline - line + 1;
+    return line;
+  }
+
+  // Unterminated last line: the byte after it is only writable when the file
+  // does not end exactly on a page boundary
+  trace->offset = trace->size;
+  if (!trace->mapped || trace->size % sysconf(_SC_PAGESIZE) != 0) {
+    line[remaining] = '\0';
+    return line;
+  }
+  trace->tail = strndup(line, remaining);
+  return trace->tail;
+}
+
+void trace_close(TraceFile* trace) {
+  if (trace->mapped)
+    munmap(trace->data, trace->size);
+  else
+    free(trace->data);
+  free(trace->tail);
+  *trace = (TraceFile){0};
+}
+
+Action action_from_token(const char* token, size_t length) {
+  switch (length) {
+    case 4:
+      if (token[0] == 'b' && memcmp(token, "book", 4) == 0)
+        return ACTION_BOOK;
+      break;
+    case 5:
+      if (token[0] == 'l' && memcmp(token, "login", 5) == 0)
+        return ACTION_LOGIN;
+      if (token[0] == 'q' && memcmp(token, "query", 5) == 0)
+        return ACTION_QUERY;
+      if (token[0] == 's' && memcmp(token, "stats", 5) == 0)
+        return ACTION_STATS;
+      break;
+    case 6:
+      if (token[0] == 'l' && memcmp(token, "logout", 6) == 0)
+        return ACTION_LOGOUT;
+      if (token[0] == 'r' && memcmp(token, "resume", 6) == 0)
+        return ACTION_RESUME;
+      break;
+    case 8:
+      if (token[0] == 'w' && memcmp(token, "waitlist", 8) == 0)
+        return ACTION_WAITLIST;
+      break;
+    case 9:
+      if (token[0] == 'b' && memcmp(token, "batchbook", 9) == 0)
+        return ACTION_BATCH_BOOK;
+      break;
+    case 13:
+      if (token[0] == 'c' && memcmp(token, "cancelbooking", 13) == 0)
+        return ACTION_CANCEL_BOOKING;
+      break;
+    case 14:
+      if (token[0] == 'c' && memcmp(token, "confirmbooking", 14) == 0)
+        return ACTION_CONFIRM_BOOKING;
+      break;
+  }
+
+  // Spellings such as "cancel-booking" go through the normalizing parser
+  for (size_t i = 0; i < length; i++) {
+    if (isspace((unsigned char)token[i]) || ispunct((unsigned char)token[i]))
+      return to_action(token);
+  }
+  return ACTION_INVALID;
+}
+
+// strtok_r(..., " ", ...) without the hidden state: skips leading spaces and
+// terminates the token in place
+static char* next_token(char** cursor, size_t* length) {
+  char* start = *cursor;
+  while (*start == ' ') {
+    start++;
+  }
+  if (*start == '\0') {
+    *cursor = start;
+    return nullptr;
+  }
+
+  char* end = start;
+  while (*end != '\0' && *end != ' ') {
+    end++;
+  }
+  *length = end - start;
+  *cursor = (*end == '\0') ? end : end + 1;
+  *end = '\0';
+  return start;
+}
+
+ParsingError parse_request_view(Request* request,
+                                char* line,
+                                const char** active_user) {
+  default_request(request);
+
+  char* cursor = line;
+  size_t length = 0;
+  char* token = next_token(&cursor, &length);
+  if (token == nullptr) {
+    fprintf(stderr, "Please enter the action!\n");
+    return PARSING_NO_ACTION;
+  }
+
+  request->action = action_from_token(token, length);
+  if (request->action == ACTION_INVALID) {
+    fprintf(stderr, "Invalid action received!\n");
+    return PARSING_INVALID_ACTION;
+  }
+  if (request->action == ACTION_STATS)
+    return PARSING_SUCCESS;
+  bool logs_in =
+      request->action == ACTION_LOGIN || request->action == ACTION_RESUME;
+  if (!logs_in) {
+    if (active_user == nullptr || *active_user == nullptr) {
+      fprintf(stderr, "User is not logged in!\n");
+      default_request(request);
+      return PARSING_NOT_LOGGED_IN;
+    }
+    request->username = (char*)*active_user;
+    request->username_length = strlen(*active_user);
+  } else if (active_user != nullptr && *active_user != nullptr) {
+    fprintf(stderr, "Client is already serving user %s!\n", *active_user);
+    default_request(request);
+    return PARSING_ALREADY_LOGGED_IN;
+  }
+
+  if (request->action == ACTION_LOGOUT)
+    return PARSING_SUCCESS;
+
+  token = next_token(&cursor, &length);
+  if (token == nullptr) {
+    fprintf(stderr, "Please enter the action and data!\n");
+    default_request(request);
+    return PARSING_NO_DATA;
+  }
+
+  if (!logs_in) {
+    request->data = token;
+    request->data_size = length;
+    return PARSING_SUCCESS;
+  }
+
+  request->username = token;
+  request->username_length = length;
+
+  token = next_token(&cursor, &length);
+  if (token == nullptr) {
+    fprintf(stderr, request->action == ACTION_RESUME
+                        ? "Please enter your resume token!\n"
+                        : "Please enter your password!\n");
+    default_request(request);
+    return PARSING_NO_DATA;
+  }
+  request->data = token;
+  request->data_size = length;
+  return PARSING_SUCCESS;
+}
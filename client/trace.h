@@ -0,0 +1,27 @@
+#ifndef CLIENT_TRACE_H
+#define CLIENT_TRACE_H
+#include <helper.h>
+
+// Request file mapped into memory and tokenized in place. Lines are handed
+// out NUL-terminated inside the mapping, so no per-line heap allocation
+// happens while scanning.
+typedef struct {
+  char* data;
+  size_t size;
+  size_t offset;
+  bool mapped;
+  char* tail;  // copy of an unterminated last line that ends on a page edge
+} TraceFile;
+
+bool trace_open(TraceFile* trace, const char* path);
+char* trace_next_line(TraceFile* trace);
+void trace_close(TraceFile* trace);
+
+Action action_from_token(const char* token, size_t length);
+
+// Same rules and diagnostics as parse_request, but the request only points
+// into line and *active_user; it must not be passed to free_request
+ParsingError parse_request_view(Request* request,
+                                char* line,
+                                const char** active_user);
+#endif
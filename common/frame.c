@@ -0,0 +1,89 @@
+#include "helper.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void default_request(Request* request) {
+  request->username = nullptr;
+  request->username_length = 0;
+  request->data = nullptr;
+  request->data_size = 0;
+  request->action = ACTION_INVALID;
+}
+
+void free_request(Request* request) {
+  if (request->username != nullptr) {
+    free(request->username);
+    request->username = nullptr;
+  }
+  if (request->data != nullptr) {
+    free(request->data);
+    request->data = nullptr;
+  }
+}
+
+void default_response(Response* response) {
+  response->data = nullptr;
+  response->data_size = 0;
+  response->code = 0;
+  response->shared = nullptr;
+}
+
+void free_response(Response* response) {
+  if (response->shared != nullptr) {
+    shared_buffer_unref(response->shared);
+    response->shared = nullptr;
+    response->data = nullptr;
+  } else if (response->data != nullptr) {
+    free(response->data);
+    response->data = nullptr;
+  }
+}
+
+SharedBuffer* shared_buffer_new(size_t size) {
+  SharedBuffer* buffer = malloc(sizeof(SharedBuffer) + size);
+  if (buffer == nullptr) {
+    perror("malloc failed");
+    exit(EXIT_FAILURE);
+  }
+  buffer->refs = 1;
+  buffer->size = size;
+  return buffer;
+}
+
+SharedBuffer* shared_buffer_ref(SharedBuffer* buffer) {
+  __atomic_fetch_add(&buffer->refs, 1, __ATOMIC_RELAXED);
+  return buffer;
+}
+
+void shared_buffer_unref(SharedBuffer* buffer) {
+  // Acquire-release, so every reader is done before it is freed
+  if (__atomic_sub_fetch(&buffer->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    free(buffer);
+}
+
+size_t request_frame_size(const Request* request) {
+  return sizeof(Action) + 2 * sizeof(uint64_t) + request->username_length +
+         request->data_size;
+}
+
+// Writes the wire frame of a request; buf must hold request_frame_size bytes
+void encode_request(const Request* request, uint8_t* buf) {
+  memcpy(buf, &request->action, sizeof(Action));
+  buf += sizeof(Action);
+  memcpy(buf, &request->username_length, sizeof(uint64_t));
+  buf += sizeof(uint64_t);
+  if (request->username_length > 0)
+    memcpy(buf, request->username, request->username_length);
+  buf += request->username_length;
+  memcpy(buf, &request->data_size, sizeof(uint64_t));
+  buf += sizeof(uint64_t);
+  if (request->data_size > 0)
+    memcpy(buf, request->data, request->data_size);
+}
+
+// Reads the fixed-size part of a response frame (code and data size)
+void decode_response_header(const uint8_t* buf, Response* response) {
+  memcpy(&response->code, buf, sizeof(int32_t));
+  memcpy(&response->data_size, buf + sizeof(int32_t), sizeof(uint64_t));
+}
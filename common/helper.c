@@ -5,7 +5,11 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 
 void sigint_handler(int32_t signum) {
   if (signum == SIGINT)
@@ -18,32 +22,6 @@ void setup_sigint_handler() {
   sigaction(SIGINT, &action, nullptr);
 }
 
-void default_request(Request* request) {
-  request->username = nullptr;
-  request->username_length = 0;
-  request->data = nullptr;
-  request->data_size = 0;
-  request->action = ACTION_INVALID;
-}
-
-void free_request(Request* request) {
-  if (request->username != nullptr) {
-    free(request->username);
-    request->username = nullptr;
-  }
-  if (request->data != nullptr) {
-    free(request->data);
-    request->data = nullptr;
-  }
-}
-
-void free_response(Response* response) {
-  if (response->data != nullptr) {
-    free(response->data);
-    response->data = nullptr;
-  }
-}
-
 ssize_t sigint_safe_write(int32_t fd, void* buf, size_t count) {
   ssize_t n_written;
   do {
@@ -59,3 +37,121 @@ ssize_t sigint_safe_read(int32_t fd, void* buf, size_t count) {
   } while (n_read < 0 && errno == EINTR);
   return n_read;
 }
+
+// Loops over short reads/writes; returns 0 on EOF, -1 on error, else count
+ssize_t sigint_safe_read_all(int32_t fd, void* buf, size_t count) {
+  size_t n_done = 0;
+  while (n_done < count) {
+    ssize_t n_read = sigint_safe_read(fd, (uint8_t*)buf + n_done, count - n_done);
+    if (n_read <= 0)
+      return n_read;
+    n_done += n_read;
+  }
+  return n_done;
+}
+
+ssize_t sigint_safe_write_all(int32_t fd, const void* buf, size_t count) {
+  size_t n_done = 0;
+  while (n_done < count) {
+    ssize_t n_written =
+        sigint_safe_write(fd, (uint8_t*)buf + n_done, count - n_done);
+    if (n_written < 0)
+      return n_written;
+    n_done += n_written;
+  }
+  return n_done;
+}
+
+ssize_t sigint_safe_writev_all(int32_t fd, struct iovec* iov, int32_t iovcnt) {
+  size_t n_done = 0;
+  while (iovcnt > 0) {
+    ssize_t n_written = writev(fd, iov, iovcnt);
+    if (n_written < 0) {
+      if (errno == EINTR)
+        continue;
+      return n_written;
+    }
+    n_done += n_written;
+
+    // Skip the fully written vectors and trim the partially written one
+    while (iovcnt > 0 && (size_t)n_written >= iov->iov_len) {
+      n_written -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (uint8_t*)iov->iov_base + n_written;
+      iov->iov_len -= n_written;
+    }
+  }
+  return n_done;
+}
+
+uint64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1'000'000'000 + ts.tv_nsec;
+}
+
+bool remove_stale_socket(const char* socket_path) {
+  struct stat st;
+  if (lstat(socket_path, &st) < 0) {
+    if (errno == ENOENT)
+      return true;
+    perror("lstat");
+    return false;
+  }
+  if (!S_ISSOCK(st.st_mode)) {
+    fprintf(stderr, "%s exists and is not a socket\n", socket_path);
+    return false;
+  }
+  if (unlink(socket_path) < 0) {
+    perror("unlink");
+    return false;
+  }
+  return true;
+}
+
+// Framing-related functions
+bool receive_request(int32_t fd, Request* request) {
+  if (sigint_safe_read_all(fd, &request->action, sizeof(Action)) <= 0 ||
+      sigint_safe_read_all(fd, &request->username_length, sizeof(uint64_t)) <=
+          0 ||
+      request->username_length > MAX_REQUEST_FIELD_SIZE)
+    return false;
+
+  if (request->username_length > 0) {
+    request->username = malloc(request->username_length + 1);
+    if (sigint_safe_read_all(fd, request->username,
+                             request->username_length) <= 0) {
+      free_request(request);
+      return false;
+    }
+    request->username[request->username_length] = '\0';
+  }
+
+  if (sigint_safe_read_all(fd, &request->data_size, sizeof(uint64_t)) <= 0 ||
+      request->data_size > MAX_REQUEST_FIELD_SIZE) {
+    free_request(request);
+    return false;
+  }
+
+  if (request->data_size > 0) {
+    request->data = malloc(request->data_size + 1);
+    if (sigint_safe_read_all(fd, request->data, request->data_size) <= 0) {
+      free_request(request);
+      return false;
+    }
+    request->data[request->data_size] = '\0';
+  }
+  return true;
+}
+
+bool send_response(int32_t fd, Response* response) {
+  // Send response as a single write
+  struct iovec response_iov[3] = {
+      {.iov_base = &response->code, .iov_len = sizeof(int32_t)},
+      {.iov_base = &response->data_size, .iov_len = sizeof(uint64_t)},
+      {.iov_base = response->data, .iov_len = response->data_size}};
+  return sigint_safe_writev_all(fd, response_iov, 3) > 0;
+}
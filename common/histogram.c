@@ -0,0 +1,90 @@
+#include "histogram.h"
+#include <string.h>
+
+static size_t bucket_index(uint64_t value) {
+  if (value < HISTOGRAM_SUB_BUCKETS)
+    return value;
+
+  size_t magnitude = 63 - __builtin_clzll(value);
+  if (magnitude > HISTOGRAM_MAX_MAGNITUDE)
+    return HISTOGRAM_BUCKETS - 1;
+
+  size_t shift = magnitude - HISTOGRAM_SUB_BUCKET_BITS + 1;
+  return HISTOGRAM_SUB_BUCKETS + (shift - 1) * HISTOGRAM_HALF_BUCKETS +
+         ((value >> shift) - HISTOGRAM_HALF_BUCKETS);
+}
+
+// Highest value that falls into the bucket, as HdrHistogram reports it
+static uint64_t bucket_value(size_t index) {
+  if (index < HISTOGRAM_SUB_BUCKETS)
+    return index;
+
+  size_t offset = index - HISTOGRAM_SUB_BUCKETS;
+  size_t shift = offset / HISTOGRAM_HALF_BUCKETS + 1;
+  uint64_t sub_bucket = offset % HISTOGRAM_HALF_BUCKETS + HISTOGRAM_HALF_BUCKETS;
+  return (sub_bucket << shift) + ((uint64_t)1 << shift) - 1;
+}
+
+static uint64_t load_relaxed(const uint64_t* ptr) {
+  return __atomic_load_n(ptr, __ATOMIC_RELAXED);
+}
+
+// Single-writer increment: a plain load/store pair, no locked instruction
+static void add_relaxed(uint64_t* ptr, uint64_t value) {
+  __atomic_store_n(ptr, load_relaxed(ptr) + value, __ATOMIC_RELAXED);
+}
+
+void histogram_init(Histogram* histogram) {
+  memset(histogram, 0, sizeof(Histogram));
+  histogram->min = UINT64_MAX;
+}
+
+void histogram_record(Histogram* histogram, uint64_t value) {
+  add_relaxed(&histogram->counts[bucket_index(value)], 1);
+  add_relaxed(&histogram->total, 1);
+  add_relaxed(&histogram->sum, value);
+  if (value < load_relaxed(&histogram->min))
+    __atomic_store_n(&histogram->min, value, __ATOMIC_RELAXED);
+  if (value > load_relaxed(&histogram->max))
+    __atomic_store_n(&histogram->max, value, __ATOMIC_RELAXED);
+}
+
+void histogram_merge(Histogram* dst, const Histogram* src) {
+  for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    dst->counts[i] += load_relaxed(&src->counts[i]);
+  }
+  dst->total += load_relaxed(&src->total);
+  dst->sum += load_relaxed(&src->sum);
+
+  uint64_t src_min = load_relaxed(&src->min);
+  uint64_t src_max = load_relaxed(&src->max);
+  if (src_min < dst->min)
+    dst->min = src_min;
+  if (src_max > dst->max)
+    dst->max = src_max;
+}
+
+uint64_t histogram_percentile(const Histogram* histogram, double percentile) {
+  if (histogram->total == 0)
+    return 0;
+
+  uint64_t rank = (uint64_t)(percentile / 100.0 * histogram->total + 0.5);
+  if (rank == 0)
+    rank = 1;
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    seen += histogram->counts[i];
+    if (seen >= rank) {
+      uint64_t value = bucket_value(i);
+      return value > histogram->max ? histogram->max : value;
+    }
+  }
+  return histogram->max;
+}
+
+double histogram_mean(const Histogram* histogram) {
+  if (histogram->total == 0)
+    return 0.0;
+  return (double)histogram->sum / histogram->total;
+}
@@ -0,0 +1,29 @@
+#include "shard.h"
+#include <stdlib.h>
+
+bool parse_shard(const char* text, ShardId* shard) {
+  char* end;
+  unsigned long index = strtoul(text, &end, 10);
+  if (end == text || *end != '/')
+    return false;
+  const char* count_text = end + 1;
+  unsigned long count = strtoul(count_text, &end, 10);
+  if (end == count_text || *end != '\0' || count == 0 ||
+      count > MAX_SHARDS || index >= count)
+    return false;
+  *shard = (ShardId){index, count};
+  return true;
+}
+
+void shard_seat_range(ShardId shard, pa3_seat_t* first, pa3_seat_t* last) {
+  *first = (pa3_seat_t)shard.index * NUM_SEATS / shard.count + 1;
+  *last = (pa3_seat_t)(shard.index + 1) * NUM_SEATS / shard.count;
+}
+
+uint32_t shard_of_seat(pa3_seat_t seat, uint32_t count) {
+  // The inverse of shard_seat_range, rounding the same way
+  uint32_t index = (seat - 1) * count / NUM_SEATS;
+  while ((pa3_seat_t)(index + 1) * NUM_SEATS / count < seat)
+    index++;
+  return index;
+}
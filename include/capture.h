@@ -0,0 +1,31 @@
+#ifndef COMMON_CAPTURE_H
+#define COMMON_CAPTURE_H
+
+#include <stdint.h>
+
+// On-disk traffic capture format shared by pa3_server and pa3_replay.
+// A file is one CaptureFileHeader followed by records; each record is a
+// CaptureRecordHeader, then username_length bytes of username and
+// data_size bytes of data. Integers are in host byte order.
+#define CAPTURE_MAGIC "PA3TRACE"
+#define CAPTURE_VERSION 1
+
+// Login passwords and resume tokens never reach the file: both are recorded
+// as this password, which pa3_replay logs in with instead
+#define CAPTURE_REDACTED_PASSWORD "pa3-replay"
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+} CaptureFileHeader;
+
+typedef struct {
+  uint64_t timestamp_ns;  // request arrival, relative to capture start
+  uint64_t connection_id;
+  int32_t action;
+  int32_t response_code;
+  uint32_t username_length;
+  uint32_t data_size;
+} CaptureRecordHeader;
+#endif
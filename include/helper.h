@@ -9,12 +9,19 @@ typedef void* nullptr_t;
 #endif
 
 #include <pthread.h>
+#include <stdalign.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <sys/types.h> // <-- Add this line
+#include <sys/uio.h>
 #include "pa3_error.h"
 
 typedef uint64_t pa3_seat_t;
-extern bool sigint_received;
+#define NUM_SEATS 100
+// Hex characters of the resume token a successful login answers with
+#define RESUME_TOKEN_LENGTH 32
+// Set from the SIGINT handler, read by every thread of the process
+extern atomic_bool sigint_received;
 
 typedef enum {
   ACTION_INVALID = -1,
@@ -24,7 +31,16 @@ typedef enum {
   ACTION_CONFIRM_BOOKING,
   ACTION_CANCEL_BOOKING,
   ACTION_LOGOUT,
-  ACTION_QUERY
+  ACTION_QUERY,
+  ACTION_STATS,
+  ACTION_WAITLIST,
+  ACTION_BATCH_BOOK,
+  // Two-phase batch booking, sent by pa3_router to each shard involved
+  ACTION_PREPARE_BOOK,
+  ACTION_COMMIT_BOOK,
+  ACTION_ABORT_BOOK,
+  // Logs back in with the token a login answered, without the password
+  ACTION_RESUME
 } Action;
 
 typedef struct {
@@ -38,16 +54,31 @@ typedef struct {
 void default_request(Request* request);
 void free_request(Request* request);
 
+// Response data shared by reference; the last free_response frees it
+typedef struct {
+  uint64_t refs;
+  size_t size;
+  uint8_t data[];
+} SharedBuffer;
+
+SharedBuffer* shared_buffer_new(size_t size);
+SharedBuffer* shared_buffer_ref(SharedBuffer* buffer);
+void shared_buffer_unref(SharedBuffer* buffer);
+
 typedef struct {
   uint64_t data_size;
   int32_t code;
   uint8_t* data;
+  SharedBuffer* shared;  // holds data when set
 } Response;
 
+void default_response(Response* response);
 void free_response(Response* response);
 
+// Cache-line aligned so workers booking neighbouring seats do not share
+// lines; query responses carry the whole struct, padding included
 typedef struct {
-  pa3_seat_t id;
+  alignas(64) pa3_seat_t id;
   uint64_t amount_of_times_booked;
   uint64_t amount_of_times_canceled;
   const char* user_who_booked;
@@ -57,4 +88,23 @@ typedef struct {
 void setup_sigint_handler();
 ssize_t sigint_safe_write(int32_t fd, void* buf, size_t count);
 ssize_t sigint_safe_read(int32_t fd, void* buf, size_t count);
+ssize_t sigint_safe_read_all(int32_t fd, void* buf, size_t count);
+ssize_t sigint_safe_write_all(int32_t fd, const void* buf, size_t count);
+ssize_t sigint_safe_writev_all(int32_t fd, struct iovec* iov, int32_t iovcnt);
+uint64_t monotonic_ns();
+// A previous run that was killed leaves its socket file behind. Removes
+// it, but nothing at that path that is not a socket; false if one is.
+bool remove_stale_socket(const char* socket_path);
+
+// Wire framing (common/frame.c)
+#define RESPONSE_HEADER_SIZE (sizeof(int32_t) + sizeof(uint64_t))
+#define MAX_REQUEST_FIELD_SIZE (1 << 20)
+size_t request_frame_size(const Request* request);
+void encode_request(const Request* request, uint8_t* buf);
+void decode_response_header(const uint8_t* buf, Response* response);
+
+// Blocking frame I/O (common/helper.c); false when the peer is gone or
+// sent a field over MAX_REQUEST_FIELD_SIZE
+bool receive_request(int32_t fd, Request* request);
+bool send_response(int32_t fd, Response* response);
 #endif
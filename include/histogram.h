@@ -0,0 +1,32 @@
+#ifndef COMMON_HISTOGRAM_H
+#define COMMON_HISTOGRAM_H
+
+#include <stdint.h>
+
+// Log-linear (HDR-style) histogram: values below 2^SUB_BUCKET_BITS are
+// exact, larger values keep SUB_BUCKET_BITS - 1 significant bits (~3%)
+#define HISTOGRAM_SUB_BUCKET_BITS 6
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_HALF_BUCKETS (HISTOGRAM_SUB_BUCKETS / 2)
+#define HISTOGRAM_MAX_MAGNITUDE 47
+#define HISTOGRAM_BUCKETS                                        \
+  (HISTOGRAM_SUB_BUCKETS +                                       \
+   (HISTOGRAM_MAX_MAGNITUDE - HISTOGRAM_SUB_BUCKET_BITS + 1) * \
+       HISTOGRAM_HALF_BUCKETS)
+
+// A histogram has a single writer; readers may merge it concurrently and
+// observe a slightly stale but never torn snapshot
+typedef struct {
+  uint64_t counts[HISTOGRAM_BUCKETS];
+  uint64_t total;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+} Histogram;
+
+void histogram_init(Histogram* histogram);
+void histogram_record(Histogram* histogram, uint64_t value);
+void histogram_merge(Histogram* dst, const Histogram* src);
+uint64_t histogram_percentile(const Histogram* histogram, double percentile);
+double histogram_mean(const Histogram* histogram);
+#endif
@@ -0,0 +1,97 @@
+#ifndef LIBPA3CLIENT_PA3_CLIENT_H
+#define LIBPA3CLIENT_PA3_CLIENT_H
+
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "helper.h"
+
+// Embeddable, non-blocking client for pa3_server.
+//
+// A Pa3Client owns a pool of connections and is driven by one event loop
+// thread: either hand its descriptors to your own loop with
+// pa3_client_pollfds/pa3_client_process, or call pa3_client_run_once.
+// Completions are delivered to the per-request callback, or queued for
+// pa3_client_next_completion when the callback is nullptr.
+// Nothing in the library calls exit(); every failure is reported as a
+// Pa3ClientError.
+
+typedef enum {
+  PA3_CLIENT_OK = 0,
+  PA3_CLIENT_ERROR_INVALID_ARGUMENT = -1,
+  PA3_CLIENT_ERROR_NO_MEMORY = -2,
+  PA3_CLIENT_ERROR_CONNECT = -3,
+  PA3_CLIENT_ERROR_DISCONNECTED = -4,
+  PA3_CLIENT_ERROR_QUEUE_FULL = -5,
+  PA3_CLIENT_ERROR_PROTOCOL = -6,
+  PA3_CLIENT_ERROR_CLOSED = -7,
+} Pa3ClientError;
+
+typedef struct Pa3Client Pa3Client;
+
+typedef struct {
+  uint64_t request_id;
+  Action action;
+  Pa3ClientError error;  // PA3_CLIENT_OK when the server answered
+  int32_t code;          // server response code, valid when error is OK
+  uint64_t data_size;
+  uint8_t* data;
+  void* user_data;
+} Pa3Completion;
+
+// The completion (and its data) is only valid until the callback returns
+typedef void (*Pa3CompletionCallback)(const Pa3Completion* completion);
+
+typedef struct {
+  const char* hostname;     // IPv4 address, used when socket_path is nullptr
+  uint16_t port;
+  const char* socket_path;  // UNIX domain socket of the server
+  size_t pool_size;         // number of pooled connections
+  size_t max_in_flight;     // per connection
+  uint32_t reconnect_min_ms;
+  uint32_t reconnect_max_ms;
+  // Called with request_id 0 and action ACTION_WAITLIST for every
+  // WAITLIST_NOTICE_SEAT_ASSIGNED the server sends; nullptr drops them
+  Pa3CompletionCallback notice_callback;
+} Pa3ClientConfig;
+
+void pa3_client_default_config(Pa3ClientConfig* config);
+
+Pa3Client* pa3_client_create(const Pa3ClientConfig* config,
+                             Pa3ClientError* error);
+// Pending requests complete with PA3_CLIENT_ERROR_CLOSED
+void pa3_client_destroy(Pa3Client* client);
+
+// Requests naming a user all go down the same pooled connection, so they
+// are answered in the order they were submitted; that connection being
+// down fails them with PA3_CLIENT_ERROR_DISCONNECTED. Others go to the
+// least-loaded connection.
+// Login requests carry the password as data; successful logins are
+// remembered and replayed after the pool reconnects from a full outage,
+// as a resume with the token the login was answered with when there is
+// one, and with the password otherwise
+Pa3ClientError pa3_client_submit(Pa3Client* client,
+                                 Action action,
+                                 const char* username,
+                                 const char* data,
+                                 Pa3CompletionCallback callback,
+                                 void* user_data,
+                                 uint64_t* request_id);
+
+// Event loop integration
+size_t pa3_client_pollfds(Pa3Client* client,
+                          struct pollfd* fds,
+                          size_t max_fds);
+int32_t pa3_client_timeout_ms(const Pa3Client* client);
+Pa3ClientError pa3_client_process(Pa3Client* client,
+                                  const struct pollfd* fds,
+                                  size_t n_fds);
+Pa3ClientError pa3_client_run_once(Pa3Client* client, int32_t timeout_ms);
+
+// Completion queue, for requests submitted without a callback
+bool pa3_client_next_completion(Pa3Client* client, Pa3Completion* completion);
+void pa3_client_release_completion(Pa3Completion* completion);
+
+size_t pa3_client_in_flight(const Pa3Client* client);
+const char* pa3_client_strerror(Pa3ClientError error);
+#endif
@@ -54,4 +54,54 @@ typedef enum {
   QUERY_ERROR_NO_DATA
 } QueryErrorCode;
 
+typedef enum {
+  STATS_ERROR_SUCCESS,
+} StatsErrorCode;
+
+typedef enum {
+  WAITLIST_ERROR_SUCCESS,
+  WAITLIST_ERROR_USER_NOT_LOGGED_IN,
+  WAITLIST_ERROR_SEAT_OUT_OF_RANGE,
+  WAITLIST_ERROR_NO_DATA,
+  WAITLIST_ERROR_SEAT_ASSIGNED,  // one was free and is booked already
+  WAITLIST_ERROR_TOO_MANY_TICKETS,
+  WAITLIST_ERROR_SEAT_HELD,  // the user has booked one of them already
+} WaitlistErrorCode;
+
+// Also the answer to the two-phase actions pa3_router sends to shards
+typedef enum {
+  BATCH_BOOK_ERROR_SUCCESS,
+  BATCH_BOOK_ERROR_USER_NOT_LOGGED_IN,
+  BATCH_BOOK_ERROR_SEAT_UNAVAILABLE,  // nothing was booked
+  BATCH_BOOK_ERROR_SEAT_OUT_OF_RANGE,
+  BATCH_BOOK_ERROR_NO_DATA,
+  BATCH_BOOK_ERROR_UNKNOWN_TRANSACTION,  // not prepared on this connection
+} BatchBookErrorCode;
+
+typedef enum {
+  RESUME_ERROR_SUCCESS,
+  RESUME_ERROR_INVALID_TOKEN,  // unknown user, wrong or revoked token
+  RESUME_ERROR_EXPIRED,
+  RESUME_ERROR_NO_DATA,
+} ResumeErrorCode;
+
+// Any action can be answered with this instead of its own codes when the
+// client or the user is over its request rate; nothing was done
+typedef enum {
+  RATE_LIMIT_ERROR_THROTTLED = 64,
+} RateLimitErrorCode;
+
+// A server started with -S answers requests for seats outside its range
+// with this; nothing was done
+typedef enum {
+  SHARD_ERROR_WRONG_SHARD = 65,
+} ShardErrorCode;
+
+// Sent unprompted, between two responses, to the connection that queued
+// for a seat once a cancellation hands it one; the data is the seat
+// number as a pa3_seat_t. It answers no request.
+typedef enum {
+  WAITLIST_NOTICE_SEAT_ASSIGNED = 128,
+} WaitlistNoticeCode;
+
 #endif
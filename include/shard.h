@@ -0,0 +1,22 @@
+#ifndef COMMON_SHARD_H
+#define COMMON_SHARD_H
+#include "helper.h"
+
+// Seats are split into contiguous ranges, one per pa3_server started with
+// -S <index>/<count>; pa3_router sends every seat request to the owner
+typedef struct {
+  uint32_t index;
+  uint32_t count;
+} ShardId;
+
+#define MAX_SHARDS 64
+
+// Parses "<index>/<count>", with index < count <= MAX_SHARDS
+bool parse_shard(const char* text, ShardId* shard);
+
+// First and last seat of the shard; empty (first > last) when there are
+// more shards than seats
+void shard_seat_range(ShardId shard, pa3_seat_t* first, pa3_seat_t* last);
+
+uint32_t shard_of_seat(pa3_seat_t seat, uint32_t count);
+#endif
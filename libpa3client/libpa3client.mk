@@ -0,0 +1,8 @@
+LIB_SRCS := $(wildcard libpa3client/*.c) common/frame.c
+LIB_OBJS := $(LIB_SRCS:.c=.o)
+
+libpa3client.a: $(LIB_OBJS)
+	$(AR) rcs $@ $^
+
+clean_libpa3client:
+	rm -f $(LIB_OBJS) libpa3client.a
@@ -0,0 +1,861 @@
+#include "pa3_client.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define READ_CHUNK_SIZE 16384
+
+typedef enum {
+  CONNECTION_DISCONNECTED,
+  CONNECTION_CONNECTING,
+  CONNECTION_CONNECTED
+} ConnectionState;
+
+typedef struct {
+  uint64_t id;
+  Action action;
+  bool internal;  // session re-login or resume issued by the library itself
+  Pa3CompletionCallback callback;
+  void* user_data;
+  char* username;  // kept for login/logout session bookkeeping
+  char* password;
+} PendingRequest;
+
+typedef struct {
+  PendingRequest* items;
+  size_t capacity;
+  size_t head;
+  size_t count;
+} PendingQueue;
+
+typedef struct {
+  uint8_t* data;
+  size_t start;
+  size_t end;
+  size_t capacity;
+} ByteBuffer;
+
+typedef struct {
+  int32_t fd;
+  ConnectionState state;
+  uint64_t retry_at_ns;
+  uint32_t backoff_ms;
+  ByteBuffer out;
+  ByteBuffer in;
+  PendingQueue pending;
+  bool relogin_needed;  // replays its users' sessions once it is up
+} PooledConnection;
+
+typedef struct {
+  char* username;
+  char* password;
+  char* token;  // resumes it without the password; nullptr if none
+} Session;
+
+typedef struct {
+  Pa3Completion* items;
+  size_t capacity;
+  size_t head;
+  size_t count;
+} CompletionQueue;
+
+struct Pa3Client {
+  Pa3ClientConfig config;
+  char* hostname;
+  char* socket_path;
+  PooledConnection* connections;
+  size_t n_connections;
+  Session* sessions;
+  size_t n_sessions;
+  size_t sessions_capacity;
+  CompletionQueue completions;
+  uint64_t next_request_id;
+};
+
+// Kept local so the library does not pull in the executables' signal code
+static uint64_t clock_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1'000'000'000 + ts.tv_nsec;
+}
+
+// Buffers and queues
+
+static bool buffer_reserve(ByteBuffer* buffer, size_t extra) {
+  if (buffer->start > 0 && buffer->start == buffer->end) {
+    buffer->start = buffer->end = 0;
+  }
+  if (buffer->end + extra <= buffer->capacity)
+    return true;
+
+  // Compact first, grow only when that is not enough
+  if (buffer->start > 0) {
+    memmove(buffer->data, buffer->data + buffer->start,
+            buffer->end - buffer->start);
+    buffer->end -= buffer->start;
+    buffer->start = 0;
+    if (buffer->end + extra <= buffer->capacity)
+      return true;
+  }
+
+  size_t capacity = buffer->capacity ? buffer->capacity : READ_CHUNK_SIZE;
+  while (capacity < buffer->end + extra) {
+    capacity *= 2;
+  }
+  uint8_t* data = realloc(buffer->data, capacity);
+  if (data == nullptr)
+    return false;
+  buffer->data = data;
+  buffer->capacity = capacity;
+  return true;
+}
+
+static void buffer_free(ByteBuffer* buffer) {
+  free(buffer->data);
+  *buffer = (ByteBuffer){0};
+}
+
+static bool pending_push(PendingQueue* queue, const PendingRequest* request) {
+  if (queue->count == queue->capacity) {
+    size_t capacity = queue->capacity ? queue->capacity * 2 : 16;
+    PendingRequest* items = malloc(sizeof(PendingRequest) * capacity);
+    if (items == nullptr)
+      return false;
+    for (size_t i = 0; i < queue->count; i++) {
+      items[i] = queue->items[(queue->head + i) % queue->capacity];
+    }
+    free(queue->items);
+    queue->items = items;
+    queue->capacity = capacity;
+    queue->head = 0;
+  }
+  queue->items[(queue->head + queue->count) % queue->capacity] = *request;
+  queue->count++;
+  return true;
+}
+
+static PendingRequest pending_pop(PendingQueue* queue) {
+  PendingRequest request = queue->items[queue->head];
+  queue->head = (queue->head + 1) % queue->capacity;
+  queue->count--;
+  return request;
+}
+
+static void pending_request_free(PendingRequest* request) {
+  free(request->username);
+  free(request->password);
+  request->username = nullptr;
+  request->password = nullptr;
+}
+
+static bool completion_push(CompletionQueue* queue,
+                            const Pa3Completion* completion) {
+  if (queue->count == queue->capacity) {
+    size_t capacity = queue->capacity ? queue->capacity * 2 : 64;
+    Pa3Completion* items = malloc(sizeof(Pa3Completion) * capacity);
+    if (items == nullptr)
+      return false;
+    for (size_t i = 0; i < queue->count; i++) {
+      items[i] = queue->items[(queue->head + i) % queue->capacity];
+    }
+    free(queue->items);
+    queue->items = items;
+    queue->capacity = capacity;
+    queue->head = 0;
+  }
+  queue->items[(queue->head + queue->count) % queue->capacity] = *completion;
+  queue->count++;
+  return true;
+}
+
+// Sessions
+
+static ssize_t find_session(const Pa3Client* client, const char* username) {
+  for (size_t i = 0; i < client->n_sessions; i++) {
+    if (strcmp(client->sessions[i].username, username) == 0)
+      return i;
+  }
+  return -1;
+}
+
+// Requests of one user all go down one connection, so the server answers
+// them in the order they were submitted: a book never overtakes its login
+static PooledConnection* connection_of(const Pa3Client* client,
+                                       const char* username) {
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ULL;
+  for (; *username != '\0'; username++)
+    hash = (hash ^ (uint8_t)*username) * 1099511628211ULL;
+  return &client->connections[hash % client->n_connections];
+}
+
+// A login the library replayed has no password but still a new token
+static void remember_session(Pa3Client* client,
+                             const char* username,
+                             const char* password,
+                             const uint8_t* token,
+                             size_t token_size) {
+  if (username == nullptr)
+    return;
+  ssize_t i = find_session(client, username);
+  if (i == -1) {
+    if (password == nullptr)
+      return;
+    if (client->n_sessions == client->sessions_capacity) {
+      size_t capacity =
+          client->sessions_capacity ? client->sessions_capacity * 2 : 16;
+      Session* sessions =
+          realloc(client->sessions, sizeof(Session) * capacity);
+      if (sessions == nullptr)
+        return;
+      client->sessions = sessions;
+      client->sessions_capacity = capacity;
+    }
+    i = client->n_sessions++;
+    client->sessions[i] = (Session){.username = strdup(username),
+                                    .password = strdup(password),
+                                    .token = nullptr};
+  }
+
+  // Logins of a user that is logged in already come without one
+  if (token_size > 0) {
+    char* copy = strndup((const char*)token, token_size);
+    if (copy != nullptr) {
+      free(client->sessions[i].token);
+      client->sessions[i].token = copy;
+    }
+  }
+}
+
+static void forget_session(Pa3Client* client, const char* username) {
+  ssize_t i = (username != nullptr) ? find_session(client, username) : -1;
+  if (i == -1)
+    return;
+  free(client->sessions[i].username);
+  free(client->sessions[i].password);
+  free(client->sessions[i].token);
+  client->sessions[i] = client->sessions[--client->n_sessions];
+}
+
+// Completions
+
+static void deliver(Pa3Client* client,
+                    PendingRequest* request,
+                    Pa3ClientError error,
+                    Response* response) {
+  Pa3Completion completion = {.request_id = request->id,
+                              .action = request->action,
+                              .error = error,
+                              .code = response ? response->code : 0,
+                              .data_size = response ? response->data_size : 0,
+                              .data = response ? response->data : nullptr,
+                              .user_data = request->user_data};
+
+  if (error == PA3_CLIENT_OK) {
+    if (request->action == ACTION_LOGIN &&
+        (completion.code == LOGIN_ERROR_SUCCESS ||
+         completion.code == LOGIN_ERROR_ACTIVE_USER)) {
+      remember_session(client, request->username, request->password,
+                       completion.data, completion.data_size);
+    } else if (request->action == ACTION_LOGOUT &&
+               completion.code != LOGOUT_ERROR_USER_NOT_FOUND) {
+      forget_session(client, request->username);
+    }
+  }
+
+  if (request->internal) {
+    free(completion.data);
+  } else if (request->callback != nullptr) {
+    request->callback(&completion);
+    free(completion.data);
+  } else if (!completion_push(&client->completions, &completion)) {
+    free(completion.data);
+  }
+  pending_request_free(request);
+}
+
+// Connections
+
+static void fail_connection(Pa3Client* client,
+                            PooledConnection* conn,
+                            Pa3ClientError error) {
+  if (conn->fd >= 0)
+    close(conn->fd);
+  conn->fd = -1;
+  conn->state = CONNECTION_DISCONNECTED;
+  conn->out.start = conn->out.end = 0;
+  conn->in.start = conn->in.end = 0;
+
+  // In-flight requests may or may not have been applied, so they are failed
+  // rather than silently retried
+  while (conn->pending.count > 0) {
+    PendingRequest request = pending_pop(&conn->pending);
+    deliver(client, &request, error, nullptr);
+  }
+
+  if (conn->backoff_ms == 0)
+    conn->backoff_ms = client->config.reconnect_min_ms;
+  else if (conn->backoff_ms < client->config.reconnect_max_ms / 2)
+    conn->backoff_ms *= 2;
+  else
+    conn->backoff_ms = client->config.reconnect_max_ms;
+  conn->retry_at_ns = clock_now_ns() + conn->backoff_ms * 1'000'000ULL;
+
+  // Once no connection is up the server may have restarted and lost all
+  // sessions, so each connection re-logs its users in when it is back
+  bool any_connected = false;
+  for (size_t i = 0; i < client->n_connections; i++) {
+    any_connected |= client->connections[i].state == CONNECTION_CONNECTED;
+  }
+  if (!any_connected && client->n_sessions > 0) {
+    for (size_t i = 0; i < client->n_connections; i++)
+      client->connections[i].relogin_needed = true;
+  }
+}
+
+static Pa3ClientError start_connect(Pa3Client* client, PooledConnection* conn) {
+  struct sockaddr_storage addr;
+  socklen_t addr_len;
+  memset(&addr, 0, sizeof(addr));
+
+  if (client->socket_path != nullptr) {
+    struct sockaddr_un* unix_addr = (struct sockaddr_un*)&addr;
+    unix_addr->sun_family = AF_UNIX;
+    strncpy(unix_addr->sun_path, client->socket_path,
+            sizeof(unix_addr->sun_path) - 1);
+    addr_len = sizeof(struct sockaddr_un);
+  } else {
+    struct sockaddr_in* inet_addr = (struct sockaddr_in*)&addr;
+    inet_addr->sin_family = AF_INET;
+    inet_addr->sin_port = htons(client->config.port);
+    if (inet_pton(AF_INET, client->hostname, &inet_addr->sin_addr) <= 0)
+      return PA3_CLIENT_ERROR_INVALID_ARGUMENT;
+    addr_len = sizeof(struct sockaddr_in);
+  }
+
+  conn->fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    0);
+  if (conn->fd < 0) {
+    fail_connection(client, conn, PA3_CLIENT_ERROR_CONNECT);
+    return PA3_CLIENT_ERROR_CONNECT;
+  }
+  if (addr.ss_family == AF_INET) {
+    int32_t nodelay = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+  }
+
+  if (connect(conn->fd, (struct sockaddr*)&addr, addr_len) == 0) {
+    conn->state = CONNECTION_CONNECTED;
+  } else if (errno == EINPROGRESS || errno == EAGAIN) {
+    conn->state = CONNECTION_CONNECTING;
+  } else {
+    fail_connection(client, conn, PA3_CLIENT_ERROR_CONNECT);
+    return PA3_CLIENT_ERROR_CONNECT;
+  }
+  return PA3_CLIENT_OK;
+}
+
+static bool queue_frame(PooledConnection* conn, const Request* request) {
+  size_t frame_size = request_frame_size(request);
+  if (!buffer_reserve(&conn->out, frame_size))
+    return false;
+  encode_request(request, conn->out.data + conn->out.end);
+  conn->out.end += frame_size;
+  return true;
+}
+
+// Resumes a session with its token, which spares the server an argon2
+// hash, or logs it in again with the password when it has none
+static void queue_relogin(Pa3Client* client,
+                          PooledConnection* conn,
+                          const Session* session) {
+  Request request;
+  default_request(&request);
+  request.action = session->token ? ACTION_RESUME : ACTION_LOGIN;
+  request.username = session->username;
+  request.username_length = strlen(session->username);
+  request.data = session->token ? session->token : session->password;
+  request.data_size = strlen(request.data);
+
+  PendingRequest pending = {.id = client->next_request_id++,
+                            .action = request.action,
+                            .internal = true,
+                            .username = strdup(session->username)};
+  if (!queue_frame(conn, &request) || !pending_push(&conn->pending, &pending))
+    pending_request_free(&pending);
+}
+
+// Queued user requests must follow the re-logins, so the logins are encoded
+// into a fresh buffer and queue that the old contents are appended to
+static void relogin_sessions(Pa3Client* client, PooledConnection* conn) {
+  ByteBuffer old_out = conn->out;
+  PendingQueue old_pending = conn->pending;
+  conn->out = (ByteBuffer){0};
+  conn->pending = (PendingQueue){0};
+
+  for (size_t i = 0; i < client->n_sessions; i++) {
+    if (connection_of(client, client->sessions[i].username) == conn)
+      queue_relogin(client, conn, &client->sessions[i]);
+  }
+
+  if (buffer_reserve(&conn->out, old_out.end - old_out.start)) {
+    memcpy(conn->out.data + conn->out.end, old_out.data + old_out.start,
+           old_out.end - old_out.start);
+    conn->out.end += old_out.end - old_out.start;
+  }
+  while (old_pending.count > 0) {
+    PendingRequest request = pending_pop(&old_pending);
+    pending_push(&conn->pending, &request);
+  }
+  buffer_free(&old_out);
+  free(old_pending.items);
+  conn->relogin_needed = false;
+}
+
+static void on_connected(Pa3Client* client, PooledConnection* conn) {
+  conn->state = CONNECTION_CONNECTED;
+  conn->backoff_ms = 0;
+  if (conn->relogin_needed)
+    relogin_sessions(client, conn);
+}
+
+static Pa3ClientError flush_output(Pa3Client* client, PooledConnection* conn) {
+  while (conn->out.start < conn->out.end) {
+    ssize_t n_sent = send(conn->fd, conn->out.data + conn->out.start,
+                          conn->out.end - conn->out.start, MSG_NOSIGNAL);
+    if (n_sent < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return PA3_CLIENT_OK;
+      fail_connection(client, conn, PA3_CLIENT_ERROR_DISCONNECTED);
+      return PA3_CLIENT_ERROR_DISCONNECTED;
+    }
+    conn->out.start += n_sent;
+  }
+  conn->out.start = conn->out.end = 0;
+  return PA3_CLIENT_OK;
+}
+
+// The token expired, or the server restarted and forgot it: logs in with
+// the password instead. Requests sent behind the resume were answered
+// before this login, so they may have found the user logged out.
+static void resume_failed(Pa3Client* client,
+                          PooledConnection* conn,
+                          const char* username) {
+  ssize_t i = find_session(client, username);
+  if (i == -1)
+    return;
+  free(client->sessions[i].token);
+  client->sessions[i].token = nullptr;
+  queue_relogin(client, conn, &client->sessions[i]);
+}
+
+static Pa3ClientError parse_responses(Pa3Client* client,
+                                      PooledConnection* conn) {
+  for (;;) {
+    size_t available = conn->in.end - conn->in.start;
+    if (available < RESPONSE_HEADER_SIZE)
+      return PA3_CLIENT_OK;
+
+    Response response;
+    default_response(&response);
+    decode_response_header(conn->in.data + conn->in.start, &response);
+    if (available - RESPONSE_HEADER_SIZE < response.data_size)
+      return PA3_CLIENT_OK;
+
+    // A waitlist notice answers no request, so nothing is popped for it
+    bool notice = response.code == WAITLIST_NOTICE_SEAT_ASSIGNED;
+    if (!notice && conn->pending.count == 0) {
+      fail_connection(client, conn, PA3_CLIENT_ERROR_PROTOCOL);
+      return PA3_CLIENT_ERROR_PROTOCOL;
+    }
+    if (notice) {
+      Pa3Completion completion = {
+          .action = ACTION_WAITLIST,
+          .code = response.code,
+          .data_size = response.data_size,
+          .data = conn->in.data + conn->in.start + RESPONSE_HEADER_SIZE};
+      conn->in.start += RESPONSE_HEADER_SIZE + response.data_size;
+      if (client->config.notice_callback != nullptr)
+        client->config.notice_callback(&completion);
+      continue;
+    }
+
+    if (response.data_size > 0) {
+      response.data = malloc(response.data_size);
+      if (response.data == nullptr) {
+        fail_connection(client, conn, PA3_CLIENT_ERROR_NO_MEMORY);
+        return PA3_CLIENT_ERROR_NO_MEMORY;
+      }
+      memcpy(response.data,
+             conn->in.data + conn->in.start + RESPONSE_HEADER_SIZE,
+             response.data_size);
+    }
+    conn->in.start += RESPONSE_HEADER_SIZE + response.data_size;
+
+    PendingRequest request = pending_pop(&conn->pending);
+    if (request.internal && request.action == ACTION_RESUME &&
+        response.code != RESUME_ERROR_SUCCESS)
+      resume_failed(client, conn, request.username);
+    deliver(client, &request, PA3_CLIENT_OK, &response);
+  }
+}
+
+static Pa3ClientError read_input(Pa3Client* client, PooledConnection* conn) {
+  for (;;) {
+    if (!buffer_reserve(&conn->in, READ_CHUNK_SIZE)) {
+      fail_connection(client, conn, PA3_CLIENT_ERROR_NO_MEMORY);
+      return PA3_CLIENT_ERROR_NO_MEMORY;
+    }
+    ssize_t n_read = recv(conn->fd, conn->in.data + conn->in.end,
+                          conn->in.capacity - conn->in.end, 0);
+    if (n_read < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return parse_responses(client, conn);
+      fail_connection(client, conn, PA3_CLIENT_ERROR_DISCONNECTED);
+      return PA3_CLIENT_ERROR_DISCONNECTED;
+    }
+    if (n_read == 0) {
+      Pa3ClientError error = parse_responses(client, conn);
+      if (conn->fd >= 0)
+        fail_connection(client, conn, PA3_CLIENT_ERROR_DISCONNECTED);
+      return error != PA3_CLIENT_OK ? error : PA3_CLIENT_ERROR_DISCONNECTED;
+    }
+    conn->in.end += n_read;
+  }
+}
+
+static void handle_events(Pa3Client* client,
+                          PooledConnection* conn,
+                          int16_t revents) {
+  if (conn->state == CONNECTION_CONNECTING) {
+    if (!(revents & (POLLOUT | POLLERR | POLLHUP)))
+      return;
+    int32_t socket_error = 0;
+    socklen_t len = sizeof(socket_error);
+    getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &socket_error, &len);
+    if (socket_error != 0) {
+      fail_connection(client, conn, PA3_CLIENT_ERROR_CONNECT);
+      return;
+    }
+    on_connected(client, conn);
+  }
+
+  if (revents & POLLIN) {
+    if (read_input(client, conn) != PA3_CLIENT_OK)
+      return;
+  } else if (revents & (POLLERR | POLLHUP)) {
+    fail_connection(client, conn, PA3_CLIENT_ERROR_DISCONNECTED);
+    return;
+  }
+
+  if (conn->out.start < conn->out.end)
+    flush_output(client, conn);
+}
+
+static void retry_connections(Pa3Client* client) {
+  uint64_t now_ns = clock_now_ns();
+  for (size_t i = 0; i < client->n_connections; i++) {
+    PooledConnection* conn = &client->connections[i];
+    if (conn->state == CONNECTION_DISCONNECTED && conn->retry_at_ns <= now_ns) {
+      if (start_connect(client, conn) == PA3_CLIENT_OK &&
+          conn->state == CONNECTION_CONNECTED)
+        on_connected(client, conn);
+    }
+  }
+}
+
+// Public API
+
+void pa3_client_default_config(Pa3ClientConfig* config) {
+  *config = (Pa3ClientConfig){.hostname = "127.0.0.1",
+                              .port = 0,
+                              .socket_path = nullptr,
+                              .pool_size = 4,
+                              .max_in_flight = 1024,
+                              .reconnect_min_ms = 50,
+                              .reconnect_max_ms = 5000,
+                              .notice_callback = nullptr};
+}
+
+static Pa3Client* create_failed(Pa3ClientError* error, Pa3ClientError status) {
+  if (error != nullptr)
+    *error = status;
+  return nullptr;
+}
+
+Pa3Client* pa3_client_create(const Pa3ClientConfig* config,
+                             Pa3ClientError* error) {
+  if (config == nullptr || config->pool_size == 0 ||
+      config->max_in_flight == 0 ||
+      (config->socket_path == nullptr && config->hostname == nullptr))
+    return create_failed(error, PA3_CLIENT_ERROR_INVALID_ARGUMENT);
+
+  Pa3Client* client = calloc(1, sizeof(Pa3Client));
+  if (client == nullptr)
+    return create_failed(error, PA3_CLIENT_ERROR_NO_MEMORY);
+
+  client->config = *config;
+  client->hostname = config->hostname ? strdup(config->hostname) : nullptr;
+  client->socket_path =
+      config->socket_path ? strdup(config->socket_path) : nullptr;
+  client->n_connections = config->pool_size;
+  client->connections = calloc(config->pool_size, sizeof(PooledConnection));
+  client->next_request_id = 1;
+  if (client->connections == nullptr) {
+    pa3_client_destroy(client);
+    return create_failed(error, PA3_CLIENT_ERROR_NO_MEMORY);
+  }
+
+  // The pool is usable as soon as one connection can be started
+  Pa3ClientError status = PA3_CLIENT_OK;
+  bool any_started = false;
+  for (size_t i = 0; i < client->n_connections; i++) {
+    client->connections[i].fd = -1;
+  }
+  for (size_t i = 0; i < client->n_connections; i++) {
+    status = start_connect(client, &client->connections[i]);
+    any_started |= status == PA3_CLIENT_OK;
+    if (status == PA3_CLIENT_ERROR_INVALID_ARGUMENT)
+      break;
+  }
+  if (!any_started) {
+    pa3_client_destroy(client);
+    return create_failed(error, status);
+  }
+
+  if (error != nullptr)
+    *error = PA3_CLIENT_OK;
+  return client;
+}
+
+void pa3_client_destroy(Pa3Client* client) {
+  if (client == nullptr)
+    return;
+
+  for (size_t i = 0; i < client->n_connections; i++) {
+    PooledConnection* conn = &client->connections[i];
+    if (conn->fd >= 0)
+      close(conn->fd);
+    while (conn->pending.count > 0) {
+      PendingRequest request = pending_pop(&conn->pending);
+      deliver(client, &request, PA3_CLIENT_ERROR_CLOSED, nullptr);
+    }
+    buffer_free(&conn->out);
+    buffer_free(&conn->in);
+    free(conn->pending.items);
+  }
+
+  while (client->completions.count > 0) {
+    Pa3Completion completion;
+    pa3_client_next_completion(client, &completion);
+    pa3_client_release_completion(&completion);
+  }
+  for (size_t i = 0; i < client->n_sessions; i++) {
+    free(client->sessions[i].username);
+    free(client->sessions[i].password);
+    free(client->sessions[i].token);
+  }
+
+  free(client->completions.items);
+  free(client->sessions);
+  free(client->connections);
+  free(client->hostname);
+  free(client->socket_path);
+  free(client);
+}
+
+Pa3ClientError pa3_client_submit(Pa3Client* client,
+                                 Action action,
+                                 const char* username,
+                                 const char* data,
+                                 Pa3CompletionCallback callback,
+                                 void* user_data,
+                                 uint64_t* request_id) {
+  if (client == nullptr || action == ACTION_INVALID ||
+      action == ACTION_TERMINATION)
+    return PA3_CLIENT_ERROR_INVALID_ARGUMENT;
+
+  // A user's own connection, otherwise the least-loaded one that is up or
+  // coming up
+  PooledConnection* conn = nullptr;
+  if (username != nullptr && *username != '\0') {
+    conn = connection_of(client, username);
+    if (conn->state == CONNECTION_DISCONNECTED)
+      return PA3_CLIENT_ERROR_DISCONNECTED;
+    if (conn->pending.count >= client->config.max_in_flight)
+      return PA3_CLIENT_ERROR_QUEUE_FULL;
+  } else {
+    bool any_live = false;
+    for (size_t i = 0; i < client->n_connections; i++) {
+      PooledConnection* candidate = &client->connections[i];
+      if (candidate->state == CONNECTION_DISCONNECTED)
+        continue;
+      any_live = true;
+      if (candidate->pending.count >= client->config.max_in_flight)
+        continue;
+      if (conn == nullptr || candidate->pending.count < conn->pending.count)
+        conn = candidate;
+    }
+    if (conn == nullptr)
+      return any_live ? PA3_CLIENT_ERROR_QUEUE_FULL
+                      : PA3_CLIENT_ERROR_DISCONNECTED;
+  }
+
+  Request request;
+  default_request(&request);
+  request.action = action;
+  request.username = (char*)username;
+  request.username_length = username ? strlen(username) : 0;
+  request.data = (char*)data;
+  request.data_size = data ? strlen(data) : 0;
+
+  PendingRequest pending = {.id = client->next_request_id++,
+                            .action = action,
+                            .internal = false,
+                            .callback = callback,
+                            .user_data = user_data};
+  if (action == ACTION_LOGIN || action == ACTION_LOGOUT) {
+    pending.username = username ? strdup(username) : nullptr;
+    pending.password =
+        (action == ACTION_LOGIN && data) ? strdup(data) : nullptr;
+  }
+
+  size_t out_end = conn->out.end;
+  if (!queue_frame(conn, &request) || !pending_push(&conn->pending, &pending)) {
+    conn->out.end = out_end;
+    pending_request_free(&pending);
+    return PA3_CLIENT_ERROR_NO_MEMORY;
+  }
+  if (request_id != nullptr)
+    *request_id = pending.id;
+
+  // Write eagerly; whatever does not fit is sent on POLLOUT
+  if (conn->state == CONNECTION_CONNECTED)
+    flush_output(client, conn);
+  return PA3_CLIENT_OK;
+}
+
+size_t pa3_client_pollfds(Pa3Client* client,
+                          struct pollfd* fds,
+                          size_t max_fds) {
+  retry_connections(client);
+
+  size_t n_fds = 0;
+  for (size_t i = 0; i < client->n_connections && n_fds < max_fds; i++) {
+    PooledConnection* conn = &client->connections[i];
+    if (conn->fd < 0)
+      continue;
+    fds[n_fds].fd = conn->fd;
+    fds[n_fds].events = POLLIN;
+    fds[n_fds].revents = 0;
+    if (conn->state == CONNECTION_CONNECTING || conn->out.start < conn->out.end)
+      fds[n_fds].events |= POLLOUT;
+    n_fds++;
+  }
+  return n_fds;
+}
+
+int32_t pa3_client_timeout_ms(const Pa3Client* client) {
+  uint64_t now_ns = clock_now_ns();
+  int64_t timeout_ms = -1;
+  for (size_t i = 0; i < client->n_connections; i++) {
+    const PooledConnection* conn = &client->connections[i];
+    if (conn->state != CONNECTION_DISCONNECTED)
+      continue;
+    int64_t wait_ms = conn->retry_at_ns > now_ns
+                          ? (conn->retry_at_ns - now_ns + 999'999) / 1'000'000
+                          : 0;
+    if (timeout_ms == -1 || wait_ms < timeout_ms)
+      timeout_ms = wait_ms;
+  }
+  return timeout_ms;
+}
+
+Pa3ClientError pa3_client_process(Pa3Client* client,
+                                  const struct pollfd* fds,
+                                  size_t n_fds) {
+  for (size_t i = 0; i < n_fds; i++) {
+    if (fds[i].revents == 0)
+      continue;
+    for (size_t j = 0; j < client->n_connections; j++) {
+      if (client->connections[j].fd == fds[i].fd) {
+        handle_events(client, &client->connections[j], fds[i].revents);
+        break;
+      }
+    }
+  }
+  retry_connections(client);
+  return PA3_CLIENT_OK;
+}
+
+Pa3ClientError pa3_client_run_once(Pa3Client* client, int32_t timeout_ms) {
+  struct pollfd fds[client->n_connections];
+  size_t n_fds = pa3_client_pollfds(client, fds, client->n_connections);
+
+  int32_t retry_ms = pa3_client_timeout_ms(client);
+  if (retry_ms >= 0 && (timeout_ms < 0 || retry_ms < timeout_ms))
+    timeout_ms = retry_ms;
+
+  if (poll(fds, n_fds, timeout_ms) < 0 && errno != EINTR)
+    return PA3_CLIENT_ERROR_DISCONNECTED;
+  return pa3_client_process(client, fds, n_fds);
+}
+
+bool pa3_client_next_completion(Pa3Client* client, Pa3Completion* completion) {
+  CompletionQueue* queue = &client->completions;
+  if (queue->count == 0)
+    return false;
+  *completion = queue->items[queue->head];
+  queue->head = (queue->head + 1) % queue->capacity;
+  queue->count--;
+  return true;
+}
+
+void pa3_client_release_completion(Pa3Completion* completion) {
+  free(completion->data);
+  completion->data = nullptr;
+  completion->data_size = 0;
+}
+
+size_t pa3_client_in_flight(const Pa3Client* client) {
+  size_t in_flight = 0;
+  for (size_t i = 0; i < client->n_connections; i++) {
+    in_flight += client->connections[i].pending.count;
+  }
+  return in_flight;
+}
+
+const char* pa3_client_strerror(Pa3ClientError error) {
+  switch (error) {
+    case PA3_CLIENT_OK:
+      return "success";
+    case PA3_CLIENT_ERROR_INVALID_ARGUMENT:
+      return "invalid argument";
+    case PA3_CLIENT_ERROR_NO_MEMORY:
+      return "out of memory";
+    case PA3_CLIENT_ERROR_CONNECT:
+      return "connection failed";
+    case PA3_CLIENT_ERROR_DISCONNECTED:
+      return "disconnected from server";
+    case PA3_CLIENT_ERROR_QUEUE_FULL:
+      return "too many requests in flight";
+    case PA3_CLIENT_ERROR_PROTOCOL:
+      return "unexpected data from server";
+    case PA3_CLIENT_ERROR_CLOSED:
+      return "client closed";
+    default:
+      return "unknown error";
+  }
+}
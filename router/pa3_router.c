@@ -0,0 +1,626 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <helper.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <shard.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Fronts pa3_servers started with -S k/n, one per shard of the seats, so
+// clients see a single server. Each client gets a thread and its own
+// connection to every shard: seat requests go to the shard owning the
+// seat, login, resume, logout and listings to all of them, and a batch
+// booking spanning shards is prepared on each, then committed or aborted.
+//
+// A shard aborts whatever this connection prepared but did not settle
+// when it closes, so a router that dies mid-batch leaves no seats held,
+// except that one dying between two commits leaves the batch partly
+// booked.
+
+#define LISTEN_BACKLOG 128
+
+atomic_bool sigint_received = false;
+
+static const char* shard_addresses[MAX_SHARDS];
+static uint32_t n_shards = 0;
+
+// Transactions only have to be unique per shard connection, but a global
+// counter keeps them apart in shard logs
+static atomic_uint_fast64_t next_transaction = 1;
+
+typedef struct {
+  int32_t client_fd;
+  int32_t shard_fds[MAX_SHARDS];
+} RouterSession;
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s -s <shard> [-s <shard> ...] (-u <socket path> | "
+          "<port>)\n"
+          "  -s  a pa3_server started with -S k/n, as <IP address>:<port> "
+          "or a socket\n"
+          "      path; give all n of them, in order of k\n",
+          program);
+}
+
+// "<IP address>:<port>" or a UNIX socket path; -1 if unreachable
+static int32_t connect_to_shard(const char* address) {
+  const char* colon = strrchr(address, ':');
+  if (colon == nullptr || strchr(address, '/') != nullptr) {
+    struct sockaddr_un saddr = {.sun_family = AF_UNIX};
+    strncpy(saddr.sun_path, address, sizeof(saddr.sun_path) - 1);
+    int32_t fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&saddr, sizeof(saddr)) < 0) {
+      perror("connect to shard");
+      if (fd >= 0)
+        close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  char host[INET_ADDRSTRLEN] = {0};
+  size_t host_length = colon - address;
+  struct sockaddr_in saddr = {.sin_family = AF_INET,
+                              .sin_port = htons(strtoul(colon + 1, nullptr,
+                                                        10))};
+  if (host_length >= sizeof(host)) {
+    fprintf(stderr, "Invalid shard address: %s\n", address);
+    return -1;
+  }
+  memcpy(host, address, host_length);
+  if (inet_pton(AF_INET, host, &saddr.sin_addr) <= 0) {
+    fprintf(stderr, "Invalid shard address: %s\n", address);
+    return -1;
+  }
+  int32_t fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr*)&saddr, sizeof(saddr)) < 0) {
+    perror("connect to shard");
+    if (fd >= 0)
+      close(fd);
+    return -1;
+  }
+  int32_t nodelay = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+  return fd;
+}
+
+static bool send_to_shard(int32_t fd, const Request* request) {
+  size_t size = request_frame_size(request);
+  uint8_t* frame = malloc(size);
+  encode_request(request, frame);
+  bool sent = sigint_safe_write_all(fd, frame, size) == (ssize_t)size;
+  free(frame);
+  return sent;
+}
+
+static bool read_frame(int32_t fd, Response* response) {
+  uint8_t header[RESPONSE_HEADER_SIZE];
+  if (sigint_safe_read_all(fd, header, sizeof(header)) <= 0)
+    return false;
+  decode_response_header(header, response);
+  if (response->data_size > MAX_REQUEST_FIELD_SIZE)
+    return false;
+  response->data = nullptr;
+  if (response->data_size > 0) {
+    response->data = malloc(response->data_size);
+    if (sigint_safe_read_all(fd, response->data, response->data_size) <= 0) {
+      free_response(response);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Reads the response of a shard, passing waitlist notices ahead of it on
+// to the client
+static bool receive_from_shard(RouterSession* session,
+                               uint32_t shard,
+                               Response* response) {
+  for (;;) {
+    if (!read_frame(session->shard_fds[shard], response))
+      return false;
+    if (response->code != WAITLIST_NOTICE_SEAT_ASSIGNED)
+      return true;
+    bool sent = send_response(session->client_fd, response);
+    free_response(response);
+    if (!sent)
+      return false;
+  }
+}
+
+// Sends each involved shard its request before reading any response, so
+// the shards work on them at the same time
+static bool exchange(RouterSession* session,
+                     const Request* requests,
+                     const bool* involved,
+                     Response* responses) {
+  for (uint32_t k = 0; k < n_shards; k++) {
+    default_response(&responses[k]);
+    if (involved[k] && !send_to_shard(session->shard_fds[k], &requests[k]))
+      return false;
+  }
+  for (uint32_t k = 0; k < n_shards; k++)
+    if (involved[k] && !receive_from_shard(session, k, &responses[k]))
+      return false;
+  return true;
+}
+
+static bool broadcast(RouterSession* session,
+                      const Request* request,
+                      Response* responses) {
+  Request requests[MAX_SHARDS];
+  bool involved[MAX_SHARDS];
+  for (uint32_t k = 0; k < n_shards; k++) {
+    requests[k] = *request;
+    involved[k] = true;
+  }
+  return exchange(session, requests, involved, responses);
+}
+
+static void free_responses(Response* responses) {
+  for (uint32_t k = 0; k < n_shards; k++)
+    free_response(&responses[k]);
+}
+
+// The first code that is not success, or success
+static int32_t combined_code(const Response* responses,
+                             const bool* involved,
+                             int32_t success) {
+  for (uint32_t k = 0; k < n_shards; k++)
+    if (involved[k] && responses[k].code != success)
+      return responses[k].code;
+  return success;
+}
+
+// Shard of the seat a request starts with; malformed ones go to shard 0,
+// which reports them
+static uint32_t shard_of_request(const Request* request) {
+  if (request->data_size == 0)
+    return 0;
+  char* end;
+  long seat = strtol(request->data, &end, 10);
+  if (end == request->data || seat < 1 || seat > NUM_SEATS)
+    return 0;
+  return shard_of_seat(seat, n_shards);
+}
+
+// Logged in everywhere or nowhere, or later requests would fail on some
+// shards only
+static bool log_out_on(RouterSession* session,
+                       const Request* request,
+                       const bool* involved) {
+  Request logout = {.action = ACTION_LOGOUT,
+                    .username = request->username,
+                    .username_length = request->username_length};
+  Request requests[MAX_SHARDS];
+  for (uint32_t k = 0; k < n_shards; k++)
+    requests[k] = logout;
+  Response responses[MAX_SHARDS];
+  if (!exchange(session, requests, involved, responses))
+    return false;
+  free_responses(responses);
+  return true;
+}
+
+// The resume token of a login through the router is those of the shards
+// in order, or none if a shard issued none
+static bool route_login(RouterSession* session,
+                        const Request* request,
+                        Response* reply) {
+  Response responses[MAX_SHARDS];
+  bool all[MAX_SHARDS];
+  memset(all, true, sizeof(all));
+  if (!broadcast(session, request, responses))
+    return false;
+  reply->code = combined_code(responses, all, LOGIN_ERROR_SUCCESS);
+  bool tokens = reply->code == LOGIN_ERROR_SUCCESS;
+  for (uint32_t k = 0; k < n_shards; k++)
+    tokens &= responses[k].data_size == RESUME_TOKEN_LENGTH;
+  if (tokens) {
+    reply->data_size = (uint64_t)n_shards * RESUME_TOKEN_LENGTH;
+    reply->data = malloc(reply->data_size);
+    for (uint32_t k = 0; k < n_shards; k++)
+      memcpy(reply->data + k * RESUME_TOKEN_LENGTH, responses[k].data,
+             RESUME_TOKEN_LENGTH);
+  }
+  free_responses(responses);
+
+  if (reply->code == LOGIN_ERROR_SUCCESS)
+    return true;
+  bool logged_in[MAX_SHARDS];
+  for (uint32_t k = 0; k < n_shards; k++)
+    logged_in[k] = responses[k].code == LOGIN_ERROR_SUCCESS;
+  return log_out_on(session, request, logged_in);
+}
+
+// Hands each shard its part of the token. A resume that fails on some
+// shards only logs the user out of all of them, like a login would.
+static bool route_resume(RouterSession* session,
+                         const Request* request,
+                         Response* reply) {
+  if (request->data_size != (uint64_t)n_shards * RESUME_TOKEN_LENGTH) {
+    reply->code = request->data_size == 0 ? RESUME_ERROR_NO_DATA
+                                          : RESUME_ERROR_INVALID_TOKEN;
+    return true;
+  }
+  Request requests[MAX_SHARDS];
+  bool all[MAX_SHARDS];
+  for (uint32_t k = 0; k < n_shards; k++) {
+    requests[k] = *request;
+    requests[k].data = request->data + k * RESUME_TOKEN_LENGTH;
+    requests[k].data_size = RESUME_TOKEN_LENGTH;
+    all[k] = true;
+  }
+  Response responses[MAX_SHARDS];
+  if (!exchange(session, requests, all, responses))
+    return false;
+  reply->code = combined_code(responses, all, RESUME_ERROR_SUCCESS);
+  free_responses(responses);
+
+  bool resumed = false;
+  for (uint32_t k = 0; k < n_shards; k++)
+    resumed |= responses[k].code == RESUME_ERROR_SUCCESS;
+  if (reply->code == RESUME_ERROR_SUCCESS || !resumed)
+    return true;
+  return log_out_on(session, request, all);
+}
+
+static bool route_confirm_booking(RouterSession* session,
+                                  const Request* request,
+                                  Response* reply) {
+  Response responses[MAX_SHARDS];
+  bool all[MAX_SHARDS];
+  memset(all, true, sizeof(all));
+  if (!broadcast(session, request, responses))
+    return false;
+  reply->code = combined_code(responses, all, CONFIRM_BOOKING_ERROR_SUCCESS);
+  if (reply->code == CONFIRM_BOOKING_ERROR_SUCCESS) {
+    // Shards hold ascending ranges, so the lists stay sorted
+    for (uint32_t k = 0; k < n_shards; k++)
+      reply->data_size += responses[k].data_size;
+    reply->data = reply->data_size > 0 ? malloc(reply->data_size) : nullptr;
+    size_t offset = 0;
+    for (uint32_t k = 0; k < n_shards; k++) {
+      if (responses[k].data_size > 0)
+        memcpy(reply->data + offset, responses[k].data,
+               responses[k].data_size);
+      offset += responses[k].data_size;
+    }
+  }
+  free_responses(responses);
+  return true;
+}
+
+static bool route_stats(RouterSession* session,
+                        const Request* request,
+                        Response* reply) {
+  Response responses[MAX_SHARDS];
+  if (!broadcast(session, request, responses))
+    return false;
+  size_t capacity = 0;
+  for (uint32_t k = 0; k < n_shards; k++)
+    capacity += responses[k].data_size + 32;
+  char* report = malloc(capacity);
+  size_t length = 0;
+  for (uint32_t k = 0; k < n_shards; k++) {
+    length += sprintf(report + length, "Shard %u/%u:\n", k, n_shards);
+    if (responses[k].data_size > 0)
+      memcpy(report + length, responses[k].data, responses[k].data_size);
+    length += responses[k].data_size;
+  }
+  reply->code = STATS_ERROR_SUCCESS;
+  reply->data = (uint8_t*)report;
+  reply->data_size = length;
+  free_responses(responses);
+  return true;
+}
+
+// Splits "<seat>,<seat>,..." by shard into "<seat>,..." strings, each
+// prefixed with prefix; false if a seat is malformed
+static bool split_seats(const char* text,
+                        const char* prefix,
+                        char** parts,
+                        bool* involved) {
+  for (uint32_t k = 0; k < n_shards; k++) {
+    parts[k] = nullptr;
+    involved[k] = false;
+  }
+  size_t capacity = strlen(prefix) + strlen(text) + 1;
+  for (;;) {
+    char* end;
+    long seat = strtol(text, &end, 10);
+    if (end == text || seat < 1 || seat > NUM_SEATS ||
+        (*end != '\0' && *end != ','))
+      break;
+    uint32_t k = shard_of_seat(seat, n_shards);
+    if (!involved[k]) {
+      parts[k] = malloc(capacity);
+      strcpy(parts[k], prefix);
+      involved[k] = true;
+    } else {
+      strcat(parts[k], ",");
+    }
+    strncat(parts[k], text, end - text);
+    if (*end == '\0')
+      return true;
+    text = end + 1;
+  }
+  for (uint32_t k = 0; k < n_shards; k++)
+    free(parts[k]);
+  return false;
+}
+
+static bool route_batch_book(RouterSession* session,
+                             const Request* request,
+                             Response* reply) {
+  char* parts[MAX_SHARDS];
+  bool involved[MAX_SHARDS];
+  uint32_t n_involved = 0;
+  uint64_t transaction = next_transaction++;
+  char prefix[32];
+  snprintf(prefix, sizeof(prefix), "%lu:", transaction);
+  if (request->data_size > 0 &&
+      split_seats(request->data, prefix, parts, involved)) {
+    for (uint32_t k = 0; k < n_shards; k++)
+      n_involved += involved[k];
+  }
+
+  // One shard books it alone, as do malformed batches it then reports
+  if (n_involved <= 1) {
+    uint32_t owner = shard_of_request(request);
+    for (uint32_t k = 0; k < n_shards && n_involved == 1; k++) {
+      if (involved[k])
+        owner = k;
+      free(parts[k]);
+    }
+    if (!send_to_shard(session->shard_fds[owner], request))
+      return false;
+    return receive_from_shard(session, owner, reply);
+  }
+
+  Request requests[MAX_SHARDS];
+  Response responses[MAX_SHARDS];
+  for (uint32_t k = 0; k < n_shards; k++) {
+    requests[k] = *request;
+    requests[k].action = ACTION_PREPARE_BOOK;
+    requests[k].data = parts[k];
+    requests[k].data_size = involved[k] ? strlen(parts[k]) : 0;
+  }
+  bool exchanged = exchange(session, requests, involved, responses);
+  for (uint32_t k = 0; k < n_shards; k++)
+    free(parts[k]);
+  if (!exchanged)
+    return false;
+  reply->code = combined_code(responses, involved, BATCH_BOOK_ERROR_SUCCESS);
+
+  // Commit everywhere, or abort where it was prepared
+  char settle[32];
+  snprintf(settle, sizeof(settle), "%lu", transaction);
+  for (uint32_t k = 0; k < n_shards; k++) {
+    if (reply->code != BATCH_BOOK_ERROR_SUCCESS)
+      involved[k] = involved[k] && responses[k].code == BATCH_BOOK_ERROR_SUCCESS;
+    requests[k].action = reply->code == BATCH_BOOK_ERROR_SUCCESS
+                             ? ACTION_COMMIT_BOOK
+                             : ACTION_ABORT_BOOK;
+    requests[k].data = settle;
+    requests[k].data_size = strlen(settle);
+  }
+  free_responses(responses);
+  if (!exchange(session, requests, involved, responses))
+    return false;
+  free_responses(responses);
+  return true;
+}
+
+// Answers one client request in reply; false once a shard is gone
+static bool route_request(RouterSession* session,
+                          const Request* request,
+                          Response* reply) {
+  bool all[MAX_SHARDS];
+  memset(all, true, sizeof(all));
+  switch (request->action) {
+    case ACTION_LOGIN:
+      return route_login(session, request, reply);
+    case ACTION_RESUME:
+      return route_resume(session, request, reply);
+    case ACTION_CONFIRM_BOOKING:
+      return route_confirm_booking(session, request, reply);
+    case ACTION_STATS:
+      return route_stats(session, request, reply);
+    case ACTION_BATCH_BOOK:
+      return route_batch_book(session, request, reply);
+    case ACTION_BOOK:
+    case ACTION_CANCEL_BOOKING:
+    case ACTION_QUERY:
+    case ACTION_WAITLIST: {
+      // A waitlist range has to lie within one shard, which the owner of
+      // its first seat checks
+      uint32_t owner = shard_of_request(request);
+      if (!send_to_shard(session->shard_fds[owner], request))
+        return false;
+      return receive_from_shard(session, owner, reply);
+    }
+    case ACTION_PREPARE_BOOK:
+    case ACTION_COMMIT_BOOK:
+    case ACTION_ABORT_BOOK:
+      // Only the router speaks two-phase to the shards
+      reply->code = -1;
+      return true;
+    default: {
+      // Logout, termination and anything unknown go everywhere; every
+      // success code is 0
+      Response responses[MAX_SHARDS];
+      if (!broadcast(session, request, responses))
+        return false;
+      reply->code = combined_code(responses, all, 0);
+      free_responses(responses);
+      return true;
+    }
+  }
+}
+
+static void* serve_client(void* arg) {
+  RouterSession* session = arg;
+  bool connected = true;
+  for (uint32_t k = 0; k < n_shards; k++) {
+    session->shard_fds[k] = connected ? connect_to_shard(shard_addresses[k])
+                                      : -1;
+    connected = connected && session->shard_fds[k] >= 0;
+  }
+
+  struct pollfd fds[MAX_SHARDS + 1];
+  fds[0] = (struct pollfd){.fd = session->client_fd, .events = POLLIN};
+  for (uint32_t k = 0; k < n_shards; k++)
+    fds[k + 1] = (struct pollfd){.fd = session->shard_fds[k], .events = POLLIN};
+
+  while (connected && !sigint_received) {
+    if (poll(fds, n_shards + 1, 1000) < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("poll");
+      break;
+    }
+
+    // Between requests a shard only ever sends waitlist notices
+    for (uint32_t k = 0; k < n_shards && connected; k++) {
+      if (fds[k + 1].revents == 0)
+        continue;
+      Response notice;
+      default_response(&notice);
+      connected = read_frame(session->shard_fds[k], &notice) &&
+                  notice.code == WAITLIST_NOTICE_SEAT_ASSIGNED &&
+                  send_response(session->client_fd, &notice);
+      free_response(&notice);
+    }
+    if (!connected || fds[0].revents == 0)
+      continue;
+
+    Request request;
+    default_request(&request);
+    if (!receive_request(session->client_fd, &request))
+      break;
+    Response reply;
+    default_response(&reply);
+    connected = route_request(session, &request, &reply) &&
+                send_response(session->client_fd, &reply) &&
+                request.action != ACTION_TERMINATION;
+    free_request(&request);
+    free_response(&reply);
+  }
+
+  // Closing a shard connection aborts what it left prepared
+  for (uint32_t k = 0; k < n_shards; k++)
+    if (session->shard_fds[k] >= 0)
+      close(session->shard_fds[k]);
+  close(session->client_fd);
+  free(session);
+  return nullptr;
+}
+
+static int32_t create_listener(const char* socket_path, const char* port) {
+  int32_t fd;
+  if (socket_path != nullptr) {
+    struct sockaddr_un saddr = {.sun_family = AF_UNIX};
+    if (strlen(socket_path) >= sizeof(saddr.sun_path)) {
+      fprintf(stderr, "Socket path is too long: %s\n", socket_path);
+      return -1;
+    }
+    strcpy(saddr.sun_path, socket_path);
+    if (!remove_stale_socket(socket_path))
+      return -1;
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr*)&saddr, sizeof(saddr)) < 0 ||
+        listen(fd, LISTEN_BACKLOG) < 0) {
+      perror("bind/listen (unix)");
+      return -1;
+    }
+    return fd;
+  }
+
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  int32_t reuse = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  struct sockaddr_in saddr = {.sin_family = AF_INET,
+                              .sin_addr.s_addr = htonl(INADDR_ANY),
+                              .sin_port = htons(strtoul(port, nullptr, 10))};
+  if (fd < 0 || bind(fd, (struct sockaddr*)&saddr, sizeof(saddr)) < 0 ||
+      listen(fd, LISTEN_BACKLOG) < 0) {
+    perror("bind/listen (tcp)");
+    return -1;
+  }
+  return fd;
+}
+
+int main(int argc, char* argv[]) {
+  setup_sigint_handler();
+  signal(SIGPIPE, SIG_IGN);
+
+  const char* socket_path = nullptr;
+  int32_t opt;
+  while ((opt = getopt(argc, argv, "u:s:")) != -1) {
+    switch (opt) {
+      case 'u':
+        socket_path = optarg;
+        break;
+      case 's':
+        if (n_shards == MAX_SHARDS) {
+          print_usage(argv[0]);
+          return 1;
+        }
+        shard_addresses[n_shards++] = optarg;
+        break;
+      default:
+        print_usage(argv[0]);
+        return 1;
+    }
+  }
+  const char* port = (optind < argc) ? argv[optind++] : nullptr;
+  if (optind != argc || n_shards == 0 ||
+      (port == nullptr) == (socket_path == nullptr)) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  int32_t listen_fd = create_listener(socket_path, port);
+  if (listen_fd < 0)
+    exit(EXIT_FAILURE);
+  printf("Routing to %u shards\n", n_shards);
+
+  while (!sigint_received) {
+    int32_t client_fd = accept(listen_fd, nullptr, nullptr);
+    if (client_fd < 0) {
+      if (errno != EINTR)
+        perror("accept");
+      continue;
+    }
+    if (port != nullptr) {
+      int32_t nodelay = 1;
+      setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay,
+                 sizeof(nodelay));
+    }
+    RouterSession* session = malloc(sizeof(RouterSession));
+    session->client_fd = client_fd;
+    pthread_t tid;
+    if (pthread_create(&tid, nullptr, serve_client, session) != 0) {
+      perror("pthread_create");
+      close(client_fd);
+      free(session);
+      continue;
+    }
+    pthread_detach(tid);
+  }
+
+  close(listen_fd);
+  if (socket_path != nullptr)
+    unlink(socket_path);
+  return 0;
+}
@@ -0,0 +1,8 @@
+ROUTER_SRCS := $(wildcard router/*.c)
+ROUTER_OBJS := $(ROUTER_SRCS:.c=.o)
+
+pa3_router: $(ROUTER_OBJS) $(COMMON_OBJS)
+	$(CC) $(CFLAGS) -o $@ $^ $(LDFLAGS) -pthread
+
+clean_pa3_router:
+	rm -f $(ROUTER_OBJS) pa3_router
@@ -0,0 +1,33 @@
+#include "balance.h"
+
+bool load_balancing = true;
+
+bool plan_migration(const uint64_t* busy_ticks,
+                    const bool* has_room,
+                    size_t n_workers,
+                    uint64_t interval_ticks,
+                    size_t* from,
+                    size_t* to,
+                    uint64_t* budget_ticks) {
+  if (n_workers < 2 || interval_ticks == 0)
+    return false;
+  size_t busiest = 0;
+  size_t idlest = n_workers;
+  for (size_t i = 0; i < n_workers; i++) {
+    if (busy_ticks[i] > busy_ticks[busiest])
+      busiest = i;
+    if (has_room[i] &&
+        (idlest == n_workers || busy_ticks[i] < busy_ticks[idlest]))
+      idlest = i;
+  }
+  if (idlest == n_workers || idlest == busiest)
+    return false;
+  uint64_t gap = busy_ticks[busiest] - busy_ticks[idlest];
+  if (busy_ticks[busiest] * 100 < interval_ticks * REBALANCE_BUSY_PERCENT ||
+      gap * 100 < interval_ticks * REBALANCE_GAP_PERCENT)
+    return false;
+  *from = busiest;
+  *to = idlest;
+  *budget_ticks = gap;
+  return true;
+}
@@ -0,0 +1,51 @@
+#ifndef SERVER_BALANCE_H
+#define SERVER_BALANCE_H
+#include <helper.h>
+#include <stdalign.h>
+
+// The main thread compares the workers once per interval. The busiest
+// one must be at least REBALANCE_BUSY_PERCENT busy and that many points
+// busier than the idlest one before a connection moves between them.
+#define REBALANCE_INTERVAL_MS 250
+#define REBALANCE_BUSY_PERCENT 50
+#define REBALANCE_GAP_PERCENT 20
+// Accepts go through the same inbox, which grows to absorb a connect storm
+#define HANDOFF_INITIAL_CAPACITY 64
+
+// Cleared by the -b option, read-only afterwards
+extern bool load_balancing;
+
+// Written by the owning worker with relaxed stores, except migrate_to and
+// migrate_budget_ticks, which the balancer sets and the worker clears
+typedef struct {
+  alignas(64) uint64_t busy_ticks;  // from reading requests to writing them
+  uint64_t requests;
+  uint64_t migrated_out;
+  uint64_t migrated_in;
+  uint64_t reaped;                // idle connections closed
+  int32_t migrate_to;             // -1 when no move is requested
+  uint64_t migrate_budget_ticks;  // move a connection lighter than this
+} WorkerLoad;
+
+// What the main thread saw of one worker at the last interval boundary,
+// and the rates over the interval before it
+typedef struct {
+  uint64_t busy_ticks;
+  uint64_t requests;
+  double busy_percent;
+  double requests_per_second;
+} LoadSample;
+
+// Finds the busiest and the idlest of the busy ticks each worker spent in
+// the last interval, the idlest among those with room for another client;
+// returns false when they are close enough already or none has room.
+// A connection is worth moving when its share is below *budget_ticks,
+// since moving a heavier one would only swap the roles of the two.
+bool plan_migration(const uint64_t* busy_ticks,
+                    const bool* has_room,
+                    size_t n_workers,
+                    uint64_t interval_ticks,
+                    size_t* from,
+                    size_t* to,
+                    uint64_t* budget_ticks);
+#endif
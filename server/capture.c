@@ -0,0 +1,147 @@
+#include "capture.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static void ring_write(CaptureRing* ring, uint64_t head, const void* src,
+                       size_t count) {
+  size_t offset = head & (CAPTURE_RING_SIZE - 1);
+  size_t first = CAPTURE_RING_SIZE - offset;
+  if (first > count)
+    first = count;
+  memcpy(ring->data + offset, src, first);
+  memcpy(ring->data, (const uint8_t*)src + first, count - first);
+}
+
+static void drain_ring(Capture* capture, CaptureRing* ring) {
+  uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  uint64_t tail = ring->tail;
+  if (head == tail)
+    return;
+
+  size_t offset = tail & (CAPTURE_RING_SIZE - 1);
+  size_t count = head - tail;
+  size_t first = CAPTURE_RING_SIZE - offset;
+  if (first > count)
+    first = count;
+  fwrite(ring->data + offset, 1, first, capture->file);
+  fwrite(ring->data, 1, count - first, capture->file);
+
+  __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+}
+
+static void* capture_writer_func(void* arg) {
+  Capture* capture = (Capture*)arg;
+  struct timespec interval = {.tv_sec = 0,
+                              .tv_nsec = CAPTURE_FLUSH_INTERVAL_MS * 1'000'000};
+
+  while (__atomic_load_n(&capture->running, __ATOMIC_ACQUIRE)) {
+    for (size_t i = 0; i < capture->n_rings; i++) {
+      drain_ring(capture, &capture->rings[i]);
+    }
+    fflush(capture->file);
+    nanosleep(&interval, nullptr);
+  }
+
+  for (size_t i = 0; i < capture->n_rings; i++) {
+    drain_ring(capture, &capture->rings[i]);
+  }
+  return nullptr;
+}
+
+Capture* capture_start(const char* path, size_t n_workers) {
+  // Never follow a planted link or reuse another file, and keep the
+  // captured usernames readable by the owner only
+  int32_t fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    perror("open capture file");
+    return nullptr;
+  }
+  FILE* file = fdopen(fd, "wb");
+  if (file == nullptr) {
+    perror("fdopen capture file");
+    close(fd);
+    return nullptr;
+  }
+
+  CaptureFileHeader header = {.version = CAPTURE_VERSION, .reserved = 0};
+  memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+  fwrite(&header, sizeof(header), 1, file);
+
+  Capture* capture = calloc(1, sizeof(Capture));
+  capture->file = file;
+  capture->n_rings = n_workers;
+  capture->rings = calloc(n_workers, sizeof(CaptureRing));
+  for (size_t i = 0; i < n_workers; i++) {
+    capture->rings[i].data = malloc(CAPTURE_RING_SIZE);
+  }
+  capture->start_ns = monotonic_ns();
+  capture->running = true;
+  pthread_create(&capture->writer, nullptr, capture_writer_func, capture);
+  return capture;
+}
+
+void capture_record(Capture* capture,
+                    size_t worker,
+                    uint64_t connection_id,
+                    uint64_t received_ns,
+                    const Request* request,
+                    int32_t response_code) {
+  CaptureRing* ring = &capture->rings[worker];
+  const char* data = request->data;
+  size_t data_size = request->data_size;
+  if (request->action == ACTION_LOGIN || request->action == ACTION_RESUME) {
+    data = CAPTURE_REDACTED_PASSWORD;
+    data_size = sizeof(CAPTURE_REDACTED_PASSWORD) - 1;
+  }
+  CaptureRecordHeader header = {
+      .timestamp_ns = received_ns - capture->start_ns,
+      .connection_id = connection_id,
+      .action = request->action,
+      .response_code = response_code,
+      .username_length = request->username_length,
+      .data_size = data_size};
+  size_t record_size = sizeof(header) + request->username_length + data_size;
+
+  // Never block the worker: a full ring drops the record and counts it
+  uint64_t head = ring->head;
+  uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  if (record_size > CAPTURE_RING_SIZE - (head - tail)) {
+    ring->dropped++;
+    return;
+  }
+
+  ring_write(ring, head, &header, sizeof(header));
+  head += sizeof(header);
+  if (request->username_length > 0) {
+    ring_write(ring, head, request->username, request->username_length);
+    head += request->username_length;
+  }
+  if (data_size > 0) {
+    ring_write(ring, head, data, data_size);
+    head += data_size;
+  }
+  __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+}
+
+void capture_stop(Capture* capture) {
+  if (capture == nullptr)
+    return;
+
+  __atomic_store_n(&capture->running, false, __ATOMIC_RELEASE);
+  pthread_join(capture->writer, nullptr);
+
+  uint64_t dropped = 0;
+  for (size_t i = 0; i < capture->n_rings; i++) {
+    dropped += capture->rings[i].dropped;
+    free(capture->rings[i].data);
+  }
+  if (dropped > 0)
+    fprintf(stderr, "Capture dropped %lu records (ring full)\n", dropped);
+
+  fclose(capture->file);
+  free(capture->rings);
+  free(capture);
+}
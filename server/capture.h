@@ -0,0 +1,37 @@
+#ifndef SERVER_CAPTURE_H
+#define SERVER_CAPTURE_H
+#include <capture.h>
+#include <helper.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#define CAPTURE_RING_SIZE (1 << 20)
+#define CAPTURE_FLUSH_INTERVAL_MS 10
+
+// Single-producer/single-consumer byte ring: the worker appends records,
+// the capture writer thread drains them to the file
+typedef struct {
+  uint8_t* data;
+  uint64_t head;  // bytes produced, written by the worker only
+  uint64_t tail;  // bytes consumed, written by the writer only
+  uint64_t dropped;
+} CaptureRing;
+
+typedef struct {
+  FILE* file;
+  CaptureRing* rings;
+  size_t n_rings;
+  uint64_t start_ns;
+  bool running;
+  pthread_t writer;
+} Capture;
+
+Capture* capture_start(const char* path, size_t n_workers);
+void capture_record(Capture* capture,
+                    size_t worker,
+                    uint64_t connection_id,
+                    uint64_t received_ns,
+                    const Request* request,
+                    int32_t response_code);
+void capture_stop(Capture* capture);
+#endif
@@ -0,0 +1,107 @@
+#include "flight_recorder.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+_Thread_local FlightRecorder* thread_flight_recorder = nullptr;
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static FlightRecorder** registry = nullptr;
+static size_t registry_size = 0;
+
+// Lock events carry a tick count in arg1, printed in ns
+static const struct {
+  const char* name;
+  const char* arg0;
+  const char* arg1;
+} event_formats[TRACE_N_EVENTS] = {
+    [TRACE_ACCEPT] = {"accept", "conn", "fd"},
+    [TRACE_FRAME_COMPLETE] = {"frame_complete", "conn", "action"},
+    [TRACE_HANDLER_ENTRY] = {"handler_entry", "action", nullptr},
+    [TRACE_HANDLER_EXIT] = {"handler_exit", "action", "code"},
+    [TRACE_ARGON2_BEGIN] = {"argon2_begin", "verify", nullptr},
+    [TRACE_ARGON2_END] = {"argon2_end", "verify", "result"},
+    [TRACE_SEAT_LOCK] = {"seat_lock", "seat", "wait_ns"},
+    [TRACE_HANDOFF_LOCK] = {"handoff_lock", "worker", "wait_ns"},
+    [TRACE_WRITE_FLUSH] = {"write_flush", "conn", "bytes"},
+};
+
+void flight_recorder_register(const char* name) {
+  FlightRecorder* recorder = calloc(1, sizeof(FlightRecorder));
+  if (recorder == nullptr) {
+    perror("calloc failed");
+    exit(EXIT_FAILURE);
+  }
+  strncpy(recorder->name, name, sizeof(recorder->name) - 1);
+
+  pthread_mutex_lock(&registry_mutex);
+  registry = realloc(registry, sizeof(FlightRecorder*) * (registry_size + 1));
+  if (registry == nullptr) {
+    perror("realloc");
+    exit(EXIT_FAILURE);
+  }
+  registry[registry_size++] = recorder;
+  pthread_mutex_unlock(&registry_mutex);
+
+  thread_flight_recorder = recorder;
+}
+
+static void dump_recorder(FILE* out,
+                          const FlightRecorder* recorder,
+                          TraceEvent* snapshot,
+                          uint64_t now,
+                          double ns_per_tick) {
+  uint64_t end = __atomic_load_n(&recorder->next, __ATOMIC_ACQUIRE);
+  memcpy(snapshot, recorder->events, sizeof(recorder->events));
+  // Slots the owner reused while we copied may be torn; skip them
+  uint64_t end_after = __atomic_load_n(&recorder->next, __ATOMIC_ACQUIRE);
+  uint64_t begin = end_after > FLIGHT_RECORDER_EVENTS
+                       ? end_after - FLIGHT_RECORDER_EVENTS + 1
+                       : 0;
+
+  fprintf(out, "[%s] %lu events, last %lu:\n", recorder->name, end,
+          end > begin ? end - begin : 0);
+  for (uint64_t i = begin; i < end; i++) {
+    const TraceEvent* event = &snapshot[i & (FLIGHT_RECORDER_EVENTS - 1)];
+    if (event->event >= TRACE_N_EVENTS)
+      continue;
+    double age_us =
+        (double)(int64_t)(now - event->timestamp) * ns_per_tick / 1e3;
+    int64_t arg1 = (int64_t)event->arg1;
+    if (event->event == TRACE_SEAT_LOCK ||
+        event->event == TRACE_HANDOFF_LOCK)
+      arg1 = (int64_t)(arg1 * ns_per_tick);
+    fprintf(out, "  -%12.1f us %-15s %s=%ld", age_us,
+            event_formats[event->event].name, event_formats[event->event].arg0,
+            (int64_t)event->arg0);
+    if (event_formats[event->event].arg1 != nullptr)
+      fprintf(out, " %s=%ld", event_formats[event->event].arg1, arg1);
+    fprintf(out, "\n");
+  }
+}
+
+void flight_recorder_dump(FILE* out, double ns_per_tick) {
+  TraceEvent* snapshot = malloc(sizeof(TraceEvent) * FLIGHT_RECORDER_EVENTS);
+  uint64_t now = stats_now();
+
+  pthread_mutex_lock(&registry_mutex);
+  for (size_t i = 0; i < registry_size; i++) {
+    dump_recorder(out, registry[i], snapshot, now, ns_per_tick);
+  }
+  pthread_mutex_unlock(&registry_mutex);
+  fflush(out);
+  free(snapshot);
+}
+
+void flight_recorder_free_all() {
+  pthread_mutex_lock(&registry_mutex);
+  for (size_t i = 0; i < registry_size; i++) {
+    free(registry[i]);
+  }
+  free(registry);
+  registry = nullptr;
+  registry_size = 0;
+  pthread_mutex_unlock(&registry_mutex);
+  thread_flight_recorder = nullptr;
+}
@@ -0,0 +1,83 @@
+#ifndef SERVER_FLIGHT_RECORDER_H
+#define SERVER_FLIGHT_RECORDER_H
+#include <helper.h>
+#include <stdio.h>
+#include "stats.h"
+
+// Static USDT probes in the "pa3_server" provider, visible to perf and
+// bpftrace when <sys/sdt.h> (systemtap-sdt-dev) is installed. A probe site
+// is a single nop until a tracer attaches. Build with -DPA3_NO_USDT to
+// leave them out entirely.
+#if !defined(PA3_NO_USDT) && __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PA3_PROBE(name, arg0, arg1) \
+  DTRACE_PROBE2(pa3_server, name, arg0, arg1)
+#else
+#define PA3_PROBE(name, arg0, arg1) ((void)0)
+#endif
+
+// Fires the USDT probe and appends the event to the calling thread's
+// flight recorder. TRACE_EVENT_AT reuses a stats_now() value the caller
+// already has, which saves the clock read.
+#define TRACE_EVENT(event, probe, arg0, arg1) \
+  TRACE_EVENT_AT(event, probe, stats_now(), arg0, arg1)
+#define TRACE_EVENT_AT(event, probe, timestamp, arg0, arg1)           \
+  do {                                                                \
+    PA3_PROBE(probe, arg0, arg1);                                     \
+    flight_recorder_record(event, timestamp, (uint64_t)(arg0),        \
+                           (uint64_t)(arg1));                         \
+  } while (0)
+
+// Per-thread ring of the most recent events, must be a power of two
+#define FLIGHT_RECORDER_EVENTS 1024
+#define FLIGHT_RECORDER_NAME_SIZE 16
+
+typedef enum {
+  TRACE_ACCEPT,          // connection id, fd
+  TRACE_FRAME_COMPLETE,  // connection id, action
+  TRACE_HANDLER_ENTRY,   // action, 0
+  TRACE_HANDLER_EXIT,    // action, response code
+  TRACE_ARGON2_BEGIN,    // 0 hash / 1 verify, 0
+  TRACE_ARGON2_END,      // 0 hash / 1 verify, result
+  TRACE_SEAT_LOCK,       // seat id, ticks spent waiting
+  TRACE_HANDOFF_LOCK,    // worker index, ticks spent waiting
+  TRACE_WRITE_FLUSH,     // connection id, bytes written or -1
+  TRACE_N_EVENTS
+} TraceEventType;
+
+typedef struct {
+  uint64_t timestamp;  // stats_now() ticks
+  uint64_t arg0;
+  uint64_t arg1;
+  uint32_t event;
+} TraceEvent;
+
+typedef struct {
+  char name[FLIGHT_RECORDER_NAME_SIZE];
+  uint64_t next;  // events recorded so far, written by the owner only
+  TraceEvent events[FLIGHT_RECORDER_EVENTS];
+} FlightRecorder;
+
+extern _Thread_local FlightRecorder* thread_flight_recorder;
+
+// Gives the calling thread a recorder; threads without one record nothing
+void flight_recorder_register(const char* name);
+
+static inline void flight_recorder_record(TraceEventType event,
+                                          uint64_t timestamp,
+                                          uint64_t arg0,
+                                          uint64_t arg1) {
+  FlightRecorder* recorder = thread_flight_recorder;
+  if (recorder == nullptr)
+    return;
+  uint64_t next = recorder->next;
+  recorder->events[next & (FLIGHT_RECORDER_EVENTS - 1)] = (TraceEvent){
+      .timestamp = timestamp, .arg0 = arg0, .arg1 = arg1, .event = event};
+  __atomic_store_n(&recorder->next, next + 1, __ATOMIC_RELEASE);
+}
+
+// Prints every thread's ring, oldest first. The owners keep running, so
+// the oldest few events of a busy thread may already be overwritten.
+void flight_recorder_dump(FILE* out, double ns_per_tick);
+void flight_recorder_free_all();
+#endif
@@ -5,40 +5,104 @@
 #include <string.h>
 #include "helper.h"
 
+// Answers with the resume token the login was issued, if any
+static LoginErrorCode answer_login(Response* response, const char* token) {
+  if (resume_ttl_s > 0) {
+    response->data = malloc(RESUME_TOKEN_LENGTH);
+    memcpy(response->data, token, RESUME_TOKEN_LENGTH);
+    response->data_size = RESUME_TOKEN_LENGTH;
+  }
+  response->code = LOGIN_ERROR_SUCCESS;
+  return LOGIN_ERROR_SUCCESS;
+}
+
 LoginErrorCode handle_login_request(const Request* request,
                                     Response* response,
-                                    Users* users) {
+                                    Users* users,
+                                    const Session* session) {
   if (request->data_size == 0) {
     response->code = LOGIN_ERROR_NO_PASSWORD;
     return LOGIN_ERROR_NO_PASSWORD;
   }
 
   ssize_t user_index = find_user(users, request->username);
+  char token[RESUME_TOKEN_LENGTH];
   
   if (user_index == -1) {
-    // New user
-    char hashed_password[HASHED_PASSWORD_SIZE];
-    hash_password(request->data, hashed_password);
-    size_t new_user_index = add_user(users, request->username, hashed_password);
-    users->array[new_user_index].logged_in = true;
-    response->code = LOGIN_ERROR_SUCCESS;
-    return LOGIN_ERROR_SUCCESS;
-  } else {
-    // Existing user
-    if (users->array[user_index].logged_in) {
+    // New user, unless a concurrent login adds the name first
+    PasswordRecord password;
+    hash_password(request->data, &password);
+    user_index = add_user(users, request->username, &password);
+    if (user_index >= 0) {
+      if (log_in_user(users, user_index, session->connection_id, token))
+        return answer_login(response, token);
       response->code = LOGIN_ERROR_ACTIVE_USER;
       return LOGIN_ERROR_ACTIVE_USER;
     }
+    user_index = find_user(users, request->username);
+  }
 
-    if (!validate_password(request->data, users->array[user_index].hashed_password)) {
-      response->code = LOGIN_ERROR_INCORRECT_PASSWORD;
-      return LOGIN_ERROR_INCORRECT_PASSWORD;
-    }
+  // Existing user
+  User* user = user_at(users, user_index);
+  if (user->logged_in) {
+    response->code = LOGIN_ERROR_ACTIVE_USER;
+    return LOGIN_ERROR_ACTIVE_USER;
+  }
+
+  // Checked against a copy, as a concurrent login may be rehashing it
+  PasswordRecord password;
+  copy_password(users, user_index, &password);
+  if (!validate_password(request->data, &password)) {
+    response->code = LOGIN_ERROR_INCORRECT_PASSWORD;
+    return LOGIN_ERROR_INCORRECT_PASSWORD;
+  }
+
+  if (!log_in_user(users, user_index, session->connection_id, token)) {
+    response->code = LOGIN_ERROR_ACTIVE_USER;
+    return LOGIN_ERROR_ACTIVE_USER;
+  }
 
-    users->array[user_index].logged_in = true;
-    response->code = LOGIN_ERROR_SUCCESS;
-    return LOGIN_ERROR_SUCCESS;
+  // Only now is the plaintext known good, so upgrade the stored hash
+  if (hash_params_outdated(&password, &hash_params)) {
+    hash_password(request->data, &password);
+    store_password(users, user_index, &password);
   }
+
+  return answer_login(response, token);
+}
+
+// The token stands in for the password, so no argon2 is run
+ResumeErrorCode handle_resume_request(const Request* request,
+                                      Response* response,
+                                      Users* users,
+                                      const Session* session) {
+  if (request->data_size == 0) {
+    response->code = RESUME_ERROR_NO_DATA;
+    return RESUME_ERROR_NO_DATA;
+  }
+
+  ssize_t user_index = find_user(users, request->username);
+  if (user_index == -1) {
+    response->code = RESUME_ERROR_INVALID_TOKEN;
+    return RESUME_ERROR_INVALID_TOKEN;
+  }
+
+  response->code = resume_user(users, user_index, request->data,
+                               request->data_size, session->connection_id);
+  return response->code;
+}
+
+// Frees a seat the caller has locked, or hands it to the oldest waiter
+static void release_seat(Seat* seat, pa3_seat_t seat_num, Waitlist* waitlist) {
+  const char* holder = seat->user_who_booked;
+  // Someone else queued for it gets it without it ever showing up as free
+  seat->user_who_booked = waitlist_grant(waitlist, seat_num, holder);
+  free((void*)holder);
+  if (seat->user_who_booked != nullptr)
+    seat->amount_of_times_booked++;
+  else
+    listing_cache_invalidate(&listing_cache);
+  seat->amount_of_times_canceled++;
 }
 
 BookErrorCode handle_book_request(const Request* request,
@@ -51,7 +115,7 @@ BookErrorCode handle_book_request(const Request* request,
   }
 
   ssize_t user_index = find_user(users, request->username);
-  if (user_index == -1 || !users->array[user_index].logged_in) {
+  if (user_index == -1 || !user_at(users, user_index)->logged_in) {
     response->code = BOOK_ERROR_USER_NOT_LOGGED_IN;
     return BOOK_ERROR_USER_NOT_LOGGED_IN;
   }
@@ -64,7 +128,7 @@ BookErrorCode handle_book_request(const Request* request,
   }
 
   Seat* seat = &seats[seat_num - 1];
-  pthread_mutex_lock(&seat->mutex);
+  lock_seat(seat);
 
   if (seat->user_who_booked != nullptr) {
     pthread_mutex_unlock(&seat->mutex);
@@ -74,6 +138,7 @@ BookErrorCode handle_book_request(const Request* request,
 
   seat->user_who_booked = strdup(request->username);
   seat->amount_of_times_booked++;
+  listing_cache_invalidate(&listing_cache);
   pthread_mutex_unlock(&seat->mutex);
 
   response->code = BOOK_ERROR_SUCCESS;
@@ -90,7 +155,7 @@ ConfirmBookingErrorCode handle_confirm_booking_request(const Request* request,
   }
 
   ssize_t user_index = find_user(users, request->username);
-  if (user_index == -1 || !users->array[user_index].logged_in) {
+  if (user_index == -1 || !user_at(users, user_index)->logged_in) {
     response->code = CONFIRM_BOOKING_ERROR_USER_NOT_LOGGED_IN;
     return CONFIRM_BOOKING_ERROR_USER_NOT_LOGGED_IN;
   }
@@ -103,11 +168,25 @@ ConfirmBookingErrorCode handle_confirm_booking_request(const Request* request,
     return CONFIRM_BOOKING_ERROR_INVALID_DATA;
   }
 
-  pa3_seat_t* result_seats = malloc(NUM_SEATS * sizeof(pa3_seat_t));
+  // The free seats are the same for everyone, so while no seat changes
+  // one listing answers them all
+  uint64_t version = listing_cache_version(&listing_cache);
+  if (show_available) {
+    SharedBuffer* listing = listing_cache_get(&listing_cache, version);
+    if (listing != nullptr) {
+      response->shared = listing;
+      response->data = listing->data;
+      response->data_size = listing->size;
+      response->code = CONFIRM_BOOKING_ERROR_SUCCESS;
+      return CONFIRM_BOOKING_ERROR_SUCCESS;
+    }
+  }
+
+  pa3_seat_t result_seats[NUM_SEATS];
   size_t count = 0;
 
-  for (int i = 0; i < NUM_SEATS; i++) {
-    pthread_mutex_lock(&seats[i].mutex);
+  for (pa3_seat_t i = owned_seats.first - 1; i < owned_seats.last; i++) {
+    lock_seat(&seats[i]);
     bool is_available = seats[i].user_who_booked == nullptr;
     bool is_booked_by_user = !is_available && strcmp(seats[i].user_who_booked, request->username) == 0;
     pthread_mutex_unlock(&seats[i].mutex);
@@ -117,11 +196,19 @@ ConfirmBookingErrorCode handle_confirm_booking_request(const Request* request,
     }
   }
 
-  if (count > 0) {
-    response->data = (uint8_t*)result_seats;
-    response->data_size = count * sizeof(pa3_seat_t);
+  size_t size = count * sizeof(pa3_seat_t);
+  if (show_available) {
+    SharedBuffer* listing = shared_buffer_new(size);
+    memcpy(listing->data, result_seats, size);
+    listing_cache_put(&listing_cache, version, listing);
+    response->shared = listing;
+    response->data = listing->data;
+    response->data_size = size;
+  } else if (count > 0) {
+    response->data = malloc(size);
+    memcpy(response->data, result_seats, size);
+    response->data_size = size;
   } else {
-    free(result_seats);
     response->data = nullptr;
     response->data_size = 0;
   }
@@ -133,14 +220,15 @@ ConfirmBookingErrorCode handle_confirm_booking_request(const Request* request,
 CancelBookingErrorCode handle_cancel_booking_request(const Request* request,
                                                      Response* response,
                                                      Users* users,
-                                                     Seat* seats) {
+                                                     Seat* seats,
+                                                     Waitlist* waitlist) {
   if (request->data_size == 0) {
     response->code = CANCEL_BOOKING_ERROR_NO_DATA;
     return CANCEL_BOOKING_ERROR_NO_DATA;
   }
 
   ssize_t user_index = find_user(users, request->username);
-  if (user_index == -1 || !users->array[user_index].logged_in) {
+  if (user_index == -1 || !user_at(users, user_index)->logged_in) {
     response->code = CANCEL_BOOKING_ERROR_USER_NOT_LOGGED_IN;
     return CANCEL_BOOKING_ERROR_USER_NOT_LOGGED_IN;
   }
@@ -153,7 +241,7 @@ CancelBookingErrorCode handle_cancel_booking_request(const Request* request,
   }
 
   Seat* seat = &seats[seat_num - 1];
-  pthread_mutex_lock(&seat->mutex);
+  lock_seat(seat);
 
   if (seat->user_who_booked == nullptr || strcmp(seat->user_who_booked, request->username) != 0) {
     pthread_mutex_unlock(&seat->mutex);
@@ -161,9 +249,7 @@ CancelBookingErrorCode handle_cancel_booking_request(const Request* request,
     return CANCEL_BOOKING_ERROR_SEAT_NOT_BOOKED_BY_USER;
   }
 
-  free((void*)seat->user_who_booked);
-  seat->user_who_booked = nullptr;
-  seat->amount_of_times_canceled++;
+  release_seat(seat, seat_num, waitlist);
   pthread_mutex_unlock(&seat->mutex);
 
   response->code = CANCEL_BOOKING_ERROR_SUCCESS;
@@ -179,12 +265,12 @@ LogoutErrorCode handle_logout_request(const Request* request,
     return LOGOUT_ERROR_USER_NOT_FOUND;
   }
 
-  if (!users->array[user_index].logged_in) {
+  // Of two logouts racing, one finds the user logged out already
+  if (!log_out_user(users, user_index)) {
     response->code = LOGOUT_ERROR_USER_NOT_LOGGED_IN;
     return LOGOUT_ERROR_USER_NOT_LOGGED_IN;
   }
 
-  users->array[user_index].logged_in = false;
   response->code = LOGOUT_ERROR_SUCCESS;
   return LOGOUT_ERROR_SUCCESS;
 }
@@ -205,7 +291,7 @@ QueryErrorCode handle_query_request(const Request* request,
   }
 
   Seat* seat = &seats[seat_num - 1];
-  pthread_mutex_lock(&seat->mutex);
+  lock_seat(seat);
   
   Seat* seat_copy = malloc(sizeof(Seat));
   if (seat_copy == nullptr) {
@@ -223,23 +309,397 @@ QueryErrorCode handle_query_request(const Request* request,
   return QUERY_ERROR_SUCCESS;
 }
 
+WaitlistErrorCode handle_waitlist_request(const Request* request,
+                                          Response* response,
+                                          Users* users,
+                                          Seat* seats,
+                                          Waitlist* waitlist,
+                                          Waiter* waiter) {
+  if (request->data_size == 0) {
+    response->code = WAITLIST_ERROR_NO_DATA;
+    return WAITLIST_ERROR_NO_DATA;
+  }
+
+  ssize_t user_index = find_user(users, request->username);
+  if (user_index == -1 || !user_at(users, user_index)->logged_in) {
+    response->code = WAITLIST_ERROR_USER_NOT_LOGGED_IN;
+    return WAITLIST_ERROR_USER_NOT_LOGGED_IN;
+  }
+
+  pa3_seat_t first;
+  pa3_seat_t last;
+  if (!parse_waitlist_range(request->data, NUM_SEATS, &first, &last)) {
+    response->code = WAITLIST_ERROR_SEAT_OUT_OF_RANGE;
+    return WAITLIST_ERROR_SEAT_OUT_OF_RANGE;
+  }
+
+  // Giving such a seat up would only hand it back
+  for (pa3_seat_t seat_num = first; seat_num <= last; seat_num++) {
+    Seat* seat = &seats[seat_num - 1];
+    lock_seat(seat);
+    bool held = seat->user_who_booked != nullptr &&
+                strcmp(seat->user_who_booked, request->username) == 0;
+    pthread_mutex_unlock(&seat->mutex);
+    if (held) {
+      response->code = WAITLIST_ERROR_SEAT_HELD;
+      return WAITLIST_ERROR_SEAT_HELD;
+    }
+  }
+
+  WaitTicket* ticket =
+      waitlist_enqueue(waitlist, waiter, user_at(users, user_index),
+                       request->username, first, last);
+  if (ticket == nullptr) {
+    response->code = WAITLIST_ERROR_TOO_MANY_TICKETS;
+    return WAITLIST_ERROR_TOO_MANY_TICKETS;
+  }
+
+  // Queued first, so a seat cancelled from now on is handed to the
+  // ticket; one freed before then is still free here
+  for (pa3_seat_t seat_num = first; seat_num <= last; seat_num++) {
+    Seat* seat = &seats[seat_num - 1];
+    lock_seat(seat);
+    if (seat->user_who_booked != nullptr) {
+      pthread_mutex_unlock(&seat->mutex);
+      continue;
+    }
+    if (!waitlist_claim(waitlist, ticket)) {
+      // A cancellation got there first; its notice will say which seat
+      pthread_mutex_unlock(&seat->mutex);
+      break;
+    }
+    seat->user_who_booked = strdup(request->username);
+    seat->amount_of_times_booked++;
+    listing_cache_invalidate(&listing_cache);
+    pthread_mutex_unlock(&seat->mutex);
+
+    pa3_seat_t* assigned = malloc(sizeof(pa3_seat_t));
+    *assigned = seat_num;
+    response->data = (uint8_t*)assigned;
+    response->data_size = sizeof(pa3_seat_t);
+    response->code = WAITLIST_ERROR_SEAT_ASSIGNED;
+    return WAITLIST_ERROR_SEAT_ASSIGNED;
+  }
+
+  response->code = WAITLIST_ERROR_SUCCESS;
+  return WAITLIST_ERROR_SUCCESS;
+}
+
+// Parses "<seat>,<seat>,..." into ascending order without duplicates,
+// the order book_seats takes the locks in. Returns the number of seats,
+// 0 if one is malformed or out of range.
+static size_t parse_seat_list(const char* text, pa3_seat_t* list) {
+  bool listed[NUM_SEATS] = {false};
+  for (;;) {
+    char* end;
+    long seat_num = strtol(text, &end, 10);
+    if (end == text || seat_num < 1 || seat_num > NUM_SEATS)
+      return 0;
+    listed[seat_num - 1] = true;
+    if (*end == '\0')
+      break;
+    if (*end != ',')
+      return 0;
+    text = end + 1;
+  }
+  size_t n_seats = 0;
+  for (pa3_seat_t i = 0; i < NUM_SEATS; i++)
+    if (listed[i])
+      list[n_seats++] = i + 1;
+  return n_seats;
+}
+
+// Books every seat of list for username, or none if one is taken. All
+// the locks are held at once, taken in ascending order so two batches
+// never wait on each other.
+static bool book_seats(Seat* seats,
+                       const pa3_seat_t* list,
+                       size_t n_seats,
+                       const char* username) {
+  for (size_t i = 0; i < n_seats; i++)
+    lock_seat(&seats[list[i] - 1]);
+  bool all_free = true;
+  for (size_t i = 0; i < n_seats && all_free; i++)
+    all_free = seats[list[i] - 1].user_who_booked == nullptr;
+  if (all_free)
+    listing_cache_invalidate(&listing_cache);
+  for (size_t i = 0; i < n_seats; i++) {
+    Seat* seat = &seats[list[i] - 1];
+    if (all_free) {
+      seat->user_who_booked = strdup(username);
+      seat->amount_of_times_booked++;
+    }
+    pthread_mutex_unlock(&seat->mutex);
+  }
+  return all_free;
+}
+
+BatchBookErrorCode handle_batch_book_request(const Request* request,
+                                             Response* response,
+                                             Users* users,
+                                             Seat* seats) {
+  if (request->data_size == 0) {
+    response->code = BATCH_BOOK_ERROR_NO_DATA;
+    return BATCH_BOOK_ERROR_NO_DATA;
+  }
+
+  ssize_t user_index = find_user(users, request->username);
+  if (user_index == -1 || !user_at(users, user_index)->logged_in) {
+    response->code = BATCH_BOOK_ERROR_USER_NOT_LOGGED_IN;
+    return BATCH_BOOK_ERROR_USER_NOT_LOGGED_IN;
+  }
+
+  pa3_seat_t list[NUM_SEATS];
+  size_t n_seats = parse_seat_list(request->data, list);
+  if (n_seats == 0) {
+    response->code = BATCH_BOOK_ERROR_SEAT_OUT_OF_RANGE;
+    return BATCH_BOOK_ERROR_SEAT_OUT_OF_RANGE;
+  }
+
+  if (!book_seats(seats, list, n_seats, request->username)) {
+    response->code = BATCH_BOOK_ERROR_SEAT_UNAVAILABLE;
+    return BATCH_BOOK_ERROR_SEAT_UNAVAILABLE;
+  }
+  response->code = BATCH_BOOK_ERROR_SUCCESS;
+  return BATCH_BOOK_ERROR_SUCCESS;
+}
+
+// Parses the "<transaction>" that starts a prepare, commit or abort;
+// rest points past it
+static bool parse_transaction(const char* text,
+                              uint64_t* transaction,
+                              const char** rest) {
+  char* end;
+  *transaction = strtoull(text, &end, 10);
+  *rest = end;
+  return end != text;
+}
+
+// Unlinks the prepared batch of session with that transaction
+static PreparedBooking* take_prepared(Session* session, uint64_t transaction) {
+  PreparedBooking** link = &session->prepared;
+  while (*link != nullptr && (*link)->transaction != transaction)
+    link = &(*link)->next;
+  PreparedBooking* prepared = *link;
+  if (prepared != nullptr)
+    *link = prepared->next;
+  return prepared;
+}
+
+// Gives back the seats of a batch still booked in its name
+static void undo_prepared(PreparedBooking* prepared,
+                          Seat* seats,
+                          Waitlist* waitlist) {
+  for (size_t i = 0; i < prepared->n_seats; i++) {
+    Seat* seat = &seats[prepared->seats[i] - 1];
+    lock_seat(seat);
+    if (seat->user_who_booked != nullptr &&
+        strcmp(seat->user_who_booked, prepared->username) == 0)
+      release_seat(seat, prepared->seats[i], waitlist);
+    pthread_mutex_unlock(&seat->mutex);
+  }
+}
+
+static void free_prepared(PreparedBooking* prepared) {
+  free(prepared->username);
+  free(prepared->seats);
+  free(prepared);
+}
+
+BatchBookErrorCode handle_prepare_book_request(const Request* request,
+                                               Response* response,
+                                               Users* users,
+                                               Seat* seats,
+                                               Session* session) {
+  if (request->data_size == 0) {
+    response->code = BATCH_BOOK_ERROR_NO_DATA;
+    return BATCH_BOOK_ERROR_NO_DATA;
+  }
+
+  ssize_t user_index = find_user(users, request->username);
+  if (user_index == -1 || !user_at(users, user_index)->logged_in) {
+    response->code = BATCH_BOOK_ERROR_USER_NOT_LOGGED_IN;
+    return BATCH_BOOK_ERROR_USER_NOT_LOGGED_IN;
+  }
+
+  uint64_t transaction;
+  const char* rest;
+  pa3_seat_t list[NUM_SEATS];
+  size_t n_seats = 0;
+  if (parse_transaction(request->data, &transaction, &rest) && *rest == ':')
+    n_seats = parse_seat_list(rest + 1, list);
+  if (n_seats == 0) {
+    response->code = BATCH_BOOK_ERROR_SEAT_OUT_OF_RANGE;
+    return BATCH_BOOK_ERROR_SEAT_OUT_OF_RANGE;
+  }
+
+  if (!book_seats(seats, list, n_seats, request->username)) {
+    response->code = BATCH_BOOK_ERROR_SEAT_UNAVAILABLE;
+    return BATCH_BOOK_ERROR_SEAT_UNAVAILABLE;
+  }
+
+  PreparedBooking* prepared = malloc(sizeof(PreparedBooking));
+  pa3_seat_t* booked = malloc(n_seats * sizeof(pa3_seat_t));
+  if (prepared == nullptr || booked == nullptr) {
+    perror("malloc failed");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(booked, list, n_seats * sizeof(pa3_seat_t));
+  *prepared = (PreparedBooking){.transaction = transaction,
+                                .username = strdup(request->username),
+                                .seats = booked,
+                                .n_seats = n_seats,
+                                .next = session->prepared};
+  session->prepared = prepared;
+  response->code = BATCH_BOOK_ERROR_SUCCESS;
+  return BATCH_BOOK_ERROR_SUCCESS;
+}
+
+// Commit and abort both answer UNKNOWN_TRANSACTION for a batch this
+// connection did not prepare or has already settled
+BatchBookErrorCode handle_settle_book_request(const Request* request,
+                                              Response* response,
+                                              Seat* seats,
+                                              Waitlist* waitlist,
+                                              Session* session) {
+  if (request->data_size == 0) {
+    response->code = BATCH_BOOK_ERROR_NO_DATA;
+    return BATCH_BOOK_ERROR_NO_DATA;
+  }
+
+  uint64_t transaction;
+  const char* rest;
+  PreparedBooking* prepared = nullptr;
+  if (parse_transaction(request->data, &transaction, &rest) && *rest == '\0')
+    prepared = take_prepared(session, transaction);
+  if (prepared == nullptr) {
+    response->code = BATCH_BOOK_ERROR_UNKNOWN_TRANSACTION;
+    return BATCH_BOOK_ERROR_UNKNOWN_TRANSACTION;
+  }
+
+  if (request->action == ACTION_ABORT_BOOK)
+    undo_prepared(prepared, seats, waitlist);
+  free_prepared(prepared);
+  response->code = BATCH_BOOK_ERROR_SUCCESS;
+  return BATCH_BOOK_ERROR_SUCCESS;
+}
+
+void end_session(Session* session, Seat* seats, Waitlist* waitlist) {
+  waitlist_drop(waitlist, &session->waiter);
+  // Presumed abort: a router that went before committing never will
+  while (session->prepared != nullptr) {
+    PreparedBooking* prepared = session->prepared;
+    session->prepared = prepared->next;
+    undo_prepared(prepared, seats, waitlist);
+    free_prepared(prepared);
+  }
+}
+
+StatsErrorCode handle_stats_request(Response* response,
+                                    const ServerStats* stats) {
+  size_t length;
+  response->data = (uint8_t*)stats_report(stats, &length);
+  response->data_size = length;
+  response->code = STATS_ERROR_SUCCESS;
+  return STATS_ERROR_SUCCESS;
+}
+
+static bool owns_seat(pa3_seat_t seat_num) {
+  return seat_num >= owned_seats.first && seat_num <= owned_seats.last;
+}
+
+// False if the request names a seat another shard owns. Malformed seat
+// numbers pass, for the handler to report as usual.
+static bool on_own_shard(const Request* request) {
+  if (owned_seats.first == 1 && owned_seats.last == NUM_SEATS)
+    return true;
+  if (request->data_size == 0)
+    return true;
+
+  const char* text = request->data;
+  switch (request->action) {
+    case ACTION_BOOK:
+    case ACTION_CANCEL_BOOKING:
+    case ACTION_QUERY:
+    case ACTION_WAITLIST:
+      break;
+    case ACTION_PREPARE_BOOK:
+      text = strchr(text, ':');
+      if (text == nullptr)
+        return true;
+      text++;
+      [[fallthrough]];
+    case ACTION_BATCH_BOOK: {
+      pa3_seat_t list[NUM_SEATS];
+      size_t n_seats = parse_seat_list(text, list);
+      for (size_t i = 0; i < n_seats; i++)
+        if (!owns_seat(list[i]))
+          return false;
+      return true;
+    }
+    default:
+      return true;
+  }
+
+  // A seat, or for a waitlist "<first>-<last>", which must not straddle
+  // shards
+  char* end;
+  long seat_num = strtol(text, &end, 10);
+  if (end == text || seat_num < 1 || seat_num > NUM_SEATS)
+    return true;
+  if (!owns_seat(seat_num))
+    return false;
+  if (request->action == ACTION_WAITLIST && *end == '-') {
+    long last = strtol(end + 1, &end, 10);
+    if (last >= seat_num && last <= NUM_SEATS && !owns_seat(last))
+      return false;
+  }
+  return true;
+}
+
 int32_t handle_request(const Request* request,
                        Response* response,
                        Users* users,
-                       Seat* seats) {
+                       Seat* seats,
+                       const ServerStats* stats,
+                       Waitlist* waitlist,
+                       Session* session) {
+  // Seats of other shards are refused before any handler looks at them
+  if (!on_own_shard(request)) {
+    response->code = SHARD_ERROR_WRONG_SHARD;
+    return SHARD_ERROR_WRONG_SHARD;
+  }
+
   switch (request->action) {
     case ACTION_LOGIN:
-      return handle_login_request(request, response, users);
+      return handle_login_request(request, response, users, session);
     case ACTION_BOOK:
       return handle_book_request(request, response, users, seats);
     case ACTION_CONFIRM_BOOKING:
       return handle_confirm_booking_request(request, response, users, seats);
     case ACTION_CANCEL_BOOKING:
-      return handle_cancel_booking_request(request, response, users, seats);
+      return handle_cancel_booking_request(request, response, users, seats,
+                                           waitlist);
     case ACTION_LOGOUT:
       return handle_logout_request(request, response, users);
     case ACTION_QUERY:
       return handle_query_request(request, response, seats);
+    case ACTION_STATS:
+      return handle_stats_request(response, stats);
+    case ACTION_WAITLIST:
+      return handle_waitlist_request(request, response, users, seats,
+                                     waitlist, &session->waiter);
+    case ACTION_BATCH_BOOK:
+      return handle_batch_book_request(request, response, users, seats);
+    case ACTION_PREPARE_BOOK:
+      return handle_prepare_book_request(request, response, users, seats,
+                                         session);
+    case ACTION_COMMIT_BOOK:
+    case ACTION_ABORT_BOOK:
+      return handle_settle_book_request(request, response, seats, waitlist,
+                                        session);
+    case ACTION_RESUME:
+      return handle_resume_request(request, response, users, session);
     case ACTION_TERMINATION:
       response->code = -1;
       return -1;
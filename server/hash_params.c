@@ -0,0 +1,93 @@
+#include "hash_params.h"
+#include <argon2.h>
+#include <stdio.h>
+#include <string.h>
+#include "helper.h"
+
+HashParams hash_params = {.time_cost = DEFAULT_TIME_COST,
+                          .memory_kib = DEFAULT_MEMORY_KIB,
+                          .parallelism = DEFAULT_PARALLELISM};
+
+static bool valid_hash_params(const HashParams* params) {
+  return params->time_cost >= 1 && params->parallelism >= 1 &&
+         params->memory_kib >= 8 * params->parallelism;
+}
+
+bool parse_hash_params(const char* text, HashParams* params) {
+  HashParams parsed;
+  int32_t consumed = 0;
+  if (sscanf(text, "%u,%u,%u%n", &parsed.time_cost, &parsed.memory_kib,
+             &parsed.parallelism, &consumed) != 3 ||
+      text[consumed] != '\0' || !valid_hash_params(&parsed))
+    return false;
+  *params = parsed;
+  return true;
+}
+
+bool hash_params_outdated(const PasswordRecord* password,
+                          const HashParams* params) {
+  return password->params.time_cost != params->time_cost ||
+         password->params.memory_kib != params->memory_kib ||
+         password->params.parallelism != params->parallelism;
+}
+
+// Best of a few runs, since the first ones also pay for page faults
+static uint64_t time_hash(const HashParams* params) {
+  static const char password[] = "calibration password";
+  uint8_t salt[SALT_SIZE] = {0};
+  uint8_t hash[HASH_SIZE];
+  uint64_t best_ns = UINT64_MAX;
+  for (int i = 0; i < HASH_CALIBRATION_SAMPLES; i++) {
+    uint64_t start_ns = monotonic_ns();
+    argon2id_hash_raw(params->time_cost, params->memory_kib,
+                      params->parallelism, password, strlen(password), salt,
+                      SALT_SIZE, hash, HASH_SIZE);
+    uint64_t elapsed_ns = monotonic_ns() - start_ns;
+    if (elapsed_ns < best_ns)
+      best_ns = elapsed_ns;
+  }
+  return best_ns;
+}
+
+uint64_t calibrate_hash_params(HashParams* params,
+                               uint64_t target_hash_ns,
+                               uint64_t target_logins_per_second,
+                               int32_t n_workers) {
+  // Each worker hashes one login at a time
+  uint64_t budget_ns = target_hash_ns;
+  if (target_logins_per_second > 0) {
+    uint64_t throughput_ns =
+        (uint64_t)n_workers * 1'000'000'000 / target_logins_per_second;
+    if (throughput_ns < budget_ns)
+      budget_ns = throughput_ns;
+  }
+
+  HashParams best = {.time_cost = 1,
+                     .memory_kib = HASH_MIN_MEMORY_KIB,
+                     .parallelism = DEFAULT_PARALLELISM};
+  uint64_t best_ns = time_hash(&best);
+
+  // Memory first, since that is what makes argon2 expensive to attack
+  HashParams candidate = best;
+  while (candidate.memory_kib * 2 <= HASH_MAX_MEMORY_KIB) {
+    candidate.memory_kib *= 2;
+    uint64_t elapsed_ns = time_hash(&candidate);
+    if (elapsed_ns > budget_ns)
+      break;
+    best = candidate;
+    best_ns = elapsed_ns;
+  }
+
+  candidate = best;
+  while (candidate.time_cost < HASH_MAX_TIME_COST) {
+    candidate.time_cost++;
+    uint64_t elapsed_ns = time_hash(&candidate);
+    if (elapsed_ns > budget_ns)
+      break;
+    best = candidate;
+    best_ns = elapsed_ns;
+  }
+
+  *params = best;
+  return best_ns;
+}
@@ -0,0 +1,51 @@
+#ifndef SERVER_HASH_PARAMS_H
+#define SERVER_HASH_PARAMS_H
+#include <helper.h>
+
+#define DEFAULT_TIME_COST 2
+#define DEFAULT_MEMORY_KIB 512
+#define DEFAULT_PARALLELISM 1
+
+// Calibration searches between these bounds
+#define HASH_MIN_MEMORY_KIB 64
+#define HASH_MAX_MEMORY_KIB (64 * 1024)
+#define HASH_MAX_TIME_COST 10
+#define HASH_CALIBRATION_SAMPLES 3
+
+// argon2id cost parameters used for new hashes
+typedef struct {
+  uint32_t time_cost;
+  uint32_t memory_kib;
+  uint32_t parallelism;
+} HashParams;
+
+// Set from the command line before the workers start, read-only afterwards
+extern HashParams hash_params;
+
+#define SALT_SIZE 16
+#define HASH_SIZE 32
+
+// A stored password: the raw argon2id digest with the salt and parameters
+// that made it, 60 bytes in place of a ~100 byte encoded string
+typedef struct {
+  HashParams params;
+  uint8_t salt[SALT_SIZE];
+  uint8_t digest[HASH_SIZE];
+} PasswordRecord;
+
+// Parses "<t>,<m KiB>,<p>"; returns false on malformed or invalid values
+bool parse_hash_params(const char* text, HashParams* params);
+
+// True when a password was hashed with parameters other than params, so
+// it should be replaced after the next successful login
+bool hash_params_outdated(const PasswordRecord* password,
+                          const HashParams* params);
+
+// Picks the most memory, then the most passes, whose hash still fits in
+// target_hash_ns and lets n_workers sustain target_logins_per_second
+// (0 for no throughput target). Returns the measured time of one hash.
+uint64_t calibrate_hash_params(HashParams* params,
+                               uint64_t target_hash_ns,
+                               uint64_t target_logins_per_second,
+                               int32_t n_workers);
+#endif
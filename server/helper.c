@@ -1,6 +1,8 @@
 #include "helper.h"
 #include <argon2.h>
+#include <arpa/inet.h>
 #include <fcntl.h>
+#include <netinet/in.h>
 #include <sched.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -8,115 +10,521 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/random.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 // Password-related functions
 void generate_salt(uint8_t* salt) {
-  getrandom(salt, SALT_SIZE, 0);
+  if (getrandom(salt, SALT_SIZE, 0) != SALT_SIZE) {
+    perror("getrandom");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void hash_password(const char* password, PasswordRecord* record) {
+  hash_password_with(&hash_params, password, record);
 }
 
-void hash_password(const char* password, char* hashed_password) {
-  uint8_t salt[SALT_SIZE];
-  generate_salt(salt);
-  char hash[HASHED_PASSWORD_SIZE];
-  argon2id_hash_encoded(2, MEMORY_USAGE, 1, password, strlen(password), salt,
-                        SALT_SIZE, HASH_SIZE, hash, HASHED_PASSWORD_SIZE);
-  strncpy(hashed_password, hash, HASHED_PASSWORD_SIZE);
+void hash_password_with(const HashParams* params,
+                        const char* password,
+                        PasswordRecord* record) {
+  record->params = *params;
+  generate_salt(record->salt);
+  TRACE_EVENT(TRACE_ARGON2_BEGIN, argon2_begin, 0, 0);
+  int32_t result = argon2id_hash_raw(
+      params->time_cost, params->memory_kib, params->parallelism, password,
+      strlen(password), record->salt, SALT_SIZE, record->digest, HASH_SIZE);
+  TRACE_EVENT(TRACE_ARGON2_END, argon2_end, 0, result);
 }
 
 bool validate_password(const char* password_to_validate,
-                       const char* hashed_password) {
-  return argon2id_verify(hashed_password, password_to_validate,
-                         strlen(password_to_validate)) == ARGON2_OK;
+                       const PasswordRecord* record) {
+  uint8_t digest[HASH_SIZE];
+  TRACE_EVENT(TRACE_ARGON2_BEGIN, argon2_begin, 1, 0);
+  int32_t result = argon2id_hash_raw(
+      record->params.time_cost, record->params.memory_kib,
+      record->params.parallelism, password_to_validate,
+      strlen(password_to_validate), record->salt, SALT_SIZE, digest,
+      HASH_SIZE);
+  TRACE_EVENT(TRACE_ARGON2_END, argon2_end, 1, result);
+  return result == ARGON2_OK &&
+         constant_time_equal(digest, record->digest, HASH_SIZE);
 }
 
-// User-related functions
-User default_user() {
-  return (User){
-      .username = nullptr, .hashed_password = nullptr, .logged_in = false};
+// Every byte is compared, so the time taken does not tell how many match
+bool constant_time_equal(const void* a, const void* b, size_t size) {
+  const uint8_t* x = a;
+  const uint8_t* y = b;
+  uint8_t difference = 0;
+  for (size_t i = 0; i < size; i++)
+    difference |= x[i] ^ y[i];
+  return difference == 0;
 }
 
-void setup_users(Users* users) {
-  users->size = 0;
-  users->capacity = NUM_USERS;
-  users->array = malloc(sizeof(User) * users->capacity);
-  for (int i = 0; i < NUM_USERS; i++) {
-    users->array[i] = default_user();
+// Seat-related functions
+
+// Page aligned, so seat shards can be placed on different nodes
+Seat* allocate_seats() {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t size = (sizeof(Seat) * NUM_SEATS + page_size - 1) / page_size *
+                page_size;
+  Seat* seats = aligned_alloc(page_size, size);
+  if (seats == nullptr) {
+    perror("aligned_alloc");
+    exit(EXIT_FAILURE);
   }
-}
-ssize_t find_user(const Users* users, const char* username) {
-  for (size_t i = 0; i < users->size; i++)
-    if (strcmp(users->array[i].username, username) == 0)
-      return i;
-  return -1;
+  return seats;
 }
 
-size_t add_user(Users* users,
-                const char* username,
-                const char* hashed_password) {
-  if (users->size >= users->capacity) {
-    users->capacity *= 2;
-    users->array = realloc(users->array, sizeof(User) * users->capacity);
+void init_seats(Seat* seats, size_t begin, size_t end) {
+  for (size_t i = begin; i < end; i++) {
+    seats[i] = (Seat){.id = i + 1,
+                      .amount_of_times_booked = 0,
+                      .amount_of_times_canceled = 0,
+                      .user_who_booked = nullptr};
+    pthread_mutex_init(&seats[i].mutex, nullptr);
   }
-  size_t uid = users->size;
+}
 
-  users->array[uid].username = strdup(username);
-  users->array[uid].hashed_password = strdup(hashed_password);
-  users->size++;
-  return uid;
+Seat* default_seats() {
+  Seat* seats = allocate_seats();
+  init_seats(seats, 0, NUM_SEATS);
+  return seats;
 }
 
-void free_users(Users* users) {
-  for (size_t i = 0; i < users->size; i++) {
-    free((char*)users->array[i].username);
-    free((char*)users->array[i].hashed_password);
+LockStats seat_lock_stats[NUM_SEATS];
+SeatRange owned_seats = {1, NUM_SEATS};
+
+// Only contended acquisitions are timed and traced, so the common path
+// stays a single trylock
+void lock_seat(Seat* seat) {
+  if (pthread_mutex_trylock(&seat->mutex) == 0) {
+    if (lock_profiling)
+      lock_stats_record(&seat_lock_stats[seat->id - 1], false, 0);
+    return;
   }
-  free(users->array);
+  uint64_t start = stats_now();
+  pthread_mutex_lock(&seat->mutex);
+  uint64_t acquired = stats_now();
+  TRACE_EVENT_AT(TRACE_SEAT_LOCK, seat_lock, acquired, seat->id,
+                 acquired - start);
+  if (lock_profiling)
+    lock_stats_record(&seat_lock_stats[seat->id - 1], true, acquired - start);
 }
 
-// Seat-related functions
-
-Seat* default_seats() {
-  Seat* seats = malloc(sizeof(Seat) * NUM_SEATS);
+// Poll set-related functions
+size_t max_clients_per_thread;
 
-  for (int i = 0; i < NUM_SEATS; i++) {
-    seats[i].id = i + 1;
-    seats[i].amount_of_times_booked = 0;
-    seats[i].amount_of_times_canceled = 0;
-    seats[i].user_who_booked = nullptr;
-    pthread_mutex_init(&seats[i].mutex, nullptr);
+// Raises the soft fd limit as far as allowed and splits what it leaves
+// for clients between the workers
+size_t default_max_clients(int32_t n_cores) {
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) < 0) {
+    perror("getrlimit");
+    exit(EXIT_FAILURE);
   }
-
-  return seats;
+  if (limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) < 0)
+      getrlimit(RLIMIT_NOFILE, &limit);
+  }
+  if (limit.rlim_cur <= RESERVED_FDS + (rlim_t)n_cores)
+    return 1;
+  return (limit.rlim_cur - RESERVED_FDS) / n_cores;
 }
 
-// Poll set-related functions
-PollSet* create_poll_set(int32_t self_pipe_fd) {
+PollSet* create_poll_set(int32_t wake_fd) {
   PollSet* poll_set = calloc(1, sizeof(PollSet));
-  pthread_mutex_init(&poll_set->mutex, nullptr);
-  poll_set->set[0].fd = self_pipe_fd;
-  poll_set->set[0].events = POLLIN;
+  if (poll_set == nullptr) {
+    perror("calloc failed");
+    exit(EXIT_FAILURE);
+  }
+  poll_set->capacity = POLL_SET_INITIAL_CAPACITY;
+  poll_set->fds = malloc(sizeof(int32_t) * poll_set->capacity);
+  poll_set->connections = malloc(sizeof(Connection*) * poll_set->capacity);
+  poll_set->closing = malloc(sizeof(size_t) * poll_set->capacity);
+  poll_set->fds[0] = wake_fd;
+  poll_set->connections[0] = nullptr;
   poll_set->size = 1;
 
+  poll_set->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  struct epoll_event event = {.events = EPOLLIN, .data.ptr = nullptr};
+  if (poll_set->epoll_fd < 0 ||
+      (wake_fd >= 0 &&
+       epoll_ctl(poll_set->epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) < 0)) {
+    perror("epoll");
+    exit(EXIT_FAILURE);
+  }
+
   return poll_set;
 }
 
+void free_poll_set(PollSet* poll_set) {
+  close(poll_set->epoll_fd);
+  free(poll_set->fds);
+  free(poll_set->connections);
+  free(poll_set->closing);
+  free(poll_set);
+}
+
+// Makes room for one more connection; called by the owner, which is the
+// only one to look at the arrays
+static void reserve_poll_set(PollSet* poll_set) {
+  if (poll_set->size < poll_set->capacity)
+    return;
+  poll_set->capacity *= 2;
+  poll_set->fds = realloc(poll_set->fds, sizeof(int32_t) * poll_set->capacity);
+  poll_set->connections = realloc(poll_set->connections,
+                                  sizeof(Connection*) * poll_set->capacity);
+  poll_set->closing =
+      realloc(poll_set->closing, sizeof(size_t) * poll_set->capacity);
+  if (poll_set->fds == nullptr || poll_set->connections == nullptr ||
+      poll_set->closing == nullptr) {
+    perror("realloc");
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Counts connections still waiting in a worker's inbox too, otherwise a
+// burst of accepts would all go to whichever worker looked emptiest
+static size_t worker_connections(const ThreadData* data) {
+  return __atomic_load_n(&data->poll_set->size, __ATOMIC_RELAXED) +
+         __atomic_load_n(&data->handoff.size, __ATOMIC_RELAXED);
+}
+
 ssize_t find_suitable_pollset(ThreadData* data_arr, int32_t n_cores) {
   ssize_t min_i = -1;
+  size_t min_size = 0;
   for (int i = 0; i < n_cores; i++) {
-    size_t poll_set_size = data_arr[i].poll_set->size;
+    size_t poll_set_size = worker_connections(&data_arr[i]);
 
-    if (poll_set_size < CLIENTS_PER_THREAD) {
-      if (min_i == -1 || poll_set_size < data_arr[min_i].poll_set->size) {
+    if (poll_set_size - 1 < max_clients_per_thread) {
+      if (min_i == -1 || poll_set_size < min_size) {
         min_i = i;
+        min_size = poll_set_size;
       }
     }
   }
   return min_i;
 }
 
-void notify_pollset(int32_t notification_fd) {
-  write(notification_fd, "", 1);
+// True when no worker has a client, so there is no load to balance
+bool workers_idle(const ThreadData* data_arr, int32_t n_cores) {
+  for (int i = 0; i < n_cores; i++) {
+    if (worker_connections(&data_arr[i]) > 1)
+      return false;
+  }
+  return true;
+}
+
+// Puts a connection on the idle wheel, due when its idle timeout runs out
+void watch_connection(PollSet* poll_set, Connection* connection) {
+  if (poll_set->idle.timeout > 0)
+    idle_wheel_insert(&poll_set->idle, &connection->idle,
+                      connection->last_active + poll_set->idle.timeout);
+}
+
+void notify_pollset(int32_t wake_fd) {
+  uint64_t one = 1;
+  if (write(wake_fd, &one, sizeof(one)) < 0)
+    perror("write notification");
+}
+
+void init_handoff(Handoff* handoff) {
+  pthread_mutex_init(&handoff->mutex, nullptr);
+  handoff->lock_stats = (LockStats){0};
+  handoff->capacity = HANDOFF_INITIAL_CAPACITY;
+  handoff->fds = malloc(sizeof(int32_t) * handoff->capacity);
+  handoff->connections = malloc(sizeof(Connection*) * handoff->capacity);
+  handoff->size = 0;
+  handoff->migrated = 0;
+}
+
+// Timed like lock_seat; the accept thread and migrating workers take it
+// against its owner
+static void lock_handoff(Handoff* handoff, size_t worker) {
+  if (pthread_mutex_trylock(&handoff->mutex) == 0) {
+    if (lock_profiling)
+      lock_stats_record(&handoff->lock_stats, false, 0);
+    return;
+  }
+  uint64_t start = stats_now();
+  pthread_mutex_lock(&handoff->mutex);
+  uint64_t acquired = stats_now();
+  TRACE_EVENT_AT(TRACE_HANDOFF_LOCK, handoff_lock, acquired, worker,
+                 acquired - start);
+  if (lock_profiling)
+    lock_stats_record(&handoff->lock_stats, true, acquired - start);
+}
+
+// Queues a connection for the target worker and wakes it
+void hand_off_connection(ThreadData* target,
+                         int32_t fd,
+                         Connection* connection,
+                         bool migrated) {
+  Handoff* handoff = &target->handoff;
+  lock_handoff(handoff, target->thread_index);
+  if (handoff->size == handoff->capacity) {
+    handoff->capacity *= 2;
+    handoff->fds = realloc(handoff->fds, sizeof(int32_t) * handoff->capacity);
+    handoff->connections = realloc(handoff->connections,
+                                   sizeof(Connection*) * handoff->capacity);
+    if (handoff->fds == nullptr || handoff->connections == nullptr) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+  handoff->fds[handoff->size] = fd;
+  handoff->connections[handoff->size] = connection;
+  __atomic_store_n(&handoff->size, handoff->size + 1, __ATOMIC_RELAXED);
+  handoff->migrated += migrated;
+  pthread_mutex_unlock(&handoff->mutex);
+  notify_pollset(target->wake_fd);
+}
+
+// Load balancing-related functions
+
+// Called by the owner once per interval
+void roll_load_interval(PollSet* poll_set) {
+  for (size_t i = 1; i < poll_set->size; i++) {
+    poll_set->connections[i]->last_busy_ticks =
+        poll_set->connections[i]->busy_ticks;
+    poll_set->connections[i]->busy_ticks = 0;
+  }
+}
+
+// Called by the owner between rounds, so the connection has no request in
+// flight and its unread bytes move with it
+bool migrate_connection(ThreadData* data) {
+  int32_t to = __atomic_load_n(&data->load.migrate_to, __ATOMIC_ACQUIRE);
+  if (to < 0)
+    return false;
+  uint64_t budget = data->load.migrate_budget_ticks;
+  __atomic_store_n(&data->load.migrate_to, -1, __ATOMIC_RELEASE);
+
+  // The heaviest connection that still narrows the gap; a worker with a
+  // single client keeps it, moving it would only move the hot spot
+  PollSet* poll_set = data->poll_set;
+  size_t chosen = 0;
+  for (size_t i = 1; poll_set->size > 2 && i < poll_set->size; i++) {
+    uint64_t busy = poll_set->connections[i]->last_busy_ticks;
+    if (busy > 0 && busy < budget &&
+        (chosen == 0 ||
+         busy > poll_set->connections[chosen]->last_busy_ticks))
+      chosen = i;
+  }
+  if (chosen == 0)
+    return false;
+
+  // Taken off first: once handed off, the target may touch it any time
+  Connection* connection = poll_set->connections[chosen];
+  int32_t fd = poll_set->fds[chosen];
+  idle_wheel_remove(&poll_set->idle, &connection->idle);
+  waitlist_detach(data->waitlist, &connection->session.waiter);
+  epoll_ctl(poll_set->epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+
+  // The last one takes its slot, like remove_from_pollset does
+  size_t last = poll_set->size - 1;
+  poll_set->fds[chosen] = poll_set->fds[last];
+  poll_set->connections[chosen] = poll_set->connections[last];
+  poll_set->connections[chosen]->index = chosen;
+  __atomic_store_n(&poll_set->size, poll_set->size - 1, __ATOMIC_RELAXED);
+  connection->moved_from = data->thread_index;
+  hand_off_connection(&data->workers[to], fd, connection, true);
+  __atomic_store_n(&data->load.migrated_out, data->load.migrated_out + 1,
+                   __ATOMIC_RELAXED);
+  return true;
+}
+
+// Called by the owner
+void take_handoffs(ThreadData* data) {
+  PollSet* poll_set = data->poll_set;
+  // Handed back once this inbox is unlocked, as the old worker may be
+  // handing one back here at the same time
+  Connection** returned = nullptr;
+  int32_t* returned_fds = nullptr;
+  size_t n_returned = 0;
+  lock_handoff(&data->handoff, data->thread_index);
+  for (size_t i = 0; i < data->handoff.size; i++) {
+    Connection* connection = data->handoff.connections[i];
+    if (poll_set->size - 1 >= max_clients_per_thread) {
+      // Filled up since the move was planned: a moved client goes back
+      // to its worker, which takes it even if full, so its session and
+      // unread requests survive. Only new clients are refused.
+      if (connection->moved_from >= 0) {
+        if (returned == nullptr) {
+          returned = malloc(sizeof(Connection*) * data->handoff.size);
+          returned_fds = malloc(sizeof(int32_t) * data->handoff.size);
+          if (returned == nullptr || returned_fds == nullptr) {
+            perror("malloc failed");
+            exit(EXIT_FAILURE);
+          }
+        }
+        returned[n_returned] = connection;
+        returned_fds[n_returned++] = data->handoff.fds[i];
+        data->handoff.migrated--;
+        continue;
+      }
+      if (connection->last_active == 0) {
+        close(data->handoff.fds[i]);
+        end_session(&connection->session, data->seats, data->waitlist);
+        free(connection);
+        continue;
+      }
+    }
+    connection->moved_from = -1;
+    reserve_poll_set(poll_set);
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = connection};
+    if (epoll_ctl(poll_set->epoll_fd, EPOLL_CTL_ADD, data->handoff.fds[i],
+                  &event) < 0) {
+      perror("epoll_ctl");
+      close(data->handoff.fds[i]);
+      end_session(&connection->session, data->seats, data->waitlist);
+      free(connection);
+      continue;
+    }
+    poll_set->fds[poll_set->size] = data->handoff.fds[i];
+    poll_set->connections[poll_set->size] = connection;
+    connection->index = poll_set->size;
+    __atomic_store_n(&poll_set->size, poll_set->size + 1, __ATOMIC_RELAXED);
+    // New clients count as active from now, moved ones keep their clock
+    if (connection->last_active == 0)
+      connection->last_active = stats_now();
+    watch_connection(poll_set, connection);
+    waitlist_adopt(data->waitlist, &connection->session.waiter,
+                   data->thread_index);
+  }
+  __atomic_store_n(&data->load.migrated_in,
+                   data->load.migrated_in + data->handoff.migrated,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&data->handoff.size, 0, __ATOMIC_RELAXED);
+  data->handoff.migrated = 0;
+  pthread_mutex_unlock(&data->handoff.mutex);
+
+  for (size_t i = 0; i < n_returned; i++) {
+    ThreadData* back = &data->workers[returned[i]->moved_from];
+    returned[i]->moved_from = -1;
+    hand_off_connection(back, returned_fds[i], returned[i], false);
+  }
+  free(returned);
+  free(returned_fds);
+}
+
+void balance_workers(ThreadData* data_arr,
+                     int32_t n_cores,
+                     LoadSample* samples,
+                     uint64_t elapsed_ticks) {
+  double ns_per_tick = data_arr[0].stats->ns_per_tick;
+  uint64_t* busy_ticks = malloc(sizeof(uint64_t) * n_cores);
+  bool* has_room = malloc(sizeof(bool) * n_cores);
+  if (busy_ticks == nullptr || has_room == nullptr) {
+    perror("malloc failed");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < n_cores; i++) {
+    has_room[i] =
+        worker_connections(&data_arr[i]) - 1 < max_clients_per_thread;
+    const WorkerLoad* load = &data_arr[i].load;
+    uint64_t busy = __atomic_load_n(&load->busy_ticks, __ATOMIC_RELAXED);
+    uint64_t requests = __atomic_load_n(&load->requests, __ATOMIC_RELAXED);
+    busy_ticks[i] = busy - samples[i].busy_ticks;
+    samples[i].busy_percent = 100.0 * busy_ticks[i] / elapsed_ticks;
+    samples[i].requests_per_second =
+        (requests - samples[i].requests) / (elapsed_ticks * ns_per_tick / 1e9);
+    samples[i].busy_ticks = busy;
+    samples[i].requests = requests;
+  }
+
+  size_t from;
+  size_t to;
+  uint64_t budget;
+  if (load_balancing &&
+      plan_migration(busy_ticks, has_room, n_cores, elapsed_ticks, &from,
+                     &to, &budget) &&
+      __atomic_load_n(&data_arr[from].load.migrate_to, __ATOMIC_ACQUIRE) <
+          0) {
+    data_arr[from].load.migrate_budget_ticks = budget;
+    __atomic_store_n(&data_arr[from].load.migrate_to, (int32_t)to,
+                     __ATOMIC_RELEASE);
+  }
+  free(busy_ticks);
+  free(has_room);
+}
+
+void report_load(FILE* out,
+                 const ThreadData* data_arr,
+                 int32_t n_cores,
+                 const LoadSample* samples) {
+  fprintf(out, "%-10s %11s %10s %7s %9s %9s %7s\n", "worker", "connections",
+          "req/s", "busy %", "moved in", "moved out", "reaped");
+  for (int i = 0; i < n_cores; i++) {
+    const WorkerLoad* load = &data_arr[i].load;
+    fprintf(out, "%-10d %11zu %10.0f %7.1f %9lu %9lu %7lu\n", i,
+            __atomic_load_n(&data_arr[i].poll_set->size, __ATOMIC_RELAXED) - 1,
+            samples[i].requests_per_second,
+            samples[i].busy_percent,
+            __atomic_load_n(&load->migrated_in, __ATOMIC_RELAXED),
+            __atomic_load_n(&load->migrated_out, __ATOMIC_RELAXED),
+            __atomic_load_n(&load->reaped, __ATOMIC_RELAXED));
+  }
+  fflush(out);
+}
+
+// Listener-related functions
+int32_t create_tcp_listener(uint16_t port) {
+  int32_t listenfd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listenfd < 0) {
+    perror("socket");
+    return -1;
+  }
+
+  int32_t reuse = 1;
+  setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  struct sockaddr_in saddr;
+  memset(&saddr, 0, sizeof(saddr));
+  saddr.sin_family = AF_INET;
+  saddr.sin_addr.s_addr = htonl(INADDR_ANY);
+  saddr.sin_port = htons(port);
+
+  if (bind(listenfd, (struct sockaddr*)&saddr, sizeof(saddr)) < 0 ||
+      listen(listenfd, LISTEN_BACKLOG) < 0) {
+    perror("bind/listen (tcp)");
+    close(listenfd);
+    return -1;
+  }
+  return listenfd;
+}
+
+int32_t create_unix_listener(const char* socket_path) {
+  struct sockaddr_un saddr;
+  memset(&saddr, 0, sizeof(saddr));
+  saddr.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(saddr.sun_path)) {
+    fprintf(stderr, "Socket path is too long: %s\n", socket_path);
+    return -1;
+  }
+  strcpy(saddr.sun_path, socket_path);
+
+  int32_t listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenfd < 0) {
+    perror("socket");
+    return -1;
+  }
+
+  if (!remove_stale_socket(socket_path)) {
+    close(listenfd);
+    return -1;
+  }
+  if (bind(listenfd, (struct sockaddr*)&saddr, sizeof(saddr)) < 0 ||
+      listen(listenfd, LISTEN_BACKLOG) < 0) {
+    perror("bind/listen (unix)");
+    close(listenfd);
+    return -1;
+  }
+  return listenfd;
 }
 
 // Others
@@ -126,21 +534,87 @@ int32_t get_num_cores() {
   return CPU_COUNT_S(sizeof(cpu_set), &cpu_set);
 }
 
-int32_t terminate_after_cleanup(int32_t (*pipe_fds)[2],
-                                pthread_t* tid_arr,
+void report_lock_stats(FILE* out,
+                       const ThreadData* data_arr,
+                       int32_t n_cores,
+                       size_t top_n) {
+  if (!lock_profiling) {
+    fprintf(out, "Lock profiling is off, start the server with -L\n");
+    return;
+  }
+  double ns_per_tick = data_arr[0].stats->ns_per_tick;
+
+  NamedLockStats seat_locks[NUM_SEATS];
+  for (int i = 0; i < NUM_SEATS; i++) {
+    snprintf(seat_locks[i].name, sizeof(seat_locks[i].name), "seat %d", i + 1);
+    seat_locks[i].stats = &seat_lock_stats[i];
+  }
+  fprintf(out, "Hottest seat locks:\n");
+  lock_stats_report(out, seat_locks, NUM_SEATS, top_n, ns_per_tick);
+
+  NamedLockStats* worker_locks = malloc(sizeof(NamedLockStats) * n_cores);
+  if (worker_locks == nullptr) {
+    perror("malloc failed");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < n_cores; i++) {
+    snprintf(worker_locks[i].name, sizeof(worker_locks[i].name),
+             "worker %d", i);
+    worker_locks[i].stats = &data_arr[i].handoff.lock_stats;
+  }
+  fprintf(out, "Hottest worker locks:\n");
+  lock_stats_report(out, worker_locks, n_cores, top_n, ns_per_tick);
+  free(worker_locks);
+}
+
+int32_t terminate_after_cleanup(pthread_t* tid_arr,
                                 ThreadData* data_arr,
                                 int32_t n_cores,
-                                int listenfd,
+                                const int32_t* listen_fds,
+                                int32_t n_listeners,
                                 Users* users,
                                 Seat* seats) {
+  // Workers block in poll until woken, so wake them all before joining
+  for (int i = 0; i < n_cores; i++)
+    notify_pollset(data_arr[i].wake_fd);
   for (int i = 0; i < n_cores; i++) {
-    write(pipe_fds[i][1], "", 1);
-    close(pipe_fds[i][1]);
     pthread_join(tid_arr[i], nullptr);
-    close(pipe_fds[i][0]);
-    pthread_mutex_destroy(&data_arr[i].poll_set->mutex);
-    free(data_arr[i].poll_set);
+    PollSet* poll_set = data_arr[i].poll_set;
+    for (size_t j = 1; j < poll_set->size; j++) {
+      close(poll_set->fds[j]);
+      end_session(&poll_set->connections[j]->session, seats,
+                  data_arr[i].waitlist);
+      free(poll_set->connections[j]);
+    }
+    free_poll_set(poll_set);
+
+    // Handed off by a worker that finished before this one looked
+    Handoff* handoff = &data_arr[i].handoff;
+    for (size_t j = 0; j < handoff->size; j++) {
+      close(handoff->fds[j]);
+      end_session(&handoff->connections[j]->session, seats,
+                  data_arr[i].waitlist);
+      free(handoff->connections[j]);
+    }
+  }
+  // Ending a session may still hand a seat to a waiter and wake its
+  // worker, so the wake fds stay open until every session has ended
+  for (int i = 0; i < n_cores; i++) {
+    close(data_arr[i].wake_fd);
+    pthread_mutex_destroy(&data_arr[i].handoff.mutex);
+    free(data_arr[i].handoff.fds);
+    free(data_arr[i].handoff.connections);
+  }
+
+  // Workers are joined, so every captured record is already in a ring
+  if (n_cores > 0) {
+    capture_stop(data_arr[0].capture);
+    stats_free(data_arr[0].stats);
+    rate_table_free(data_arr[0].rate_table);
+    waitlist_free(data_arr[0].waitlist);
   }
+  listing_cache_free(&listing_cache);
+  flight_recorder_free_all();
 
   for (int i = 0; i < NUM_SEATS; i++) {
     pthread_mutex_destroy(&seats[i].mutex);
@@ -149,30 +623,78 @@ int32_t terminate_after_cleanup(int32_t (*pipe_fds)[2],
     }
   }
 
-  close(listenfd);
+  for (int i = 0; i < n_listeners; i++) {
+    close(listen_fds[i]);
+  }
   free(tid_arr);
-  free(pipe_fds);
   free(data_arr);
+  free(seats);
   free_users(users);
   puts("Server terminated!");
   return 0;
 }
 
-bool check_stdin_for_termination() {
-  bool should_exit = false;
-
-  char buffer[MAXLINE];
-  ssize_t n_read = read(STDIN_FILENO, buffer, sizeof(buffer));
-  if (n_read < 0) {
+void read_console(Console* console) {
+  ssize_t n_read = read(STDIN_FILENO, console->buffer + console->length,
+                        sizeof(console->buffer) - console->length - 1);
+  if (n_read < 0)
     perror("read");
-    should_exit = true;
-  } else {
-    buffer[n_read - 1] = '\0';
+  if (n_read <= 0) {
+    console->closed = true;
+    return;
+  }
+  console->length += n_read;
 
-    if (strncmp(buffer, "exit", 4) == 0 || strncmp(buffer, "quit", 4) == 0 ||
-        strncmp(buffer, "\0", 1) == 0) {
-      should_exit = true;
-    }
+  // A line that does not fit is cut here and read as a command
+  if (console->length == sizeof(console->buffer) - 1 &&
+      memchr(console->buffer, '\n', console->length) == nullptr)
+    console->buffer[console->length - 1] = '\n';
+}
+
+// Pops the next complete line; *argument points past the command word and
+// stays valid until the next call
+bool next_console_command(Console* console,
+                          ConsoleCommand* command,
+                          const char** argument) {
+  static char line[MAXLINE];
+  char* newline = memchr(console->buffer, '\n', console->length);
+  if (newline == nullptr) {
+    // End of input stops the server once every full line has been handled
+    if (!console->closed)
+      return false;
+    console->closed = false;
+    *command = CONSOLE_COMMAND_EXIT;
+    *argument = "";
+    return true;
+  }
+
+  size_t line_length = newline - console->buffer;
+  memcpy(line, console->buffer, line_length);
+  line[line_length] = '\0';
+  console->length -= line_length + 1;
+  memmove(console->buffer, newline + 1, console->length);
+
+  char* space = strchr(line, ' ');
+  *argument = (space != nullptr) ? space + 1 : "";
+
+  // An empty line stops the server, as it always has
+  if (strncmp(line, "exit", 4) == 0 || strncmp(line, "quit", 4) == 0 ||
+      line[0] == '\0') {
+    *command = CONSOLE_COMMAND_EXIT;
+  } else if (strncmp(line, "stats", 5) == 0) {
+    *command = CONSOLE_COMMAND_STATS;
+  } else if (strncmp(line, "trace", 5) == 0) {
+    *command = CONSOLE_COMMAND_TRACE;
+  } else if (strncmp(line, "locks", 5) == 0) {
+    *command = CONSOLE_COMMAND_LOCKS;
+  } else if (strncmp(line, "load", 4) == 0) {
+    *command = CONSOLE_COMMAND_LOAD;
+  } else {
+    fprintf(stderr,
+            "Unknown command: %s (try exit, stats, trace, locks [N] or "
+            "load)\n",
+            line);
+    *command = CONSOLE_COMMAND_NONE;
   }
-  return should_exit;
+  return true;
 }
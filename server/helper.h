@@ -2,86 +2,207 @@
 #define SERVER_HELPER_H
 #include <helper.h>
 #include <poll.h>
+#include <sys/epoll.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <sys/types.h>
-
-// change to 10000 if you're facing an error here
-#define NUM_USERS 10'000
+#include "balance.h"
+#include "capture.h"
+#include "flight_recorder.h"
+#include "hash_params.h"
+#include "idle.h"
+#include "listing_cache.h"
+#include "lock_stats.h"
+#include "placement.h"
+#include "rate_limit.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "users.h"
+#include "waitlist.h"
 
 #define MAXLINE 120
-#define CLIENTS_PER_THREAD 1000
-#define NUM_SEATS 100
+#define POLL_SET_INITIAL_CAPACITY 64
+#define POLL_BATCH 256  // ready connections taken per epoll_wait
+// fds kept back from the client budget for listeners, eventfds and files
+#define RESERVED_FDS 64
+#define LISTEN_BACKLOG 128
 
-#define MEMORY_USAGE 512
-#define SALT_SIZE 16
-#define HASH_SIZE 32
-#define HASHED_PASSWORD_SIZE 128
+// A batch booked on this shard that pa3_router has yet to commit or abort
+typedef struct PreparedBooking {
+  uint64_t transaction;  // chosen by the router
+  char* username;
+  pa3_seat_t* seats;
+  size_t n_seats;
+  struct PreparedBooking* next;
+} PreparedBooking;
 
-typedef ssize_t pa3_uid_t;
+// What handlers keep on a connection between its requests
+typedef struct {
+  uint64_t connection_id;     // logins through it are bound to
+  Waiter waiter;              // its waitlist tickets
+  PreparedBooking* prepared;  // aborted if the connection goes first
+} Session;
 
+// Per-connection state, kept at the same index as its pollfd
 typedef struct {
-  const char* username;
-  const char* hashed_password;
-  bool logged_in;
-} User;
+  uint64_t id;
+  uint64_t peer_key;         // rate_peer_key() of the client's address
+  uint64_t busy_ticks;       // spent on its requests this interval
+  uint64_t last_busy_ticks;  // ... and in the previous one
+  uint64_t last_active;      // stats_now() of its last request
+  size_t index;              // in its PollSet
+  ssize_t user;              // logged in through it, -1 when none
+  int32_t moved_from;        // worker it is migrating from, -1 when none
+  IdleLink idle;
+  Session session;
+} Connection;
 
+// Connections accepted by the main thread or moved here by another
+// worker, taken when this one wakes up. Its mutex is the one worker lock
+// other threads contend for, so -L profiles it.
 typedef struct {
-  User* array;
+  pthread_mutex_t mutex;
+  LockStats lock_stats;
+  int32_t* fds;
+  Connection** connections;
   size_t size;
   size_t capacity;
-} Users;
+  size_t migrated;  // how many of them came from another worker
+} Handoff;
 
+// Slot 0 is the worker's eventfd. The arrays grow by doubling and never
+// shrink; a closed slot is filled with the last connection, so removal
+// moves one entry whatever the size. The worker waits on epoll_fd, where
+// each fd is registered with its Connection (nullptr for the eventfd),
+// so a wakeup costs the ready connections rather than all of them. Only
+// the owning worker touches it; others just read size, atomically.
 typedef struct {
-  struct pollfd set[CLIENTS_PER_THREAD];
+  int32_t epoll_fd;
+  int32_t* fds;  // negated while the connection is busy in a round
+  Connection** connections;
+  size_t* closing;  // slots to close at the end of the round
   size_t size;
-  pthread_mutex_t mutex;
+  size_t capacity;
+  IdleWheel idle;  // every client, when idle_timeout_s is set
 } PollSet;
 
-typedef struct {
+typedef struct ThreadData {
   size_t thread_index;
   PollSet* poll_set;
   Users* users;
   Seat* seats;
-  int32_t pipe_out_fd;
+  int32_t wake_fd;  // eventfd, written to wake this worker up
+  Capture* capture;
+  ServerStats* stats;
+  RateTable* rate_table;  // shared by every worker
+  Waitlist* waitlist;     // shared by every worker
+  WorkerPlacement placement;
+  pthread_barrier_t* started;  // passed once poll_set and seats are set up
+  WorkerLoad load;
+  Handoff handoff;
+  struct ThreadData* workers;  // every worker, for handing connections off
 } ThreadData;
 
 // Password-related functions
-void hash_password(const char* password, char* hashed_password);
+void hash_password(const char* password, PasswordRecord* record);
+void hash_password_with(const HashParams* params,
+                        const char* password,
+                        PasswordRecord* record);
 bool validate_password(const char* password_to_validate,
-                       const char* hashed_password);
-
-// User-related functions
-User default_user();
-void setup_users(Users* users);
-void free_users(Users* users);
-ssize_t find_user(const Users* users, const char* username);
-size_t add_user(Users* users,
-                const char* username,
-                const char* hashed_password);
+                       const PasswordRecord* record);
+bool constant_time_equal(const void* a, const void* b, size_t size);
 
 // Seat-related functions
+Seat* allocate_seats();
+void init_seats(Seat* seats, size_t begin, size_t end);
 Seat* default_seats();
+void lock_seat(Seat* seat);
+extern LockStats seat_lock_stats[NUM_SEATS];
+
+// Seats this process serves, all of them unless started with -S; set
+// before the workers start, read-only afterwards
+typedef struct {
+  pa3_seat_t first;
+  pa3_seat_t last;
+} SeatRange;
+extern SeatRange owned_seats;
 
 // Poll set-related functions
-PollSet* create_poll_set(int32_t self_pipe_fd);
+extern size_t max_clients_per_thread;
+size_t default_max_clients(int32_t n_cores);
+PollSet* create_poll_set(int32_t wake_fd);
+void free_poll_set(PollSet* poll_set);
 ssize_t find_suitable_pollset(ThreadData* data_arr, int32_t n_cores);
-void notify_pollset(int32_t notification_fd);
+bool workers_idle(const ThreadData* data_arr, int32_t n_cores);
+void watch_connection(PollSet* poll_set, Connection* connection);
+void notify_pollset(int32_t wake_fd);
+void init_handoff(Handoff* handoff);
+void hand_off_connection(ThreadData* target,
+                         int32_t fd,
+                         Connection* connection,
+                         bool migrated);
+
+// Load balancing-related functions
+void roll_load_interval(PollSet* poll_set);
+bool migrate_connection(ThreadData* data);
+void take_handoffs(ThreadData* data);
+void balance_workers(ThreadData* data_arr,
+                     int32_t n_cores,
+                     LoadSample* samples,
+                     uint64_t elapsed_ticks);
+void report_load(FILE* out,
+                 const ThreadData* data_arr,
+                 int32_t n_cores,
+                 const LoadSample* samples);
+
+// Listener-related functions
+int32_t create_tcp_listener(uint16_t port);
+int32_t create_unix_listener(const char* socket_path);
 
 // Other functions
 int32_t get_num_cores();
-int32_t terminate_after_cleanup(int32_t (*pipe_fds)[2],
-                                pthread_t* tid_arr,
+void report_lock_stats(FILE* out,
+                       const ThreadData* data_arr,
+                       int32_t n_cores,
+                       size_t top_n);
+int32_t terminate_after_cleanup(pthread_t* tid_arr,
                                 ThreadData* data_arr,
                                 int32_t n_cores,
-                                int32_t listenfd,
+                                const int32_t* listen_fds,
+                                int32_t n_listeners,
                                 Users* users,
                                 Seat* seats);
 
 int32_t handle_request(const Request* request,
                        Response* response,
                        Users* users,
-                       Seat* seats);
+                       Seat* seats,
+                       const ServerStats* stats,
+                       Waitlist* waitlist,
+                       Session* session);
+// Undoes what a closing connection left pending: waitlist tickets and
+// prepared batches
+void end_session(Session* session, Seat* seats, Waitlist* waitlist);
+
+// Console-related functions
+typedef enum {
+  CONSOLE_COMMAND_NONE,
+  CONSOLE_COMMAND_EXIT,
+  CONSOLE_COMMAND_STATS,
+  CONSOLE_COMMAND_TRACE,
+  CONSOLE_COMMAND_LOCKS,
+  CONSOLE_COMMAND_LOAD,
+} ConsoleCommand;
+
+// Lines typed on stdin; one read may deliver several of them
+typedef struct {
+  char buffer[MAXLINE];
+  size_t length;
+  bool closed;
+} Console;
 
-bool check_stdin_for_termination();
+void read_console(Console* console);
+bool next_console_command(Console* console,
+                          ConsoleCommand* command,
+                          const char** argument);
 #endif
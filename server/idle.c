@@ -0,0 +1,90 @@
+#include "idle.h"
+#include <stdio.h>
+
+uint32_t idle_timeout_s = DEFAULT_IDLE_TIMEOUT_S;
+uint32_t io_timeout_ms = DEFAULT_IO_TIMEOUT_MS;
+
+bool parse_idle_timeouts(const char* text) {
+  uint32_t idle;
+  uint32_t io = io_timeout_ms;
+  int32_t consumed = 0;
+  if (sscanf(text, "%u%n", &idle, &consumed) != 1)
+    return false;
+  if (text[consumed] == ',') {
+    text += consumed + 1;
+    if (sscanf(text, "%u%n", &io, &consumed) != 1)
+      return false;
+  }
+  if (text[consumed] != '\0')
+    return false;
+  idle_timeout_s = idle;
+  io_timeout_ms = io;
+  return true;
+}
+
+void idle_wheel_init(IdleWheel* wheel, uint64_t timeout, uint64_t now) {
+  for (size_t i = 0; i < IDLE_WHEEL_SLOTS; i++)
+    wheel->slots[i] = (IdleLink){&wheel->slots[i], &wheel->slots[i]};
+  wheel->timeout = timeout;
+  wheel->slot_span = timeout / (IDLE_WHEEL_SLOTS / 2);
+  if (wheel->slot_span == 0)
+    wheel->slot_span = 1;
+  wheel->current = now / wheel->slot_span;
+  wheel->size = 0;
+}
+
+void idle_wheel_insert(IdleWheel* wheel, IdleLink* link, uint64_t deadline) {
+  // Past deadlines go in the next slot to expire, far ones in the last
+  uint64_t at = deadline / wheel->slot_span;
+  if (at < wheel->current)
+    at = wheel->current;
+  if (at >= wheel->current + IDLE_WHEEL_SLOTS)
+    at = wheel->current + IDLE_WHEEL_SLOTS - 1;
+  IdleLink* head = &wheel->slots[at % IDLE_WHEEL_SLOTS];
+  link->prev = head->prev;
+  link->next = head;
+  head->prev->next = link;
+  head->prev = link;
+  wheel->size++;
+}
+
+void idle_wheel_remove(IdleWheel* wheel, IdleLink* link) {
+  if (link->next == nullptr)
+    return;
+  link->prev->next = link->next;
+  link->next->prev = link->prev;
+  link->prev = nullptr;
+  link->next = nullptr;
+  wheel->size--;
+}
+
+IdleLink* idle_wheel_expire(IdleWheel* wheel, uint64_t now) {
+  uint64_t end = now / wheel->slot_span;
+  // After a long sleep every slot is due once, not once per turn missed
+  if (end > wheel->current + IDLE_WHEEL_SLOTS)
+    wheel->current = end - IDLE_WHEEL_SLOTS;
+
+  IdleLink* expired = nullptr;
+  for (; wheel->current < end && wheel->size > 0; wheel->current++) {
+    IdleLink* head = &wheel->slots[wheel->current % IDLE_WHEEL_SLOTS];
+    while (head->next != head) {
+      IdleLink* link = head->next;
+      idle_wheel_remove(wheel, link);
+      link->next = expired;
+      expired = link;
+    }
+  }
+  if (wheel->size == 0 && wheel->current < end)
+    wheel->current = end;
+  return expired;
+}
+
+uint64_t idle_wheel_next_expiry(const IdleWheel* wheel) {
+  if (wheel->size == 0)
+    return UINT64_MAX;
+  for (uint64_t at = wheel->current;; at++) {
+    const IdleLink* head = &wheel->slots[at % IDLE_WHEEL_SLOTS];
+    if (head->next != head)
+      return (at + 1) * wheel->slot_span;
+  }
+}
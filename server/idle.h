@@ -0,0 +1,52 @@
+#ifndef SERVER_IDLE_H
+#define SERVER_IDLE_H
+#include <helper.h>
+
+// A connection without a request for idle_timeout_s is closed and its
+// user logged out; a peer that stalls mid-frame or stops reading its
+// responses fails the read or write after io_timeout_ms instead
+#define DEFAULT_IDLE_TIMEOUT_S 300
+#define DEFAULT_IO_TIMEOUT_MS 5000
+
+// Set from the command line before the workers start, read-only
+// afterwards; 0 turns the timeout off
+extern uint32_t idle_timeout_s;
+extern uint32_t io_timeout_ms;
+
+// Parses "<idle s>[,<io ms>]"
+bool parse_idle_timeouts(const char* text);
+
+// Slots per wheel; a slot spans twice the timeout divided by this, so
+// every deadline fits in one turn
+#define IDLE_WHEEL_SLOTS 64
+
+// Embedded in whatever the wheel keeps track of
+typedef struct IdleLink {
+  struct IdleLink* prev;
+  struct IdleLink* next;  // nullptr while not on the wheel
+} IdleLink;
+
+// Hashed timer wheel owned by one worker. Deadlines are not moved on
+// activity: when a slot expires, the owner re-inserts the entries that
+// turn out to have been active since, so a request costs no wheel work.
+typedef struct {
+  IdleLink slots[IDLE_WHEEL_SLOTS];  // list heads
+  uint64_t timeout;                  // 0 when nothing is tracked
+  uint64_t slot_span;                // in the unit of the deadlines
+  uint64_t current;                  // absolute number of the next slot
+  size_t size;
+} IdleWheel;
+
+void idle_wheel_init(IdleWheel* wheel, uint64_t timeout, uint64_t now);
+void idle_wheel_insert(IdleWheel* wheel, IdleLink* link, uint64_t deadline);
+void idle_wheel_remove(IdleWheel* wheel, IdleLink* link);
+
+// Takes every entry whose slot ended by now off the wheel and returns
+// them chained through next, ending with nullptr. The caller clears next
+// on each one before it re-inserts or removes it.
+IdleLink* idle_wheel_expire(IdleWheel* wheel, uint64_t now);
+
+// When idle_wheel_expire will next have something to return; UINT64_MAX
+// while the wheel is empty
+uint64_t idle_wheel_next_expiry(const IdleWheel* wheel);
+#endif
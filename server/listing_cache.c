@@ -0,0 +1,49 @@
+#include "listing_cache.h"
+
+ListingCache listing_cache;
+
+void listing_cache_init(ListingCache* cache) {
+  // Version 0 is never cached
+  cache->version = 1;
+  pthread_mutex_init(&cache->mutex, nullptr);
+  cache->listing = nullptr;
+  cache->listing_version = 0;
+}
+
+void listing_cache_free(ListingCache* cache) {
+  if (cache->listing != nullptr)
+    shared_buffer_unref(cache->listing);
+  cache->listing = nullptr;
+  pthread_mutex_destroy(&cache->mutex);
+}
+
+SharedBuffer* listing_cache_get(ListingCache* cache, uint64_t version) {
+  // A stale cache costs no lock
+  if (__atomic_load_n(&cache->listing_version, __ATOMIC_RELAXED) != version)
+    return nullptr;
+  pthread_mutex_lock(&cache->mutex);
+  SharedBuffer* listing = nullptr;
+  if (cache->listing_version == version)
+    listing = shared_buffer_ref(cache->listing);
+  pthread_mutex_unlock(&cache->mutex);
+  return listing;
+}
+
+void listing_cache_put(ListingCache* cache,
+                       uint64_t version,
+                       SharedBuffer* listing) {
+  // Every seat was locked after version was read, so if it is still
+  // current, nothing changed while the listing was built
+  if (listing_cache_version(cache) != version)
+    return;
+  pthread_mutex_lock(&cache->mutex);
+  SharedBuffer* old = nullptr;
+  if (version > cache->listing_version) {
+    old = cache->listing;
+    cache->listing = shared_buffer_ref(listing);
+    __atomic_store_n(&cache->listing_version, version, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&cache->mutex);
+  if (old != nullptr)
+    shared_buffer_unref(old);
+}
@@ -0,0 +1,40 @@
+#ifndef SERVER_LISTING_CACHE_H
+#define SERVER_LISTING_CACHE_H
+#include <helper.h>
+#include <pthread.h>
+
+// "confirmbooking available" gets the same answer for every user until a
+// seat is booked or freed. Every such change bumps version, and the last
+// listing built is kept with the version it was built at, so listings in
+// between share it instead of scanning the seats again.
+typedef struct {
+  uint64_t version;  // bumped with the changed seat still locked
+  pthread_mutex_t mutex;  // guards listing while a reference is taken
+  SharedBuffer* listing;
+  uint64_t listing_version;
+} ListingCache;
+
+extern ListingCache listing_cache;
+
+void listing_cache_init(ListingCache* cache);
+void listing_cache_free(ListingCache* cache);
+
+// Called with the changed seat locked, so a scan that locks it later
+// sees the new version
+static inline void listing_cache_invalidate(ListingCache* cache) {
+  __atomic_fetch_add(&cache->version, 1, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t listing_cache_version(const ListingCache* cache) {
+  return __atomic_load_n(&cache->version, __ATOMIC_ACQUIRE);
+}
+
+// A reference to the listing built at version, nullptr if there is none
+SharedBuffer* listing_cache_get(ListingCache* cache, uint64_t version);
+
+// Offers a listing built by a scan that started at version; it is kept
+// only if no seat changed meanwhile
+void listing_cache_put(ListingCache* cache,
+                       uint64_t version,
+                       SharedBuffer* listing);
+#endif
@@ -0,0 +1,47 @@
+#include "lock_stats.h"
+#include <stdlib.h>
+
+bool lock_profiling = false;
+
+static uint64_t load_relaxed(const uint64_t* ptr) {
+  return __atomic_load_n(ptr, __ATOMIC_RELAXED);
+}
+
+static int32_t compare_by_wait(const void* a, const void* b) {
+  uint64_t lhs = load_relaxed(&((const NamedLockStats*)a)->stats->wait_ticks);
+  uint64_t rhs = load_relaxed(&((const NamedLockStats*)b)->stats->wait_ticks);
+  if (lhs != rhs)
+    return lhs > rhs ? -1 : 1;
+  uint64_t lhs_n =
+      load_relaxed(&((const NamedLockStats*)a)->stats->acquisitions);
+  uint64_t rhs_n =
+      load_relaxed(&((const NamedLockStats*)b)->stats->acquisitions);
+  return lhs_n > rhs_n ? -1 : (lhs_n < rhs_n);
+}
+
+void lock_stats_report(FILE* out,
+                       NamedLockStats* locks,
+                       size_t n_locks,
+                       size_t top_n,
+                       double ns_per_tick) {
+  qsort(locks, n_locks, sizeof(NamedLockStats), compare_by_wait);
+  if (top_n > n_locks)
+    top_n = n_locks;
+
+  fprintf(out, "%-12s %12s %10s %7s %12s %12s %12s\n", "lock", "acquired",
+          "contended", "%", "wait ms", "avg wait us", "max wait us");
+  for (size_t i = 0; i < top_n; i++) {
+    const LockStats* stats = locks[i].stats;
+    uint64_t acquisitions = load_relaxed(&stats->acquisitions);
+    uint64_t contended = load_relaxed(&stats->contended);
+    uint64_t wait_ticks = load_relaxed(&stats->wait_ticks);
+    if (acquisitions == 0)
+      break;
+    fprintf(out, "%-12s %12lu %10lu %7.2f %12.3f %12.1f %12.1f\n",
+            locks[i].name, acquisitions, contended,
+            100.0 * contended / acquisitions, wait_ticks * ns_per_tick / 1e6,
+            contended ? wait_ticks * ns_per_tick / contended / 1e3 : 0.0,
+            load_relaxed(&stats->max_wait_ticks) * ns_per_tick / 1e3);
+  }
+  fflush(out);
+}
@@ -0,0 +1,47 @@
+#ifndef SERVER_LOCK_STATS_H
+#define SERVER_LOCK_STATS_H
+#include <helper.h>
+#include <stdalign.h>
+#include <stdio.h>
+
+#define LOCK_STATS_DEFAULT_TOP 10
+
+// Contention counters of one mutex. They are only updated by the thread
+// that has just acquired it, so the mutex itself serialises the writers;
+// relaxed stores keep concurrent reports well defined.
+typedef struct {
+  alignas(64) uint64_t acquisitions;
+  uint64_t contended;
+  uint64_t wait_ticks;
+  uint64_t max_wait_ticks;
+} LockStats;
+
+// Set by the -L option, read-only afterwards
+extern bool lock_profiling;
+
+static inline void lock_stats_record(LockStats* stats,
+                                     bool contended,
+                                     uint64_t wait_ticks) {
+  __atomic_store_n(&stats->acquisitions, stats->acquisitions + 1,
+                   __ATOMIC_RELAXED);
+  if (!contended)
+    return;
+  __atomic_store_n(&stats->contended, stats->contended + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&stats->wait_ticks, stats->wait_ticks + wait_ticks,
+                   __ATOMIC_RELAXED);
+  if (wait_ticks > stats->max_wait_ticks)
+    __atomic_store_n(&stats->max_wait_ticks, wait_ticks, __ATOMIC_RELAXED);
+}
+
+typedef struct {
+  char name[24];
+  const LockStats* stats;
+} NamedLockStats;
+
+// Prints the top_n locks with the most total wait time
+void lock_stats_report(FILE* out,
+                       NamedLockStats* locks,
+                       size_t n_locks,
+                       size_t top_n,
+                       double ns_per_tick);
+#endif
@@ -2,230 +2,643 @@
 #include <errno.h>
 #include <helper.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <pa3_error.h>
 #include <poll.h>
 #include <pthread.h>
+#include <shard.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include "helper.h"
 
-bool sigint_received = false;
+atomic_bool sigint_received = false;
+volatile sig_atomic_t trace_dump_requested = false;
 
-void add_to_pollset(PollSet* poll_set,
-                    int32_t notification_fd,
-                    int32_t connfd) {
-  pthread_mutex_lock(&poll_set->mutex);
-  
-  if (poll_set->size >= CLIENTS_PER_THREAD) {
-    pthread_mutex_unlock(&poll_set->mutex);
-    return;
-  }
+void sigusr1_handler(int32_t signum) {
+  if (signum == SIGUSR1)
+    trace_dump_requested = true;
+}
 
-  poll_set->set[poll_set->size].fd = connfd;
-  poll_set->set[poll_set->size].events = POLLIN;
-  poll_set->size++;
-  
-  pthread_mutex_unlock(&poll_set->mutex);
-  notify_pollset(notification_fd);
+// Passes a new connection to a worker's inbox; the PollSet itself is only
+// touched by its owner, which may be blocked in epoll_wait
+void add_to_pollset(ThreadData* data,
+                    int32_t connfd,
+                    uint64_t connection_id,
+                    uint64_t peer_key) {
+  Connection* connection = calloc(1, sizeof(Connection));
+  connection->id = connection_id;
+  connection->peer_key = peer_key;
+  connection->user = -1;
+  connection->moved_from = -1;
+  connection->session.connection_id = connection_id;
+  hand_off_connection(data, connfd, connection, false);
 }
 
 void remove_from_pollset(ThreadData* data, size_t* i_ptr) {
   PollSet* poll_set = data->poll_set;
+  size_t i = *i_ptr;
+  idle_wheel_remove(&poll_set->idle, &poll_set->connections[i]->idle);
+  end_session(&poll_set->connections[i]->session, data->seats,
+              data->waitlist);
+  free(poll_set->connections[i]);
   
-  // Shift all elements after *i_ptr one position left
-  for (size_t j = *i_ptr; j < poll_set->size - 1; j++) {
-    poll_set->set[j] = poll_set->set[j + 1];
+  // Move the last connection into the hole; a caller walking up the set
+  // visits slot i again through the decrement below
+  size_t last = poll_set->size - 1;
+  if (i != last) {
+    poll_set->fds[i] = poll_set->fds[last];
+    poll_set->connections[i] = poll_set->connections[last];
+    poll_set->connections[i]->index = i;
   }
   
-  poll_set->size--;
+  __atomic_store_n(&poll_set->size, poll_set->size - 1, __ATOMIC_RELAXED);
   (*i_ptr)--;
 }
 
+// Closing the fd also drops it from the epoll set
+void close_connection(ThreadData* data, size_t* i_ptr) {
+  close(data->poll_set->fds[*i_ptr]);
+  remove_from_pollset(data, i_ptr);
+}
+
+// Answers a request over its rate limit without handling it; false when
+// the connection has to be closed
+static bool refuse_throttled(ThreadData* data,
+                             int32_t fd,
+                             const Request* request) {
+  Response response;
+  default_response(&response);
+  response.code = RATE_LIMIT_ERROR_THROTTLED;
+  stats_record_throttled(&data->stats->workers[data->thread_index],
+                         request->action);
+  return send_response(fd, &response);
+}
+
+// Tells the connections that queued for a seat which one a cancellation
+// handed them. A connection with a request in the round gets the notice
+// before its response; one that fails the write is closed once its next
+// read fails.
+static void send_waitlist_notices(ThreadData* data) {
+  WaitTicket* ticket = waitlist_take_notices(data->waitlist,
+                                             data->thread_index);
+  while (ticket != nullptr) {
+    WaitTicket* next = ticket->next_notice;
+    Connection* connection =
+        (Connection*)((char*)ticket->waiter -
+                      offsetof(Connection, session.waiter));
+    int32_t fd = data->poll_set->fds[connection->index];
+    Response notice = {.code = WAITLIST_NOTICE_SEAT_ASSIGNED,
+                       .data_size = sizeof(pa3_seat_t),
+                       .data = (uint8_t*)&ticket->assigned};
+    send_response(fd < 0 ? ~fd : fd, &notice);
+    waitlist_release(ticket);
+    ticket = next;
+  }
+}
+
+// Reads a request from every ready connection into the scheduler. Slots
+// with a request queued or a connection to close get their fd negated;
+// epoll keeps reporting them, and they are skipped until the round is
+// over.
+static void admit_ready(ThreadData* data,
+                        Scheduler* scheduler,
+                        const struct epoll_event* events,
+                        int32_t n_events,
+                        size_t* n_closing) {
+  PollSet* poll_set = data->poll_set;
+  for (int32_t k = 0; k < n_events; k++) {
+    Connection* connection = events[k].data.ptr;
+    if (connection == nullptr) {
+      // New connections, waitlist notices or shutdown; one read clears
+      // the eventfd counter
+      uint64_t wakeups;
+      if (read(data->wake_fd, &wakeups, sizeof(wakeups)) < 0 &&
+          errno != EAGAIN)
+        perror("read notification");
+      take_handoffs(data);
+      send_waitlist_notices(data);
+      continue;
+    }
+    size_t i = connection->index;
+    if (poll_set->fds[i] < 0)
+      continue;
+
+    uint64_t started = stats_now();
+    Request request;
+    default_request(&request);
+    bool received_ok = receive_request(poll_set->fds[i], &request);
+    poll_set->fds[i] = ~poll_set->fds[i];
+    if (!received_ok) {
+      poll_set->closing[(*n_closing)++] = i;
+      continue;
+    }
+    uint64_t received = stats_now();
+    poll_set->connections[i]->last_active = received;
+    TRACE_EVENT_AT(TRACE_FRAME_COMPLETE, frame_complete, received,
+                   poll_set->connections[i]->id, request.action);
+    if (!rate_limit_admit(data->rate_table, &request,
+                          poll_set->connections[i]->peer_key,
+                          monotonic_ns())) {
+      bool sent = refuse_throttled(data, ~poll_set->fds[i], &request);
+      free_request(&request);
+      if (sent)
+        poll_set->fds[i] = ~poll_set->fds[i];
+      else
+        poll_set->closing[(*n_closing)++] = i;
+      continue;
+    }
+    PendingRequest* pending =
+        scheduler_push(scheduler, &request, i, received);
+    pending->received_ns = (data->capture != nullptr) ? monotonic_ns() : 0;
+    pending->read_ticks = received - started;
+  }
+}
+
+static void serve_request(ThreadData* data,
+                          Scheduler* scheduler,
+                          PendingRequest* pending,
+                          size_t* n_closing) {
+  PollSet* poll_set = data->poll_set;
+  size_t i = pending->slot;
+  int32_t fd = ~poll_set->fds[i];
+  Connection* connection = poll_set->connections[i];
+  Request* request = &pending->request;
+  Response response;
+  default_response(&response);
+
+  uint64_t picked = stats_now();
+  TRACE_EVENT_AT(TRACE_HANDLER_ENTRY, handler_entry, picked, request->action,
+                 0);
+  handle_request(request, &response, data->users, data->seats, data->stats,
+                 data->waitlist, &connection->session);
+  uint64_t handled = stats_now();
+  if ((request->action == ACTION_LOGIN &&
+       response.code == LOGIN_ERROR_SUCCESS) ||
+      (request->action == ACTION_RESUME &&
+       response.code == RESUME_ERROR_SUCCESS)) {
+    connection->user = find_user(data->users, request->username);
+  } else if (request->action == ACTION_LOGOUT &&
+             response.code == LOGOUT_ERROR_SUCCESS) {
+    waitlist_drop(data->waitlist, &connection->session.waiter);
+  }
+  TRACE_EVENT_AT(TRACE_HANDLER_EXIT, handler_exit, handled, request->action,
+                 response.code);
+  scheduler_charge(scheduler, request->action, handled - picked);
+
+  if (data->capture != nullptr)
+    capture_record(data->capture, data->thread_index, connection->id,
+                   pending->received_ns, request, response.code);
+
+  bool sent = send_response(fd, &response);
+  uint64_t written = stats_now();
+  TRACE_EVENT_AT(TRACE_WRITE_FLUSH, write_flush, written, connection->id,
+                 sent ? (int64_t)(RESPONSE_HEADER_SIZE + response.data_size)
+                      : -1);
+  stats_record(&data->stats->workers[data->thread_index], request->action,
+               response.code, pending->received, picked, handled, written);
+  uint64_t busy = pending->read_ticks + (written - picked);
+  connection->busy_ticks += busy;
+  __atomic_store_n(&data->load.busy_ticks, data->load.busy_ticks + busy,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&data->load.requests, data->load.requests + 1,
+                   __ATOMIC_RELAXED);
+  free_request(request);
+  free_response(&response);
+
+  if (!sent || request->action == ACTION_TERMINATION)
+    poll_set->closing[(*n_closing)++] = i;
+  else
+    poll_set->fds[i] = fd;
+}
+
+static int32_t compare_slots_descending(const void* a, const void* b) {
+  size_t lhs = *(const size_t*)a;
+  size_t rhs = *(const size_t*)b;
+  return (lhs < rhs) - (lhs > rhs);
+}
+
+// Highest slot first, so the connection moved into a closed slot is
+// never one that is still to be closed
+static void close_round_connections(ThreadData* data, size_t n_closing) {
+  size_t* closing = data->poll_set->closing;
+  qsort(closing, n_closing, sizeof(size_t), compare_slots_descending);
+  for (size_t k = 0; k < n_closing; k++) {
+    size_t i = closing[k];
+    data->poll_set->fds[i] = ~data->poll_set->fds[i];
+    close_connection(data, &i);
+  }
+}
+
+// Closes the connections whose idle timeout ran out and logs out the
+// user each one logged in, unless that user has logged in again since.
+// Those active after they were put on the wheel go back on it.
+static void reap_idle_connections(ThreadData* data, uint64_t now) {
+  PollSet* poll_set = data->poll_set;
+  IdleLink* expired = idle_wheel_expire(&poll_set->idle, now);
+  while (expired != nullptr) {
+    IdleLink* next = expired->next;
+    expired->next = nullptr;
+    Connection* connection = (Connection*)((char*)expired -
+                                           offsetof(Connection, idle));
+    expired = next;
+    if (now - connection->last_active < poll_set->idle.timeout) {
+      watch_connection(poll_set, connection);
+      continue;
+    }
+
+    if (connection->user >= 0)
+      reap_user(data->users, connection->user, connection->id);
+    size_t i = connection->index;
+    close_connection(data, &i);
+    __atomic_store_n(&data->load.reaped, data->load.reaped + 1,
+                     __ATOMIC_RELAXED);
+  }
+}
+
+// epoll_wait timeout until the idle wheel next has something due, -1 if never
+static int32_t idle_poll_timeout(const PollSet* poll_set,
+                                 double ns_per_tick) {
+  uint64_t due = idle_wheel_next_expiry(&poll_set->idle);
+  if (due == UINT64_MAX)
+    return -1;
+  uint64_t now = stats_now();
+  if (due <= now)
+    return 0;
+  // Rounded up, waking early would only find the slot not yet due
+  return (due - now) * ns_per_tick / 1e6 + 1;
+}
+
 void* thread_func(void* arg) {
   ThreadData* data = (ThreadData*)arg;
+  // Set up by the worker itself so first touch puts it on its node
+  data->poll_set = create_poll_set(data->wake_fd);
+  idle_wheel_init(&data->poll_set->idle,
+                  idle_timeout_s * 1e9 / data->stats->ns_per_tick,
+                  stats_now());
+  init_seats(data->seats, data->placement.seat_begin,
+             data->placement.seat_end);
+  pthread_barrier_wait(data->started);
   PollSet* poll_set = data->poll_set;
+  char recorder_name[FLIGHT_RECORDER_NAME_SIZE];
+  snprintf(recorder_name, sizeof(recorder_name), "worker %zu",
+           data->thread_index);
+  flight_recorder_register(recorder_name);
+  double ns_per_tick = data->stats->ns_per_tick;
+  uint64_t interval_ticks = REBALANCE_INTERVAL_MS * 1e6 / ns_per_tick;
+  uint64_t interval_start = stats_now();
+  uint64_t repoll_ticks = SCHED_REPOLL_US * 1e3 / ns_per_tick;
+  Scheduler scheduler;
+  scheduler_init(&scheduler, ns_per_tick);
+  struct epoll_event events[POLL_BATCH];
   
+  // Clients, handoffs and shutdown all arrive as events; the only timeout
+  // is the next idle connection coming due
   while (!sigint_received) {
-    pthread_mutex_lock(&poll_set->mutex);
-    int ready = poll(poll_set->set, poll_set->size, 100);
-    pthread_mutex_unlock(&poll_set->mutex);
+    int ready = epoll_wait(poll_set->epoll_fd, events, POLL_BATCH,
+                           idle_poll_timeout(poll_set, ns_per_tick));
+    
     
     if (ready < 0) {
       if (errno == EINTR) continue;
-      perror("poll");
+      perror("epoll_wait");
       break;
     }
     
-    if (ready == 0) continue;
+    if (ready == 0) {
+      reap_idle_connections(data, stats_now());
+      continue;
+    }
     
-    pthread_mutex_lock(&poll_set->mutex);
-    for (size_t i = 0; i < poll_set->size && ready > 0; i++) {
-      if (poll_set->set[i].revents & POLLIN) {
-        ready--;
-        
-        if (poll_set->set[i].fd == data->pipe_out_fd) {
-          // Notification from main thread
-          char buf;
-          read(data->pipe_out_fd, &buf, 1);
-          continue;
-        }
-        
-        // Handle client request
-        Request request;
-        Response response;
-        
-        // Receive request
-        if (sigint_safe_read(poll_set->set[i].fd, &request.action, sizeof(Action)) <= 0) {
-          close(poll_set->set[i].fd);
-          remove_from_pollset(data, &i);
-          continue;
-        }
-        
-        if (sigint_safe_read(poll_set->set[i].fd, &request.username_length, sizeof(uint64_t)) <= 0) {
-          close(poll_set->set[i].fd);
-          remove_from_pollset(data, &i);
-          continue;
-        }
-        
-        if (request.username_length > 0) {
-          request.username = malloc(request.username_length + 1);
-          if (sigint_safe_read(poll_set->set[i].fd, request.username, request.username_length) <= 0) {
-            free(request.username);
-            close(poll_set->set[i].fd);
-            remove_from_pollset(data, &i);
-            continue;
-          }
-          request.username[request.username_length] = '\0';
-        } else {
-          request.username = nullptr;
+    uint64_t woke = stats_now();
+    if (woke - interval_start >= interval_ticks) {
+      roll_load_interval(poll_set);
+      interval_start = woke;
+    }
+
+    // Serve by cost class, looking for newly ready connections now and
+    // then, so a query arriving during a run of logins is not left for
+    // the next round
+    size_t n_closing = 0;
+    admit_ready(data, &scheduler, events, ready, &n_closing);
+    uint64_t admitted = woke;
+    PendingRequest* pending;
+    while ((pending = scheduler_pop(&scheduler, stats_now())) != nullptr) {
+      serve_request(data, &scheduler, pending, &n_closing);
+      uint64_t now = stats_now();
+      if (now - admitted >= repoll_ticks) {
+        ready = epoll_wait(poll_set->epoll_fd, events, POLL_BATCH, 0);
+        if (ready > 0)
+          admit_ready(data, &scheduler, events, ready, &n_closing);
+        admitted = now;
+      }
+    }
+    close_round_connections(data, n_closing);
+    reap_idle_connections(data, stats_now());
+    migrate_connection(data);
+  }
+  
+  scheduler_free(&scheduler);
+  pthread_exit(nullptr);
+}
+
+void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [-u <socket path>] [-c <capture file>] [-L] [-P] [-b]\n"
+          "       [-a <t>,<m KiB>,<p> | -A <ms per hash>[,<logins/s>]]\n"
+          "       [-R <scope>.<class>=<per s>[/<burst>],...]\n"
+          "       [-i <idle s>[,<io ms>]] [-T <resume s>] [-C <max clients>]\n"
+          "       [-S <k>/<n>] [<port>]\n"
+          "  -L  profile seat and worker lock contention (see locks [N])\n"
+          "  -P  pin each worker to its own CPU, NUMA node local data\n"
+          "  -b  never move connections between workers (see load)\n"
+          "  -a  argon2id passes, memory and lanes for new hashes "
+          "(default %d,%d,%d)\n"
+          "  -A  pick them by benchmarking this host at startup\n"
+          "  -R  rate limits per client IP or user, for point, scan or "
+          "login\n"
+          "      requests; 0 disables (default ip.login=%d/%d,"
+          "user.login=%d/%d)\n"
+          "  -i  close clients idle this long, or stalled mid-frame for "
+          "io ms;\n"
+          "      0 disables (default %d,%d)\n"
+          "  -T  logins answer with a token that logs back in without the "
+          "password\n"
+          "      this long; 0 disables (default %d)\n"
+          "  -C  clients served at once (default: what the fd limit "
+          "allows)\n"
+          "  -S  serve only shard k of n, a slice of the seats, behind "
+          "pa3_router\n",
+          program, DEFAULT_TIME_COST, DEFAULT_MEMORY_KIB,
+          DEFAULT_PARALLELISM, RATE_IP_LOGIN_PER_SECOND, RATE_IP_LOGIN_BURST,
+          RATE_USER_LOGIN_PER_SECOND, RATE_USER_LOGIN_BURST,
+          DEFAULT_IDLE_TIMEOUT_S, DEFAULT_IO_TIMEOUT_MS,
+          DEFAULT_RESUME_TTL_S);
+}
+
+int main(int argc, char* argv[]) {
+  setup_sigint_handler();
+  struct sigaction usr1_action = {.sa_handler = sigusr1_handler, .sa_flags = 0};
+  sigemptyset(&usr1_action.sa_mask);
+  sigaction(SIGUSR1, &usr1_action, nullptr);
+
+  const char* socket_path = nullptr;
+  const char* capture_path = nullptr;
+  uint64_t target_hash_ms = 0;
+  uint64_t target_logins_per_second = 0;
+  int32_t opt;
+  size_t max_clients = 0;
+  while ((opt = getopt(argc, argv, "u:c:LPba:A:R:i:T:C:S:")) != -1) {
+    switch (opt) {
+      case 'u':
+        socket_path = optarg;
+        break;
+      case 'c':
+        capture_path = optarg;
+        break;
+      case 'L':
+        lock_profiling = true;
+        break;
+      case 'P':
+        pin_workers = true;
+        break;
+      case 'b':
+        load_balancing = false;
+        break;
+      case 'a':
+        if (!parse_hash_params(optarg, &hash_params)) {
+          print_usage(argv[0]);
+          return 1;
         }
-        
-        if (sigint_safe_read(poll_set->set[i].fd, &request.data_size, sizeof(uint64_t)) <= 0) {
-          if (request.username) free(request.username);
-          close(poll_set->set[i].fd);
-          remove_from_pollset(data, &i);
-          continue;
+        break;
+      case 'C': {
+        char* end;
+        max_clients = strtoull(optarg, &end, 10);
+        if (*end != '\0' || max_clients == 0) {
+          print_usage(argv[0]);
+          return 1;
         }
-        
-        if (request.data_size > 0) {
-          request.data = malloc(request.data_size + 1);
-          if (sigint_safe_read(poll_set->set[i].fd, request.data, request.data_size) <= 0) {
-            free(request.username);
-            free(request.data);
-            close(poll_set->set[i].fd);
-            remove_from_pollset(data, &i);
-            continue;
-          }
-          request.data[request.data_size] = '\0';
-        } else {
-          request.data = nullptr;
+        break;
+      }
+      case 'i':
+        if (!parse_idle_timeouts(optarg)) {
+          print_usage(argv[0]);
+          return 1;
         }
-        
-        // Process request
-        handle_request(&request, &response, data->users, data->seats);
-        
-        // Send response
-        if (sigint_safe_write(poll_set->set[i].fd, &response.code, sizeof(int32_t)) <= 0) {
-          free_request(&request);
-          free_response(&response);
-          close(poll_set->set[i].fd);
-          remove_from_pollset(data, &i);
-          continue;
+        break;
+      case 'T': {
+        char* end;
+        unsigned long long ttl_s = strtoull(optarg, &end, 10);
+        if (end == optarg || *end != '\0' || ttl_s > UINT32_MAX) {
+          print_usage(argv[0]);
+          return 1;
         }
-        
-        if (sigint_safe_write(poll_set->set[i].fd, &response.data_size, sizeof(uint64_t)) <= 0) {
-          free_request(&request);
-          free_response(&response);
-          close(poll_set->set[i].fd);
-          remove_from_pollset(data, &i);
-          continue;
+        resume_ttl_s = ttl_s;
+        break;
+      }
+      case 'S': {
+        ShardId shard;
+        if (!parse_shard(optarg, &shard)) {
+          print_usage(argv[0]);
+          return 1;
         }
-        
-        if (response.data_size > 0) {
-          if (sigint_safe_write(poll_set->set[i].fd, response.data, response.data_size) <= 0) {
-            free_request(&request);
-            free_response(&response);
-            close(poll_set->set[i].fd);
-            remove_from_pollset(data, &i);
-            continue;
-          }
+        shard_seat_range(shard, &owned_seats.first, &owned_seats.last);
+        printf("Serving seats %lu-%lu as shard %s\n", owned_seats.first,
+               owned_seats.last, optarg);
+        break;
+      }
+      case 'R':
+        if (!parse_rate_limits(optarg)) {
+          print_usage(argv[0]);
+          return 1;
         }
-        
-        free_request(&request);
-        free_response(&response);
-        
-        if (request.action == ACTION_TERMINATION) {
-          close(poll_set->set[i].fd);
-          remove_from_pollset(data, &i);
+        break;
+      case 'A': {
+        char* end;
+        target_hash_ms = strtoull(optarg, &end, 10);
+        if (*end == ',')
+          target_logins_per_second = strtoull(end + 1, &end, 10);
+        if (*end != '\0' || target_hash_ms == 0) {
+          print_usage(argv[0]);
+          return 1;
         }
+        break;
       }
+      default:
+        print_usage(argv[0]);
+        return 1;
     }
-    pthread_mutex_unlock(&poll_set->mutex);
   }
-  
-  pthread_exit(nullptr);
-}
 
-int main(int argc, char* argv[]) {
-  setup_sigint_handler();
-
-  if (argc != 2) {
-    fprintf(stderr, "usage: %s <port>\n", argv[0]);
+  // TCP and UNIX domain listeners may be used together or on their own
+  const char* port = (optind < argc) ? argv[optind++] : nullptr;
+  if (optind != argc || (port == nullptr && socket_path == nullptr)) {
+    print_usage(argv[0]);
     return 1;
   }
 
-  int listenfd;
-  struct sockaddr_in saddr, caddr;
+  int32_t listen_fds[2];
+  int32_t n_listeners = 0;
+  if (port != nullptr) {
+    int32_t tcp_fd = create_tcp_listener(strtoull(port, nullptr, 10));
+    if (tcp_fd < 0)
+      exit(EXIT_FAILURE);
+    listen_fds[n_listeners++] = tcp_fd;
+  }
+  if (socket_path != nullptr) {
+    int32_t unix_fd = create_unix_listener(socket_path);
+    if (unix_fd < 0)
+      exit(EXIT_FAILURE);
+    listen_fds[n_listeners++] = unix_fd;
+  }
+
+  struct sockaddr_storage caddr;
 
   Users users;
   setup_users(&users);
 
-  Seat* seats = default_seats();
+  Seat* seats = allocate_seats();
   int32_t n_cores = get_num_cores();
 
+  // Each client costs a socket, so the fd limit bounds -C as well
+  max_clients_per_thread = default_max_clients(n_cores);
+  if (max_clients > 0) {
+    size_t per_thread = (max_clients + n_cores - 1) / n_cores;
+    if (per_thread > max_clients_per_thread)
+      fprintf(stderr, "warning: the fd limit allows only %zu clients\n",
+              max_clients_per_thread * n_cores);
+    else
+      max_clients_per_thread = per_thread;
+  }
+
+  if (target_hash_ms > 0) {
+    uint64_t hash_ns =
+        calibrate_hash_params(&hash_params, target_hash_ms * 1'000'000,
+                              target_logins_per_second, n_cores);
+    printf("argon2id calibrated to t=%u m=%u KiB p=%u: %.1f ms per hash, "
+           "~%.0f logins/s on %d workers\n",
+           hash_params.time_cost, hash_params.memory_kib,
+           hash_params.parallelism, hash_ns / 1e6,
+           n_cores * 1e9 / hash_ns, n_cores);
+    if (hash_ns > target_hash_ms * 1'000'000 ||
+        (uint64_t)n_cores * 1'000'000'000 <
+            target_logins_per_second * hash_ns)
+      fprintf(stderr, "warning: even the cheapest parameters miss the "
+                      "target on this host\n");
+  }
+
   pthread_t* tid_arr = malloc(sizeof(pthread_t) * n_cores);
-  ThreadData* data_arr = malloc(sizeof(ThreadData) * n_cores);
-  int32_t (*pipe_fds)[2] = malloc(sizeof(int32_t[2]) * n_cores);
+  // WorkerLoad is cache-line aligned, which malloc does not guarantee
+  ThreadData* data_arr =
+      aligned_alloc(alignof(ThreadData), sizeof(ThreadData) * n_cores);
+
+  ServerStats stats;
+  stats_init(&stats, n_cores);
+  RateTable rate_table;
+  rate_table_init(&rate_table);
+  Waitlist waitlist;
+  waitlist_init(&waitlist, NUM_SEATS, n_cores);
+  listing_cache_init(&listing_cache);
+  flight_recorder_register("main");
+
+  // Only the main thread takes SIGUSR1 and SIGINT, so it is the one woken
+  // from poll; it wakes the workers itself when shutting down
+  sigset_t main_only_set;
+  sigemptyset(&main_only_set);
+  sigaddset(&main_only_set, SIGUSR1);
+  sigaddset(&main_only_set, SIGINT);
+  pthread_sigmask(SIG_BLOCK, &main_only_set, nullptr);
+
+  Capture* capture = nullptr;
+  if (capture_path != nullptr) {
+    capture = capture_start(capture_path, n_cores);
+    if (capture == nullptr)
+      exit(EXIT_FAILURE);
+  }
+
+  WorkerPlacement* placements = malloc(sizeof(WorkerPlacement) * n_cores);
+  plan_placement(placements, n_cores, sizeof(Seat), NUM_SEATS);
+  pthread_barrier_t started;
+  pthread_barrier_init(&started, nullptr, n_cores + 1);
 
   for (int i = 0; i < n_cores; i++) {
-    if (pipe(pipe_fds[i]) < 0) {
-      perror("pipe");
+    int32_t wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+      perror("eventfd");
       exit(EXIT_FAILURE);
     }
 
     data_arr[i].thread_index = i;
-    data_arr[i].pipe_out_fd = pipe_fds[i][0];
-    data_arr[i].poll_set = create_poll_set(pipe_fds[i][0]);
+    data_arr[i].wake_fd = wake_fd;
+    data_arr[i].poll_set = nullptr;
     data_arr[i].users = &users;
     data_arr[i].seats = seats;
-    pthread_create(&tid_arr[i], nullptr, thread_func, &data_arr[i]);
-  }
-
-  listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    data_arr[i].capture = capture;
+    data_arr[i].stats = &stats;
+    data_arr[i].rate_table = &rate_table;
+    data_arr[i].waitlist = &waitlist;
+    waitlist.inboxes[i].wake_fd = wake_fd;
+    data_arr[i].placement = placements[i];
+    data_arr[i].started = &started;
+    data_arr[i].load = (WorkerLoad){.migrate_to = -1};
+    init_handoff(&data_arr[i].handoff);
+    data_arr[i].workers = data_arr;
 
-  memset(&saddr, 0, sizeof(saddr));
-  saddr.sin_family = AF_INET;
-  saddr.sin_addr.s_addr = htonl(INADDR_ANY);
-  saddr.sin_port = htons(strtoull(argv[1], nullptr, 10));
-
-  bind(listenfd, (struct sockaddr*)&saddr, sizeof(saddr));
-  listen(listenfd, 10);
+    // Pinned from the start, so nothing the worker allocates is misplaced
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (placements[i].cpu >= 0) {
+      cpu_set_t cpu_set;
+      CPU_ZERO(&cpu_set);
+      CPU_SET(placements[i].cpu, &cpu_set);
+      pthread_attr_setaffinity_np(&attr, sizeof(cpu_set), &cpu_set);
+      printf("worker %d pinned to cpu %d on node %d\n", i, placements[i].cpu,
+             placements[i].node);
+    }
+    if (pthread_create(&tid_arr[i], &attr, thread_func, &data_arr[i]) != 0) {
+      perror("pthread_create");
+      exit(EXIT_FAILURE);
+    }
+    pthread_attr_destroy(&attr);
+  }
+  pthread_barrier_wait(&started);
+  pthread_barrier_destroy(&started);
+  free(placements);
+  pthread_sigmask(SIG_UNBLOCK, &main_only_set, nullptr);
 
-  struct pollfd main_thread_poll_set[2];
+  struct pollfd main_thread_poll_set[3];
   memset(main_thread_poll_set, 0, sizeof(main_thread_poll_set));
   main_thread_poll_set[0].fd = STDIN_FILENO;
   main_thread_poll_set[0].events = POLLIN;
-  main_thread_poll_set[1].fd = listenfd;
-  main_thread_poll_set[1].events = POLLIN;
+  for (int i = 0; i < n_listeners; i++) {
+    main_thread_poll_set[i + 1].fd = listen_fds[i];
+    main_thread_poll_set[i + 1].events = POLLIN;
+  }
 
+  Console console = {0};
+  uint64_t next_connection_id = 1;
+  LoadSample* load_samples = calloc(n_cores, sizeof(LoadSample));
+  uint64_t interval_ticks = REBALANCE_INTERVAL_MS * 1e6 / stats.ns_per_tick;
+  uint64_t interval_start = stats_now();
   while (!sigint_received) {
-    if (poll(main_thread_poll_set, 2, -1) < 0) {
+    if (trace_dump_requested) {
+      trace_dump_requested = false;
+      flight_recorder_dump(stdout, stats.ns_per_tick);
+    }
+
+    // Balancing needs a tick only while some worker has clients
+    int32_t timeout =
+        workers_idle(data_arr, n_cores) ? -1 : REBALANCE_INTERVAL_MS;
+    if (poll(main_thread_poll_set, n_listeners + 1, timeout) < 0) {
       if (errno == EINTR) {
         continue;
       }
@@ -233,14 +646,46 @@ int main(int argc, char* argv[]) {
       exit(EXIT_FAILURE);
     }
 
-    if (main_thread_poll_set[0].revents & POLLIN) {
-      if (check_stdin_for_termination() == true) {
-        kill(getpid(), SIGINT);
-        continue;
+    uint64_t now = stats_now();
+    if (now - interval_start >= interval_ticks) {
+      balance_workers(data_arr, n_cores, load_samples, now - interval_start);
+      interval_start = now;
+    }
+
+    if (main_thread_poll_set[0].revents & (POLLIN | POLLHUP)) {
+      read_console(&console);
+      ConsoleCommand command;
+      const char* argument;
+      while (next_console_command(&console, &command, &argument)) {
+        if (command == CONSOLE_COMMAND_EXIT) {
+          kill(getpid(), SIGINT);
+          break;
+        } else if (command == CONSOLE_COMMAND_STATS) {
+          size_t length;
+          char* report = stats_report(&stats, &length);
+          fwrite(report, 1, length, stdout);
+          fflush(stdout);
+          free(report);
+        } else if (command == CONSOLE_COMMAND_TRACE) {
+          flight_recorder_dump(stdout, stats.ns_per_tick);
+        } else if (command == CONSOLE_COMMAND_LOCKS) {
+          size_t top_n = strtoull(argument, nullptr, 10);
+          report_lock_stats(stdout, data_arr, n_cores,
+                            top_n ? top_n : LOCK_STATS_DEFAULT_TOP);
+        } else if (command == CONSOLE_COMMAND_LOAD) {
+          report_load(stdout, data_arr, n_cores, load_samples);
+        }
       }
-    } else if (main_thread_poll_set[1].revents & POLLIN) {
-      uint32_t caddrlen = sizeof(caddr);
-      int connfd = accept(listenfd, (struct sockaddr*)&caddr, &caddrlen);
+      if (sigint_received)
+        continue;
+    }
+
+    for (int i = 0; i < n_listeners; i++) {
+      if (!(main_thread_poll_set[i + 1].revents & POLLIN))
+        continue;
+
+      socklen_t caddrlen = sizeof(caddr);
+      int connfd = accept(listen_fds[i], (struct sockaddr*)&caddr, &caddrlen);
       if (connfd < 0) {
         if (errno == EINTR) {
           continue;
@@ -249,16 +694,41 @@ int main(int argc, char* argv[]) {
         exit(EXIT_FAILURE);
       }
 
+      if (caddr.ss_family == AF_INET) {
+        // Responses are written field by field, so Nagle would hold them
+        // back until the client's delayed ACK
+        int32_t nodelay = 1;
+        setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+      }
+
+      // Workers read and write with blocking calls, so a peer that
+      // stalls mid-frame must not hold one up for longer than this
+      if (io_timeout_ms > 0) {
+        struct timeval io_timeout = {.tv_sec = io_timeout_ms / 1000,
+                                     .tv_usec = io_timeout_ms % 1000 * 1000};
+        setsockopt(connfd, SOL_SOCKET, SO_RCVTIMEO, &io_timeout,
+                   sizeof(io_timeout));
+        setsockopt(connfd, SOL_SOCKET, SO_SNDTIMEO, &io_timeout,
+                   sizeof(io_timeout));
+      }
+
+      ssize_t pollset_i = find_suitable_pollset(data_arr, n_cores);
+      if (pollset_i == -1) {
+        // Every slot is taken; the idle reaper is what frees them up
+        close(connfd);
+        continue;
+      }
       printf("Accepted connection from client\n");
-      ssize_t pollset_i;
-      do {
-        pollset_i = find_suitable_pollset(data_arr, n_cores);
-      } while (pollset_i == -1);
-      add_to_pollset(data_arr[pollset_i].poll_set, pipe_fds[pollset_i][1],
-                     connfd);
+      TRACE_EVENT(TRACE_ACCEPT, accept, next_connection_id, connfd);
+      add_to_pollset(&data_arr[pollset_i], connfd, next_connection_id++,
+                     rate_peer_key(&caddr));
     }
   }
 
-  return terminate_after_cleanup(pipe_fds, tid_arr, data_arr, n_cores, listenfd,
-                                 &users, seats);
-}
\ No newline at end of file
+  if (socket_path != nullptr)
+    unlink(socket_path);
+
+  free(load_samples);
+  return terminate_after_cleanup(tid_arr, data_arr, n_cores, listen_fds,
+                                 n_listeners, &users, seats);
+}
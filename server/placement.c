@@ -0,0 +1,74 @@
+#include "placement.h"
+#include <dirent.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+bool pin_workers = false;
+
+int32_t nth_allowed_cpu(int32_t n) {
+  cpu_set_t cpu_set;
+  sched_getaffinity(0, sizeof(cpu_set), &cpu_set);
+  for (int32_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &cpu_set) && n-- == 0)
+      return cpu;
+  }
+  return -1;
+}
+
+int32_t cpu_node(int32_t cpu) {
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  DIR* dir = opendir(path);
+  if (dir == nullptr)
+    return 0;
+  int32_t node = 0;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    if (sscanf(entry->d_name, "node%d", &node) == 1)
+      break;
+  }
+  closedir(dir);
+  return node;
+}
+
+void plan_placement(WorkerPlacement* placements,
+                    int32_t n_workers,
+                    size_t seat_size,
+                    size_t n_seats) {
+  // Nodes in order of their first worker; unpinned workers share node 0
+  int32_t* nodes = malloc(sizeof(int32_t) * n_workers);
+  int32_t* first_worker = malloc(sizeof(int32_t) * n_workers);
+  int32_t n_nodes = 0;
+  for (int32_t i = 0; i < n_workers; i++) {
+    placements[i] = (WorkerPlacement){.cpu = -1, .node = 0};
+    if (pin_workers) {
+      placements[i].cpu = nth_allowed_cpu(i);
+      placements[i].node = cpu_node(placements[i].cpu);
+    }
+    int32_t k = 0;
+    while (k < n_nodes && nodes[k] != placements[i].node)
+      k++;
+    if (k == n_nodes) {
+      nodes[n_nodes] = placements[i].node;
+      first_worker[n_nodes++] = i;
+    }
+  }
+
+  // Shards are whole pages, since first touch places memory per page
+  size_t seats_per_page = sysconf(_SC_PAGESIZE) / seat_size;
+  size_t n_pages = (n_seats + seats_per_page - 1) / seats_per_page;
+  for (int32_t k = 0; k < n_nodes; k++) {
+    WorkerPlacement* owner = &placements[first_worker[k]];
+    owner->seat_begin = k * n_pages / n_nodes * seats_per_page;
+    owner->seat_end = (k + 1) * n_pages / n_nodes * seats_per_page;
+    if (owner->seat_begin > n_seats)
+      owner->seat_begin = n_seats;
+    if (owner->seat_end > n_seats)
+      owner->seat_end = n_seats;
+  }
+  free(nodes);
+  free(first_worker);
+}
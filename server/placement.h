@@ -0,0 +1,29 @@
+#ifndef SERVER_PLACEMENT_H
+#define SERVER_PLACEMENT_H
+#include <helper.h>
+
+// Set by the -P option, read-only afterwards
+extern bool pin_workers;
+
+// Where one worker runs and which seats it first touches
+typedef struct {
+  int32_t cpu;   // -1 when the worker is not pinned
+  int32_t node;  // NUMA node of cpu, 0 when unknown
+  size_t seat_begin;
+  size_t seat_end;
+} WorkerPlacement;
+
+// The n-th CPU of the process affinity mask
+int32_t nth_allowed_cpu(int32_t n);
+
+// Reads the node from sysfs; 0 on machines without NUMA information
+int32_t cpu_node(int32_t cpu);
+
+// Gives worker i the i-th allowed CPU when pinning, and splits the seat
+// pages between the nodes in use; the first worker on each node gets
+// its node's shard to initialise
+void plan_placement(WorkerPlacement* placements,
+                    int32_t n_workers,
+                    size_t seat_size,
+                    size_t n_seats);
+#endif
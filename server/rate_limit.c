@@ -0,0 +1,175 @@
+#include "rate_limit.h"
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+
+RateLimit rate_limits[RATE_N_SCOPES][COST_N_CLASSES] = {
+    [RATE_SCOPE_IP][COST_CLASS_LOGIN] = {RATE_IP_LOGIN_PER_SECOND,
+                                         RATE_IP_LOGIN_BURST},
+    [RATE_SCOPE_USER][COST_CLASS_LOGIN] = {RATE_USER_LOGIN_PER_SECOND,
+                                           RATE_USER_LOGIN_BURST},
+};
+
+static const char* scope_names[RATE_N_SCOPES] = {
+    [RATE_SCOPE_IP] = "ip",
+    [RATE_SCOPE_USER] = "user",
+};
+
+static const char* class_names[COST_N_CLASSES] = {
+    [COST_CLASS_POINT] = "point",
+    [COST_CLASS_SCAN] = "scan",
+    [COST_CLASS_LOGIN] = "login",
+};
+
+static ssize_t find_name(const char* const* names,
+                         size_t n_names,
+                         const char* name,
+                         size_t length) {
+  for (size_t i = 0; i < n_names; i++) {
+    if (strlen(names[i]) == length && strncmp(names[i], name, length) == 0)
+      return i;
+  }
+  return -1;
+}
+
+// Applies one "<scope>.<class>=<per second>[/<burst>]" item
+static bool parse_rate_limit(const char* item, size_t length) {
+  const char* dot = memchr(item, '.', length);
+  const char* equals = memchr(item, '=', length);
+  if (dot == nullptr || equals == nullptr || equals < dot)
+    return false;
+  ssize_t scope = find_name(scope_names, RATE_N_SCOPES, item, dot - item);
+  ssize_t class =
+      find_name(class_names, COST_N_CLASSES, dot + 1, equals - dot - 1);
+  if (scope < 0 || class < 0)
+    return false;
+
+  char* end;
+  double per_second = strtod(equals + 1, &end);
+  double burst = per_second < 1 ? 1 : per_second;
+  if (*end == '/')
+    burst = strtod(end + 1, &end);
+  if (end != item + length || per_second < 0 || burst < 1)
+    return false;
+  rate_limits[scope][class] = (RateLimit){per_second, burst};
+  return true;
+}
+
+bool parse_rate_limits(const char* text) {
+  while (*text != '\0') {
+    const char* comma = strchrnul(text, ',');
+    if (!parse_rate_limit(text, comma - text))
+      return false;
+    text = (*comma == ',') ? comma + 1 : comma;
+  }
+  return true;
+}
+
+void rate_table_init(RateTable* table) {
+  table->buckets = calloc(RATE_TABLE_SLOTS, sizeof(RateBucket));
+  for (int i = 0; i < RATE_TABLE_STRIPES; i++)
+    pthread_mutex_init(&table->stripes[i], nullptr);
+}
+
+void rate_table_free(RateTable* table) {
+  for (int i = 0; i < RATE_TABLE_STRIPES; i++)
+    pthread_mutex_destroy(&table->stripes[i]);
+  free(table->buckets);
+  table->buckets = nullptr;
+}
+
+bool rate_table_take(RateTable* table,
+                     uint64_t key,
+                     const RateLimit* limit,
+                     uint64_t now_ns) {
+  size_t group = key % (RATE_TABLE_SLOTS / RATE_GROUP_SIZE);
+  RateBucket* slots = &table->buckets[group * RATE_GROUP_SIZE];
+  pthread_mutex_t* stripe = &table->stripes[group % RATE_TABLE_STRIPES];
+  pthread_mutex_lock(stripe);
+
+  RateBucket* bucket = nullptr;
+  RateBucket* oldest = &slots[0];
+  for (size_t i = 0; i < RATE_GROUP_SIZE && bucket == nullptr; i++) {
+    if (slots[i].key == key)
+      bucket = &slots[i];
+    else if (slots[i].key == 0 || slots[i].updated_ns < oldest->updated_ns)
+      oldest = &slots[i];
+  }
+  // An evicted bucket comes back full, which is what it would have
+  // refilled to anyway unless its owner is still busy
+  if (bucket == nullptr) {
+    bucket = oldest;
+    *bucket = (RateBucket){
+        .key = key, .updated_ns = now_ns, .tokens = limit->burst};
+  }
+
+  // Workers read the clock before taking the stripe, so another one may
+  // have stored a later time already; an older one adds nothing
+  if (now_ns > bucket->updated_ns) {
+    bucket->tokens += (now_ns - bucket->updated_ns) * limit->per_second / 1e9;
+    if (bucket->tokens > limit->burst)
+      bucket->tokens = limit->burst;
+    bucket->updated_ns = now_ns;
+  }
+  bool taken = bucket->tokens >= 1;
+  if (taken)
+    bucket->tokens -= 1;
+  pthread_mutex_unlock(stripe);
+  return taken;
+}
+
+// FNV-1a, then a finalizer so consecutive addresses spread over groups
+static uint64_t hash_key(RateScope scope,
+                         CostClass class,
+                         const void* bytes,
+                         size_t length) {
+  uint64_t hash = 14'695'981'039'346'656'037ull ^ (scope << 8 | class);
+  for (size_t i = 0; i < length; i++) {
+    hash ^= ((const uint8_t*)bytes)[i];
+    hash *= 1'099'511'628'211ull;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  return hash != 0 ? hash : 1;
+}
+
+uint64_t rate_peer_key(const struct sockaddr_storage* address) {
+  // Keyed per class later; this only has to tell clients apart
+  if (address->ss_family == AF_INET) {
+    const struct in_addr* ip = &((const struct sockaddr_in*)address)->sin_addr;
+    return hash_key(RATE_SCOPE_IP, 0, ip, sizeof(*ip));
+  }
+  if (address->ss_family == AF_INET6) {
+    const struct in6_addr* ip =
+        &((const struct sockaddr_in6*)address)->sin6_addr;
+    return hash_key(RATE_SCOPE_IP, 0, ip, sizeof(*ip));
+  }
+  return 0;
+}
+
+bool rate_limit_admit(RateTable* table,
+                      const Request* request,
+                      uint64_t peer_key,
+                      uint64_t now_ns) {
+  // Closing the connection is never worth refusing
+  if (request->action == ACTION_TERMINATION)
+    return true;
+  CostClass class = cost_class(request->action);
+
+  const RateLimit* ip_limit = &rate_limits[RATE_SCOPE_IP][class];
+  if (peer_key != 0 && ip_limit->per_second > 0 &&
+      !rate_table_take(table, hash_key(RATE_SCOPE_IP, class, &peer_key,
+                                       sizeof(peer_key)),
+                       ip_limit, now_ns))
+    return false;
+
+  const RateLimit* user_limit = &rate_limits[RATE_SCOPE_USER][class];
+  if (request->username != nullptr && user_limit->per_second > 0 &&
+      !rate_table_take(table, hash_key(RATE_SCOPE_USER, class,
+                                       request->username,
+                                       request->username_length),
+                       user_limit, now_ns))
+    return false;
+  return true;
+}
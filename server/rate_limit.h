@@ -0,0 +1,74 @@
+#ifndef SERVER_RATE_LIMIT_H
+#define SERVER_RATE_LIMIT_H
+#include <helper.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "scheduler.h"
+
+// Token buckets checked as soon as a frame is complete, before it is
+// queued. Each cost class has a limit per client IP and one per username;
+// a request that finds either bucket empty is answered
+// RATE_LIMIT_ERROR_THROTTLED and never reaches its handler.
+typedef enum {
+  RATE_SCOPE_IP,
+  RATE_SCOPE_USER,
+  RATE_N_SCOPES
+} RateScope;
+
+typedef struct {
+  double per_second;  // 0 leaves the class unlimited
+  double burst;       // tokens a bucket starts with and never exceeds
+} RateLimit;
+
+// Only logins are limited unless -R says otherwise, one argon2 hash each
+#define RATE_IP_LOGIN_PER_SECOND 20
+#define RATE_IP_LOGIN_BURST 40
+#define RATE_USER_LOGIN_PER_SECOND 5
+#define RATE_USER_LOGIN_BURST 10
+
+// Buckets live in groups of RATE_GROUP_SIZE slots; a key only ever
+// probes its own group, which one of the stripe locks guards
+#define RATE_TABLE_SLOTS 8192
+#define RATE_GROUP_SIZE 8
+#define RATE_TABLE_STRIPES 64
+
+// Set from the command line before the workers start, read-only afterwards
+extern RateLimit rate_limits[RATE_N_SCOPES][COST_N_CLASSES];
+
+// Parses "<scope>.<class>=<per second>[/<burst>]" items separated by
+// commas, e.g. "ip.login=10/20,user.scan=50"; scope is ip or user, class
+// point, scan or login. The burst defaults to one second's worth.
+bool parse_rate_limits(const char* text);
+
+typedef struct {
+  uint64_t key;  // 0 marks a free slot
+  uint64_t updated_ns;
+  double tokens;
+} RateBucket;
+
+typedef struct {
+  RateBucket* buckets;
+  pthread_mutex_t stripes[RATE_TABLE_STRIPES];
+} RateTable;
+
+void rate_table_init(RateTable* table);
+void rate_table_free(RateTable* table);
+
+// Takes a token from the bucket of key, refilled up to now_ns first;
+// false when it is empty. A key without a bucket gets a full one, taking
+// over the least recently used slot of its group if none is free.
+bool rate_table_take(RateTable* table,
+                     uint64_t key,
+                     const RateLimit* limit,
+                     uint64_t now_ns);
+
+// Keys the per-IP buckets; 0 for clients without an IP address
+uint64_t rate_peer_key(const struct sockaddr_storage* address);
+
+// True when the request may be handled. Charges the client's bucket
+// (peer_key 0 skips it) and then the user's for the request's class.
+bool rate_limit_admit(RateTable* table,
+                      const Request* request,
+                      uint64_t peer_key,
+                      uint64_t now_ns);
+#endif
@@ -0,0 +1,130 @@
+#include "scheduler.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static const uint64_t class_weight[COST_N_CLASSES] = {
+    [COST_CLASS_POINT] = SCHED_WEIGHT_POINT,
+    [COST_CLASS_SCAN] = SCHED_WEIGHT_SCAN,
+    [COST_CLASS_LOGIN] = SCHED_WEIGHT_LOGIN,
+};
+
+static const uint64_t class_budget_us[COST_N_CLASSES] = {
+    [COST_CLASS_POINT] = SCHED_BUDGET_POINT_US,
+    [COST_CLASS_SCAN] = SCHED_BUDGET_SCAN_US,
+    [COST_CLASS_LOGIN] = SCHED_BUDGET_LOGIN_US,
+};
+
+CostClass cost_class(Action action) {
+  switch (action) {
+    case ACTION_LOGIN:
+      return COST_CLASS_LOGIN;
+    case ACTION_CONFIRM_BOOKING:
+    case ACTION_STATS:
+      return COST_CLASS_SCAN;
+    default:
+      return COST_CLASS_POINT;
+  }
+}
+
+void scheduler_init(Scheduler* scheduler, double ns_per_tick) {
+  *scheduler = (Scheduler){.capacity = 64};
+  scheduler->pending = malloc(sizeof(PendingRequest) * scheduler->capacity);
+  if (scheduler->pending == nullptr) {
+    perror("malloc failed");
+    exit(EXIT_FAILURE);
+  }
+  for (int c = 0; c < COST_N_CLASSES; c++) {
+    scheduler->classes[c].items = malloc(sizeof(size_t) * scheduler->capacity);
+    if (scheduler->classes[c].items == nullptr) {
+      perror("malloc failed");
+      exit(EXIT_FAILURE);
+    }
+    scheduler->budget_ticks[c] = class_budget_us[c] * 1e3 / ns_per_tick;
+  }
+}
+
+void scheduler_free(Scheduler* scheduler) {
+  free(scheduler->pending);
+  for (int c = 0; c < COST_N_CLASSES; c++)
+    free(scheduler->classes[c].items);
+}
+
+PendingRequest* scheduler_push(Scheduler* scheduler,
+                               const Request* request,
+                               size_t slot,
+                               uint64_t received) {
+  if (scheduler->n_pending == scheduler->capacity) {
+    scheduler->capacity *= 2;
+    scheduler->pending = realloc(scheduler->pending,
+                                 sizeof(PendingRequest) * scheduler->capacity);
+    if (scheduler->pending == nullptr) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+    for (int c = 0; c < COST_N_CLASSES; c++) {
+      scheduler->classes[c].items =
+          realloc(scheduler->classes[c].items,
+                  sizeof(size_t) * scheduler->capacity);
+      if (scheduler->classes[c].items == nullptr) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+      }
+    }
+  }
+
+  // A class that was idle starts from the current virtual time rather
+  // than with the credit it did not use
+  ClassQueue* queue = &scheduler->classes[cost_class(request->action)];
+  if (queue->head == queue->tail &&
+      queue->virtual_time < scheduler->virtual_time)
+    queue->virtual_time = scheduler->virtual_time;
+
+  size_t index = scheduler->n_pending++;
+  queue->items[queue->tail++] = index;
+  PendingRequest* pending = &scheduler->pending[index];
+  *pending = (PendingRequest){
+      .request = *request, .slot = slot, .received = received};
+  return pending;
+}
+
+PendingRequest* scheduler_pop(Scheduler* scheduler, uint64_t now) {
+  int32_t chosen = -1;
+  uint64_t most_overdue = 0;
+  for (int c = 0; c < COST_N_CLASSES; c++) {
+    ClassQueue* queue = &scheduler->classes[c];
+    if (queue->head == queue->tail)
+      continue;
+    uint64_t waited =
+        now - scheduler->pending[queue->items[queue->head]].received;
+    if (waited > scheduler->budget_ticks[c] &&
+        waited - scheduler->budget_ticks[c] > most_overdue) {
+      most_overdue = waited - scheduler->budget_ticks[c];
+      chosen = c;
+    }
+  }
+  if (chosen < 0) {
+    uint64_t least = UINT64_MAX;
+    for (int c = 0; c < COST_N_CLASSES; c++) {
+      ClassQueue* queue = &scheduler->classes[c];
+      if (queue->head != queue->tail && queue->virtual_time < least) {
+        least = queue->virtual_time;
+        chosen = c;
+      }
+    }
+  }
+
+  if (chosen < 0) {
+    scheduler->n_pending = 0;
+    for (int c = 0; c < COST_N_CLASSES; c++)
+      scheduler->classes[c].head = scheduler->classes[c].tail = 0;
+    return nullptr;
+  }
+  ClassQueue* queue = &scheduler->classes[chosen];
+  scheduler->virtual_time = queue->virtual_time;
+  return &scheduler->pending[queue->items[queue->head++]];
+}
+
+void scheduler_charge(Scheduler* scheduler, Action action, uint64_t ticks) {
+  CostClass c = cost_class(action);
+  scheduler->classes[c].virtual_time += ticks / class_weight[c];
+}
@@ -0,0 +1,71 @@
+#ifndef SERVER_SCHEDULER_H
+#define SERVER_SCHEDULER_H
+#include <helper.h>
+
+// Requests read in one poll round are served by cost class instead of fd
+// order, so a cheap query never waits behind a batch of logins
+typedef enum {
+  COST_CLASS_POINT,  // book, cancel, query, logout: a seat or a user
+  COST_CLASS_SCAN,   // confirm booking and stats walk every seat or worker
+  COST_CLASS_LOGIN,  // argon2
+  COST_N_CLASSES
+} CostClass;
+
+// Share of worker time each class gets while all of them are backlogged
+#define SCHED_WEIGHT_POINT 8
+#define SCHED_WEIGHT_SCAN 2
+#define SCHED_WEIGHT_LOGIN 1
+
+// A request that has waited longer than its class budget is served next,
+// whatever the weights say
+#define SCHED_BUDGET_POINT_US 1000
+#define SCHED_BUDGET_SCAN_US 5000
+#define SCHED_BUDGET_LOGIN_US 100'000
+
+// While a round is being served, the worker polls again for newly ready
+// connections once this much time has passed since it last looked
+#define SCHED_REPOLL_US 200
+
+typedef struct {
+  Request request;
+  size_t slot;           // index in the PollSet, stable during a round
+  uint64_t received;     // stats_now() when the frame was complete
+  uint64_t received_ns;  // monotonic_ns() for the capture, 0 without one
+  uint64_t read_ticks;   // spent reading the frame
+} PendingRequest;
+
+typedef struct {
+  size_t* items;  // indices into Scheduler.pending, in arrival order
+  size_t head;
+  size_t tail;
+  uint64_t virtual_time;  // service received, scaled down by the weight
+} ClassQueue;
+
+typedef struct {
+  PendingRequest* pending;
+  size_t n_pending;
+  size_t capacity;
+  ClassQueue classes[COST_N_CLASSES];
+  uint64_t virtual_time;  // of the class served last
+  uint64_t budget_ticks[COST_N_CLASSES];
+} Scheduler;
+
+CostClass cost_class(Action action);
+
+void scheduler_init(Scheduler* scheduler, double ns_per_tick);
+void scheduler_free(Scheduler* scheduler);
+
+// Queues a request; the returned entry stays valid until the next push
+PendingRequest* scheduler_push(Scheduler* scheduler,
+                               const Request* request,
+                               size_t slot,
+                               uint64_t received);
+
+// The most overdue request if any class is past its budget, otherwise
+// the head of the class with the least weighted service so far;
+// nullptr once every queue is empty, which also recycles the entries
+PendingRequest* scheduler_pop(Scheduler* scheduler, uint64_t now);
+
+// Bills a class for the handler time of the request it just had served
+void scheduler_charge(Scheduler* scheduler, Action action, uint64_t ticks);
+#endif
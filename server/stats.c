@@ -0,0 +1,172 @@
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* action_names[STATS_N_ACTIONS] = {
+    "invalid",       "termination", "login",  "book", "confirmbooking",
+    "cancelbooking", "logout",      "query",  "stats", "waitlist",
+    "batchbook",     "preparebook", "commitbook", "abortbook", "resume"};
+
+#define BATCH_BOOK_CODE_NAMES                                        \
+  {"success", "user_not_logged_in", "seat_unavailable",              \
+   "seat_out_of_range", "no_data", "unknown_transaction"}
+
+// Names of the codes in pa3_error.h, indexed like WorkerStats::codes
+static const char* code_names[STATS_N_ACTIONS][STATS_N_CODES - 1] = {
+    [ACTION_LOGIN + 1] = {"success", "active_user", "active_client",
+                          "incorrect_password", "no_password"},
+    [ACTION_BOOK + 1] = {"success", "user_not_logged_in", "seat_unavailable",
+                         "seat_out_of_range", "no_data"},
+    [ACTION_CONFIRM_BOOKING + 1] = {"success", "user_not_logged_in",
+                                    "invalid_data", "no_data"},
+    [ACTION_CANCEL_BOOKING + 1] = {"success", "user_not_logged_in",
+                                   "seat_not_booked_by_user",
+                                   "seat_out_of_range", "no_data"},
+    [ACTION_LOGOUT + 1] = {"success", "user_not_found", "user_not_logged_in"},
+    [ACTION_QUERY + 1] = {"success", "seat_out_of_range", "no_data"},
+    [ACTION_STATS + 1] = {"success"},
+    [ACTION_WAITLIST + 1] = {"success", "user_not_logged_in",
+                             "seat_out_of_range", "no_data", "seat_assigned",
+                             "too_many_tickets", "seat_held"},
+    [ACTION_BATCH_BOOK + 1] = BATCH_BOOK_CODE_NAMES,
+    [ACTION_PREPARE_BOOK + 1] = BATCH_BOOK_CODE_NAMES,
+    [ACTION_COMMIT_BOOK + 1] = BATCH_BOOK_CODE_NAMES,
+    [ACTION_ABORT_BOOK + 1] = BATCH_BOOK_CODE_NAMES,
+    [ACTION_RESUME + 1] = {"success", "invalid_token", "expired", "no_data"},
+};
+
+static size_t action_index(Action action) {
+  if (action < ACTION_TERMINATION || action > ACTION_RESUME)
+    return 0;
+  return action + 1;
+}
+
+static double calibrate_ns_per_tick() {
+#if defined(__x86_64__) || defined(__i386__)
+  uint64_t start_ns = monotonic_ns();
+  uint64_t start_ticks = stats_now();
+  while (monotonic_ns() - start_ns < 10'000'000) {
+  }
+  return (double)(monotonic_ns() - start_ns) / (stats_now() - start_ticks);
+#else
+  return 1.0;
+#endif
+}
+
+void stats_init(ServerStats* stats, size_t n_workers) {
+  stats->workers = malloc(sizeof(WorkerStats) * n_workers);
+  stats->n_workers = n_workers;
+  for (size_t i = 0; i < n_workers; i++) {
+    WorkerStats* worker = &stats->workers[i];
+    for (size_t a = 0; a < STATS_N_ACTIONS; a++) {
+      histogram_init(&worker->queue_wait[a]);
+      histogram_init(&worker->handler[a]);
+      histogram_init(&worker->write[a]);
+    }
+    memset(worker->codes, 0, sizeof(worker->codes));
+    memset(worker->throttled, 0, sizeof(worker->throttled));
+  }
+  stats->ns_per_tick = calibrate_ns_per_tick();
+}
+
+void stats_free(ServerStats* stats) {
+  free(stats->workers);
+  stats->workers = nullptr;
+  stats->n_workers = 0;
+}
+
+void stats_record(WorkerStats* stats,
+                  Action action,
+                  int32_t code,
+                  uint64_t ready,
+                  uint64_t picked,
+                  uint64_t handled,
+                  uint64_t written) {
+  size_t a = action_index(action);
+  size_t c = (code >= 0 && code < STATS_N_CODES - 1) ? (size_t)code
+                                                     : STATS_N_CODES - 1;
+  histogram_record(&stats->queue_wait[a], picked - ready);
+  histogram_record(&stats->handler[a], handled - picked);
+  histogram_record(&stats->write[a], written - handled);
+  // Single writer, so a relaxed load/store pair is enough
+  __atomic_store_n(&stats->codes[a][c],
+                   __atomic_load_n(&stats->codes[a][c], __ATOMIC_RELAXED) + 1,
+                   __ATOMIC_RELAXED);
+}
+
+void stats_record_throttled(WorkerStats* stats, Action action) {
+  size_t a = action_index(action);
+  __atomic_store_n(&stats->throttled[a],
+                   __atomic_load_n(&stats->throttled[a], __ATOMIC_RELAXED) + 1,
+                   __ATOMIC_RELAXED);
+}
+
+char* stats_report(const ServerStats* stats, size_t* length) {
+  WorkerStats* merged = malloc(sizeof(WorkerStats));
+  memset(merged->codes, 0, sizeof(merged->codes));
+  memset(merged->throttled, 0, sizeof(merged->throttled));
+  for (size_t a = 0; a < STATS_N_ACTIONS; a++) {
+    histogram_init(&merged->queue_wait[a]);
+    histogram_init(&merged->handler[a]);
+    histogram_init(&merged->write[a]);
+    for (size_t i = 0; i < stats->n_workers; i++) {
+      const WorkerStats* worker = &stats->workers[i];
+      histogram_merge(&merged->queue_wait[a], &worker->queue_wait[a]);
+      histogram_merge(&merged->handler[a], &worker->handler[a]);
+      histogram_merge(&merged->write[a], &worker->write[a]);
+      for (size_t c = 0; c < STATS_N_CODES; c++) {
+        merged->codes[a][c] +=
+            __atomic_load_n(&worker->codes[a][c], __ATOMIC_RELAXED);
+      }
+      merged->throttled[a] +=
+          __atomic_load_n(&worker->throttled[a], __ATOMIC_RELAXED);
+    }
+  }
+
+  char* report = nullptr;
+  FILE* out = open_memstream(&report, length);
+  double us_per_tick = stats->ns_per_tick / 1e3;
+
+  fprintf(out, "%-15s %10s %9s %9s %9s %9s %9s %9s %9s\n", "action",
+          "requests", "wait p50", "wait p99", "hdl p50", "hdl p99", "hdl max",
+          "wr p50", "wr p99");
+  for (size_t a = 0; a < STATS_N_ACTIONS; a++) {
+    const Histogram* handler = &merged->handler[a];
+    if (handler->total == 0)
+      continue;
+    fprintf(out, "%-15s %10lu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+            action_names[a], handler->total,
+            histogram_percentile(&merged->queue_wait[a], 50.0) * us_per_tick,
+            histogram_percentile(&merged->queue_wait[a], 99.0) * us_per_tick,
+            histogram_percentile(handler, 50.0) * us_per_tick,
+            histogram_percentile(handler, 99.0) * us_per_tick,
+            handler->max * us_per_tick,
+            histogram_percentile(&merged->write[a], 50.0) * us_per_tick,
+            histogram_percentile(&merged->write[a], 99.0) * us_per_tick);
+  }
+  fprintf(out, "(latencies in us)\n");
+
+  for (size_t a = 0; a < STATS_N_ACTIONS; a++) {
+    if (merged->handler[a].total == 0 && merged->throttled[a] == 0)
+      continue;
+    fprintf(out, "%s:", action_names[a]);
+    for (size_t c = 0; c < STATS_N_CODES; c++) {
+      if (merged->codes[a][c] == 0)
+        continue;
+      if (c == STATS_N_CODES - 1)
+        fprintf(out, " other=%lu", merged->codes[a][c]);
+      else if (code_names[a][c] != nullptr)
+        fprintf(out, " %s=%lu", code_names[a][c], merged->codes[a][c]);
+      else
+        fprintf(out, " %zu=%lu", c, merged->codes[a][c]);
+    }
+    if (merged->throttled[a] > 0)
+      fprintf(out, " throttled=%lu", merged->throttled[a]);
+    fprintf(out, "\n");
+  }
+
+  fclose(out);
+  free(merged);
+  return report;
+}
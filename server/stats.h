@@ -0,0 +1,57 @@
+#ifndef SERVER_STATS_H
+#define SERVER_STATS_H
+#include <helper.h>
+#include <histogram.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Slot 0 collects requests with an unknown action
+#define STATS_N_ACTIONS (ACTION_RESUME + 2)
+// Response codes are small per-action enums; the last slot collects the rest
+#define STATS_N_CODES 8
+
+// Written only by the owning worker, read by whoever builds a report
+typedef struct {
+  Histogram queue_wait[STATS_N_ACTIONS];
+  Histogram handler[STATS_N_ACTIONS];
+  Histogram write[STATS_N_ACTIONS];
+  uint64_t codes[STATS_N_ACTIONS][STATS_N_CODES];
+  uint64_t throttled[STATS_N_ACTIONS];  // refused before being handled
+} WorkerStats;
+
+typedef struct {
+  WorkerStats* workers;
+  size_t n_workers;
+  double ns_per_tick;
+} ServerStats;
+
+// Timestamps are raw TSC ticks where available, since clock_gettime alone
+// costs more than the per-request budget; reports convert them to ns
+static inline uint64_t stats_now() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return monotonic_ns();
+#endif
+}
+
+void stats_init(ServerStats* stats, size_t n_workers);
+void stats_free(ServerStats* stats);
+
+// ready: request fully read; picked: the scheduler picked it; handled:
+// handler returned; written: response written. Queue wait is ready..picked,
+// i.e. the time spent in the scheduler behind other requests.
+void stats_record(WorkerStats* stats,
+                  Action action,
+                  int32_t code,
+                  uint64_t ready,
+                  uint64_t picked,
+                  uint64_t handled,
+                  uint64_t written);
+
+void stats_record_throttled(WorkerStats* stats, Action action);
+
+// Merges every worker and formats a text report, *length excludes the NUL
+char* stats_report(const ServerStats* stats, size_t* length);
+#endif
@@ -0,0 +1,290 @@
+#include "users.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include "helper.h"
+
+uint32_t resume_ttl_s = DEFAULT_RESUME_TTL_S;
+
+void setup_users(Users* users) {
+  memset(users, 0, sizeof(Users));
+  pthread_mutex_init(&users->mutex, nullptr);
+  for (size_t i = 0; i < USER_LOCK_STRIPES; i++)
+    pthread_mutex_init(&users->login_locks[i], nullptr);
+}
+
+void free_users(Users* users) {
+  for (size_t i = 0; i * USERS_PER_CHUNK < users->size; i++) {
+    free(users->chunks[i]);
+    free(users->passwords[i]);
+    free(users->tokens[i]);
+  }
+  for (size_t i = 0; i < users->names.n_chunks; i++)
+    free(users->names.chunks[i]);
+  while (users->index != nullptr) {
+    UserIndex* retired = users->index->retired;
+    free(users->index);
+    users->index = retired;
+  }
+  pthread_mutex_destroy(&users->mutex);
+  for (size_t i = 0; i < USER_LOCK_STRIPES; i++)
+    pthread_mutex_destroy(&users->login_locks[i]);
+}
+
+// FNV-1a
+static uint64_t hash_name(const char* name) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (; *name != '\0'; name++)
+    hash = (hash ^ (uint8_t)*name) * 1099511628211ULL;
+  return hash;
+}
+
+ssize_t find_user(const Users* users, const char* username) {
+  const UserIndex* index = __atomic_load_n(&users->index, __ATOMIC_ACQUIRE);
+  if (index == nullptr)
+    return -1;
+  uint64_t hash = hash_name(username);
+  for (size_t i = hash & index->mask;; i = (i + 1) & index->mask) {
+    uint64_t slot = __atomic_load_n(&index->slots[i], __ATOMIC_ACQUIRE);
+    if (slot == 0)
+      return -1;
+    if (slot >> 32 != hash >> 32)
+      continue;
+    size_t uid = (uint32_t)slot - 1;
+    if (strcmp(user_name(users, user_at(users, uid)), username) == 0)
+      return uid;
+  }
+}
+
+static void index_insert(UserIndex* index, size_t uid, uint64_t hash) {
+  size_t i = hash & index->mask;
+  while (index->slots[i] != 0)
+    i = (i + 1) & index->mask;
+  // Published last, so a reader that finds the slot finds the user
+  __atomic_store_n(&index->slots[i], (hash >> 32 << 32) | (uid + 1),
+                   __ATOMIC_RELEASE);
+}
+
+// Readers may still be probing the old table, so it is kept until
+// free_users; together the retired ones are smaller than the live one
+static void grow_index(Users* users) {
+  size_t n_slots = users->index == nullptr ? USER_INDEX_MIN_SLOTS
+                                           : 2 * (users->index->mask + 1);
+  UserIndex* index = calloc(1, sizeof(UserIndex) + n_slots * sizeof(uint64_t));
+  if (index == nullptr) {
+    perror("calloc failed");
+    exit(EXIT_FAILURE);
+  }
+  index->mask = n_slots - 1;
+  index->retired = users->index;
+  for (size_t uid = 0; uid < users->size; uid++)
+    index_insert(index, uid,
+                 hash_name(user_name(users, user_at(users, uid))));
+  __atomic_store_n(&users->index, index, __ATOMIC_RELEASE);
+}
+
+static uint64_t append_name(NameArena* arena, const char* name) {
+  size_t length = strlen(name) + 1;
+  if (arena->n_chunks == 0 || arena->used + length > NAME_ARENA_CHUNK_SIZE) {
+    if (arena->n_chunks == NAME_ARENA_MAX_CHUNKS) {
+      fprintf(stderr, "Name arena is full\n");
+      exit(EXIT_FAILURE);
+    }
+    // Pages are only backed once names reach them
+    arena->chunks[arena->n_chunks] = malloc(NAME_ARENA_CHUNK_SIZE);
+    if (arena->chunks[arena->n_chunks] == nullptr) {
+      perror("malloc failed");
+      exit(EXIT_FAILURE);
+    }
+    arena->n_chunks++;
+    arena->used = 0;
+  }
+  uint64_t offset =
+      (uint64_t)(arena->n_chunks - 1) * NAME_ARENA_CHUNK_SIZE + arena->used;
+  memcpy(arena->chunks[arena->n_chunks - 1] + arena->used, name, length);
+  arena->used += length;
+  return offset;
+}
+
+ssize_t add_user(Users* users,
+                 const char* username,
+                 const PasswordRecord* password) {
+  pthread_mutex_lock(&users->mutex);
+  // Two logins of a new name may both have missed it
+  if (find_user(users, username) >= 0) {
+    pthread_mutex_unlock(&users->mutex);
+    return -1;
+  }
+  size_t uid = users->size;
+  size_t chunk = uid / USERS_PER_CHUNK;
+  if (uid % USERS_PER_CHUNK == 0) {
+    if (chunk == USERS_MAX_CHUNKS) {
+      fprintf(stderr, "User table is full\n");
+      exit(EXIT_FAILURE);
+    }
+    users->chunks[chunk] = malloc(USERS_PER_CHUNK * sizeof(User));
+    users->passwords[chunk] =
+        malloc(USERS_PER_CHUNK * sizeof(PasswordRecord));
+    users->tokens[chunk] = malloc(USERS_PER_CHUNK * sizeof(ResumeToken));
+    if (users->chunks[chunk] == nullptr ||
+        users->passwords[chunk] == nullptr ||
+        users->tokens[chunk] == nullptr) {
+      perror("malloc failed");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  *user_at(users, uid) = (User){.name = append_name(&users->names, username),
+                                .connection_id = 0,
+                                .session = 0,
+                                .logged_in = false};
+  *user_password(users, uid) = *password;
+  *user_token(users, uid) = (ResumeToken){.expires_ns = 0};
+  if (users->index == nullptr || 2 * (uid + 1) > users->index->mask + 1)
+    grow_index(users);
+  index_insert(users->index, uid, hash_name(username));
+  __atomic_store_n(&users->size, uid + 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&users->mutex);
+  return uid;
+}
+
+// getrandom() costs a syscall, so each worker draws secrets 256 bytes at
+// a time, the most it always returns in full, and hands each out once
+#define SECRET_POOL_SIZE 256
+static _Thread_local uint8_t secret_pool[SECRET_POOL_SIZE];
+static _Thread_local size_t secret_pool_used = SECRET_POOL_SIZE;
+
+static void draw_secret(uint8_t* secret) {
+  if (secret_pool_used + RESUME_TOKEN_SIZE > SECRET_POOL_SIZE) {
+    if (getrandom(secret_pool, SECRET_POOL_SIZE, 0) != SECRET_POOL_SIZE) {
+      perror("getrandom");
+      exit(EXIT_FAILURE);
+    }
+    secret_pool_used = 0;
+  }
+  memcpy(secret, secret_pool + secret_pool_used, RESUME_TOKEN_SIZE);
+  memset(secret_pool + secret_pool_used, 0, RESUME_TOKEN_SIZE);
+  secret_pool_used += RESUME_TOKEN_SIZE;
+}
+
+static pthread_mutex_t* login_lock(Users* users, size_t uid) {
+  return &users->login_locks[uid % USER_LOCK_STRIPES];
+}
+
+void copy_password(Users* users, size_t uid, PasswordRecord* password) {
+  pthread_mutex_t* lock = login_lock(users, uid);
+  pthread_mutex_lock(lock);
+  *password = *user_password(users, uid);
+  pthread_mutex_unlock(lock);
+}
+
+void store_password(Users* users, size_t uid, const PasswordRecord* password) {
+  pthread_mutex_t* lock = login_lock(users, uid);
+  pthread_mutex_lock(lock);
+  *user_password(users, uid) = *password;
+  pthread_mutex_unlock(lock);
+}
+
+static void encode_token(const uint8_t* secret, char* token) {
+  static const char digits[] = "0123456789abcdef";
+  for (size_t i = 0; i < RESUME_TOKEN_SIZE; i++) {
+    token[2 * i] = digits[secret[i] >> 4];
+    token[2 * i + 1] = digits[secret[i] & 0xf];
+  }
+}
+
+// False unless token is RESUME_TOKEN_LENGTH lowercase hex digits
+static bool decode_token(const char* token, size_t length, uint8_t* secret) {
+  if (length != RESUME_TOKEN_LENGTH)
+    return false;
+  for (size_t i = 0; i < RESUME_TOKEN_LENGTH; i++) {
+    uint8_t digit;
+    if (token[i] >= '0' && token[i] <= '9')
+      digit = token[i] - '0';
+    else if (token[i] >= 'a' && token[i] <= 'f')
+      digit = token[i] - 'a' + 10;
+    else
+      return false;
+    secret[i / 2] = i % 2 == 0 ? digit << 4 : secret[i / 2] | digit;
+  }
+  return true;
+}
+
+bool log_in_user(Users* users,
+                 size_t uid,
+                 uint64_t connection_id,
+                 char* token) {
+  // Drawn before the lock, so a refill does not hold up the stripe
+  uint8_t secret[RESUME_TOKEN_SIZE];
+  if (resume_ttl_s > 0)
+    draw_secret(secret);
+
+  User* user = user_at(users, uid);
+  pthread_mutex_t* lock = login_lock(users, uid);
+  pthread_mutex_lock(lock);
+  // Two logins may both get past the password check; only the first one
+  // to get here logs in
+  if (user->logged_in) {
+    pthread_mutex_unlock(lock);
+    return false;
+  }
+  user->connection_id = connection_id;
+  __atomic_store_n(&user->session, user->session + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&user->logged_in, true, __ATOMIC_RELEASE);
+  if (resume_ttl_s > 0) {
+    ResumeToken* resume = user_token(users, uid);
+    memcpy(resume->secret, secret, RESUME_TOKEN_SIZE);
+    resume->expires_ns = monotonic_ns() + resume_ttl_s * 1'000'000'000ULL;
+    encode_token(secret, token);
+  }
+  pthread_mutex_unlock(lock);
+  return true;
+}
+
+bool log_out_user(Users* users, size_t uid) {
+  pthread_mutex_t* lock = login_lock(users, uid);
+  pthread_mutex_lock(lock);
+  bool logged_in = __atomic_exchange_n(&user_at(users, uid)->logged_in,
+                                       false, __ATOMIC_ACQ_REL);
+  user_token(users, uid)->expires_ns = 0;
+  pthread_mutex_unlock(lock);
+  return logged_in;
+}
+
+ResumeErrorCode resume_user(Users* users,
+                            size_t uid,
+                            const char* token,
+                            size_t length,
+                            uint64_t connection_id) {
+  uint8_t secret[RESUME_TOKEN_SIZE];
+  if (!decode_token(token, length, secret))
+    return RESUME_ERROR_INVALID_TOKEN;
+
+  User* user = user_at(users, uid);
+  ResumeToken* resume = user_token(users, uid);
+  pthread_mutex_t* lock = login_lock(users, uid);
+  pthread_mutex_lock(lock);
+  ResumeErrorCode code = RESUME_ERROR_SUCCESS;
+  if (!constant_time_equal(secret, resume->secret, RESUME_TOKEN_SIZE) ||
+      resume->expires_ns == 0) {
+    code = RESUME_ERROR_INVALID_TOKEN;
+  } else if (monotonic_ns() >= resume->expires_ns) {
+    code = RESUME_ERROR_EXPIRED;
+  } else {
+    user->connection_id = connection_id;
+    __atomic_store_n(&user->session, user->session + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&user->logged_in, true, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(lock);
+  return code;
+}
+
+void reap_user(Users* users, size_t uid, uint64_t connection_id) {
+  User* user = user_at(users, uid);
+  pthread_mutex_t* lock = login_lock(users, uid);
+  pthread_mutex_lock(lock);
+  if (user->logged_in && user->connection_id == connection_id)
+    __atomic_store_n(&user->logged_in, false, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(lock);
+}
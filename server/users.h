@@ -0,0 +1,118 @@
+#ifndef SERVER_USERS_H
+#define SERVER_USERS_H
+#include <helper.h>
+#include <pthread.h>
+#include "hash_params.h"
+
+// Users are stored in chunks allocated as the table grows, their names in
+// an append-only arena and their passwords as fixed-size records beside
+// them, so adding a user allocates nothing of its own and nothing ever
+// moves: workers look users up without a lock while another adds one.
+#define USERS_PER_CHUNK 4096
+#define USERS_MAX_CHUNKS 4096
+// Big enough for any name a request can carry
+#define NAME_ARENA_CHUNK_SIZE (2 * MAX_REQUEST_FIELD_SIZE)
+#define NAME_ARENA_MAX_CHUNKS 2048
+#define USER_INDEX_MIN_SLOTS 1024
+// Logins, logouts and resumes of a user take the lock of its stripe
+#define USER_LOCK_STRIPES 64
+#define RESUME_TOKEN_SIZE (RESUME_TOKEN_LENGTH / 2)
+#define DEFAULT_RESUME_TTL_S 1800
+
+typedef ssize_t pa3_uid_t;
+
+typedef struct {
+  uint64_t name;  // offset of its NUL-terminated name in the arena
+  uint64_t connection_id;  // of the last login, to log out if it is reaped
+  uint64_t session;        // bumped by every login and resume
+  bool logged_in;
+} User;
+
+// Lets a client that lost its connection log back in without the
+// password, and so without argon2, until it expires or the user logs out.
+// Kept in memory only: a restarted server knows none of them.
+typedef struct {
+  uint8_t secret[RESUME_TOKEN_SIZE];
+  uint64_t expires_ns;  // monotonic_ns(); 0 when there is none
+} ResumeToken;
+
+typedef struct {
+  char* chunks[NAME_ARENA_MAX_CHUNKS];
+  size_t n_chunks;
+  size_t used;  // bytes of the last chunk
+} NameArena;
+
+// Open addressing, at most half full. A slot holds uid + 1 (0 when empty)
+// and the top half of the name's hash, so probes rarely compare names.
+typedef struct UserIndex {
+  size_t mask;
+  struct UserIndex* retired;  // outgrown, but readers may still probe it
+  uint64_t slots[];
+} UserIndex;
+
+typedef struct {
+  User* chunks[USERS_MAX_CHUNKS];
+  PasswordRecord* passwords[USERS_MAX_CHUNKS];
+  ResumeToken* tokens[USERS_MAX_CHUNKS];
+  size_t size;
+  NameArena names;
+  UserIndex* index;
+  pthread_mutex_t mutex;  // taken by add_user only
+  pthread_mutex_t login_locks[USER_LOCK_STRIPES];
+} Users;
+
+// Lifetime of new resume tokens; 0 issues none. Set from the command line
+// before the workers start.
+extern uint32_t resume_ttl_s;
+
+static inline User* user_at(const Users* users, size_t uid) {
+  return &users->chunks[uid / USERS_PER_CHUNK][uid % USERS_PER_CHUNK];
+}
+
+static inline PasswordRecord* user_password(const Users* users, size_t uid) {
+  return &users->passwords[uid / USERS_PER_CHUNK][uid % USERS_PER_CHUNK];
+}
+
+static inline ResumeToken* user_token(const Users* users, size_t uid) {
+  return &users->tokens[uid / USERS_PER_CHUNK][uid % USERS_PER_CHUNK];
+}
+
+static inline const char* user_name(const Users* users, const User* user) {
+  return users->names.chunks[user->name / NAME_ARENA_CHUNK_SIZE] +
+         user->name % NAME_ARENA_CHUNK_SIZE;
+}
+
+// Allocates nothing until the first user is added
+void setup_users(Users* users);
+void free_users(Users* users);
+ssize_t find_user(const Users* users, const char* username);
+// -1 if the name is taken
+ssize_t add_user(Users* users,
+                 const char* username,
+                 const PasswordRecord* password);
+
+// A rehash on login rewrites the record while other logins read it, so
+// both go through the user's login lock
+void copy_password(Users* users, size_t uid, PasswordRecord* password);
+void store_password(Users* users, size_t uid, const PasswordRecord* password);
+
+// Logs in a user whose password checked out, through connection_id, and
+// unless resume_ttl_s is 0 writes a new resume token to token as
+// RESUME_TOKEN_LENGTH hex characters. False if it is logged in already.
+bool log_in_user(Users* users,
+                 size_t uid,
+                 uint64_t connection_id,
+                 char* token);
+// False if it was not logged in; its resume token is revoked either way
+bool log_out_user(Users* users, size_t uid);
+// Logs in a user through connection_id if token is its resume token, and
+// moves it there from any connection it is still logged in through
+ResumeErrorCode resume_user(Users* users,
+                            size_t uid,
+                            const char* token,
+                            size_t length,
+                            uint64_t connection_id);
+// Logs out a user whose connection was closed for idling, unless it has
+// logged in through another one since; its resume token stays good
+void reap_user(Users* users, size_t uid, uint64_t connection_id);
+#endif
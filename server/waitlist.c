@@ -0,0 +1,266 @@
+#include "waitlist.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void waitlist_init(Waitlist* waitlist, size_t n_seats, size_t n_workers) {
+  pthread_mutex_init(&waitlist->mutex, nullptr);
+  waitlist->queues = malloc(sizeof(WaitNode) * n_seats);
+  waitlist->waiting = calloc(n_seats, sizeof(size_t));
+  for (size_t i = 0; i < n_seats; i++)
+    waitlist->queues[i] =
+        (WaitNode){nullptr, &waitlist->queues[i], &waitlist->queues[i]};
+  waitlist->n_seats = n_seats;
+  waitlist->inboxes = calloc(n_workers, sizeof(NoticeInbox));
+  for (size_t i = 0; i < n_workers; i++)
+    waitlist->inboxes[i].wake_fd = -1;
+  waitlist->n_inboxes = n_workers;
+}
+
+static void free_ticket(WaitTicket* ticket) {
+  free(ticket->username);
+  free(ticket->nodes);
+  free(ticket);
+}
+
+// Takes a waiting ticket off the queue of every seat it covers
+static void unqueue(Waitlist* waitlist, WaitTicket* ticket) {
+  for (pa3_seat_t seat = ticket->first; seat <= ticket->last; seat++) {
+    WaitNode* node = &ticket->nodes[seat - ticket->first];
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    __atomic_store_n(&waitlist->waiting[seat - 1],
+                     waitlist->waiting[seat - 1] - 1, __ATOMIC_RELAXED);
+  }
+}
+
+static void unlink_from_waiter(WaitTicket* ticket) {
+  Waiter* waiter = ticket->waiter;
+  WaitTicket** link = &waiter->tickets;
+  while (*link != ticket)
+    link = &(*link)->next_of_waiter;
+  *link = ticket->next_of_waiter;
+  waiter->n_tickets--;
+}
+
+void waitlist_free(Waitlist* waitlist) {
+  // Connections are gone by now, so no ticket's waiter is looked at
+  for (size_t i = 0; i < waitlist->n_seats; i++) {
+    WaitNode* head = &waitlist->queues[i];
+    while (head->next != head) {
+      WaitTicket* ticket = head->next->ticket;
+      unqueue(waitlist, ticket);
+      free_ticket(ticket);
+    }
+  }
+  for (size_t i = 0; i < waitlist->n_inboxes; i++) {
+    WaitTicket* ticket = waitlist->inboxes[i].head;
+    while (ticket != nullptr) {
+      WaitTicket* next = ticket->next_notice;
+      free_ticket(ticket);
+      ticket = next;
+    }
+  }
+  pthread_mutex_destroy(&waitlist->mutex);
+  free(waitlist->queues);
+  free(waitlist->waiting);
+  free(waitlist->inboxes);
+}
+
+bool parse_waitlist_range(const char* text,
+                          size_t n_seats,
+                          pa3_seat_t* first,
+                          pa3_seat_t* last) {
+  char* end;
+  long from = strtol(text, &end, 10);
+  long to = from;
+  if (*end == '-' && end != text)
+    to = strtol(end + 1, &end, 10);
+  if (*end != '\0' || from < 1 || to < from || (size_t)to > n_seats)
+    return false;
+  *first = from;
+  *last = to;
+  return true;
+}
+
+WaitTicket* waitlist_enqueue(Waitlist* waitlist,
+                             Waiter* waiter,
+                             const User* user,
+                             const char* username,
+                             pa3_seat_t first,
+                             pa3_seat_t last) {
+  if (waiter->n_tickets >= WAITLIST_MAX_TICKETS)
+    return nullptr;
+  WaitTicket* ticket = malloc(sizeof(WaitTicket));
+  WaitNode* nodes = malloc(sizeof(WaitNode) * (last - first + 1));
+  if (ticket == nullptr || nodes == nullptr) {
+    perror("malloc failed");
+    exit(EXIT_FAILURE);
+  }
+  *ticket = (WaitTicket){.username = strdup(username),
+                         .waiter = waiter,
+                         .user = user,
+                         .session = __atomic_load_n(&user->session,
+                                                    __ATOMIC_RELAXED),
+                         .first = first,
+                         .last = last,
+                         .nodes = nodes,
+                         .next_of_waiter = waiter->tickets};
+
+  pthread_mutex_lock(&waitlist->mutex);
+  for (pa3_seat_t seat = first; seat <= last; seat++) {
+    WaitNode* head = &waitlist->queues[seat - 1];
+    WaitNode* node = &nodes[seat - first];
+    *node = (WaitNode){ticket, head->prev, head};
+    head->prev->next = node;
+    head->prev = node;
+    __atomic_store_n(&waitlist->waiting[seat - 1],
+                     waitlist->waiting[seat - 1] + 1, __ATOMIC_RELAXED);
+  }
+  waiter->tickets = ticket;
+  waiter->n_tickets++;
+  pthread_mutex_unlock(&waitlist->mutex);
+  return ticket;
+}
+
+bool waitlist_claim(Waitlist* waitlist, WaitTicket* ticket) {
+  pthread_mutex_lock(&waitlist->mutex);
+  bool waiting = ticket->assigned == 0;
+  if (waiting) {
+    unqueue(waitlist, ticket);
+    unlink_from_waiter(ticket);
+  }
+  pthread_mutex_unlock(&waitlist->mutex);
+  if (waiting)
+    free_ticket(ticket);
+  return waiting;
+}
+
+// Logging out, or in again through any connection, ends the session a
+// ticket was queued under; it stays queued until its connection drops it
+// but is never granted
+static bool ticket_live(const WaitTicket* ticket, const char* holder) {
+  const User* user = ticket->user;
+  return __atomic_load_n(&user->logged_in, __ATOMIC_ACQUIRE) &&
+         __atomic_load_n(&user->session, __ATOMIC_RELAXED) ==
+             ticket->session &&
+         (holder == nullptr || strcmp(ticket->username, holder) != 0);
+}
+
+char* waitlist_grant(Waitlist* waitlist, pa3_seat_t seat, const char* holder) {
+  // A ticket is queued before its owner looks at the seats, and this is
+  // called with the seat locked, so one queued too late for this check
+  // still finds the seat free
+  if (__atomic_load_n(&waitlist->waiting[seat - 1], __ATOMIC_RELAXED) == 0)
+    return nullptr;
+
+  pthread_mutex_lock(&waitlist->mutex);
+  WaitNode* head = &waitlist->queues[seat - 1];
+  WaitNode* node = head->next;
+  while (node != head && !ticket_live(node->ticket, holder))
+    node = node->next;
+  if (node == head) {
+    pthread_mutex_unlock(&waitlist->mutex);
+    return nullptr;
+  }
+  WaitTicket* ticket = node->ticket;
+  unqueue(waitlist, ticket);
+  ticket->assigned = seat;
+  char* username = ticket->username;
+  ticket->username = nullptr;
+
+  // A connection between two workers has no inbox; the one taking it
+  // over queues the notice
+  int32_t wake_fd = -1;
+  NoticeInbox* inbox = ticket->waiter->inbox;
+  if (inbox != nullptr) {
+    ticket->next_notice = inbox->head;
+    inbox->head = ticket;
+    wake_fd = inbox->wake_fd;
+  }
+  pthread_mutex_unlock(&waitlist->mutex);
+
+  uint64_t one = 1;
+  if (wake_fd >= 0 && write(wake_fd, &one, sizeof(one)) < 0)
+    perror("write notification");
+  return username;
+}
+
+void waitlist_drop(Waitlist* waitlist, Waiter* waiter) {
+  // Only the worker serving the connection adds or removes its tickets
+  if (waiter->tickets == nullptr)
+    return;
+  pthread_mutex_lock(&waitlist->mutex);
+  WaitTicket* ticket = waiter->tickets;
+  while (ticket != nullptr) {
+    WaitTicket* next = ticket->next_of_waiter;
+    if (ticket->assigned == 0) {
+      unqueue(waitlist, ticket);
+      free_ticket(ticket);
+    } else if (waiter->inbox == nullptr) {
+      free_ticket(ticket);  // detached, so in no inbox
+    } else {
+      ticket->waiter = nullptr;  // freed by whoever takes the inbox
+    }
+    ticket = next;
+  }
+  waiter->tickets = nullptr;
+  waiter->n_tickets = 0;
+  pthread_mutex_unlock(&waitlist->mutex);
+}
+
+void waitlist_detach(Waitlist* waitlist, Waiter* waiter) {
+  pthread_mutex_lock(&waitlist->mutex);
+  NoticeInbox* inbox = waiter->inbox;
+  if (inbox != nullptr && waiter->tickets != nullptr) {
+    WaitTicket** link = &inbox->head;
+    while (*link != nullptr) {
+      if ((*link)->waiter == waiter)
+        *link = (*link)->next_notice;
+      else
+        link = &(*link)->next_notice;
+    }
+  }
+  waiter->inbox = nullptr;
+  pthread_mutex_unlock(&waitlist->mutex);
+}
+
+void waitlist_adopt(Waitlist* waitlist, Waiter* waiter, size_t worker) {
+  NoticeInbox* inbox = &waitlist->inboxes[worker];
+  pthread_mutex_lock(&waitlist->mutex);
+  waiter->inbox = inbox;
+  for (WaitTicket* ticket = waiter->tickets; ticket != nullptr;
+       ticket = ticket->next_of_waiter) {
+    if (ticket->assigned != 0) {
+      ticket->next_notice = inbox->head;
+      inbox->head = ticket;
+    }
+  }
+  pthread_mutex_unlock(&waitlist->mutex);
+}
+
+WaitTicket* waitlist_take_notices(Waitlist* waitlist, size_t worker) {
+  NoticeInbox* inbox = &waitlist->inboxes[worker];
+  pthread_mutex_lock(&waitlist->mutex);
+  WaitTicket* notices = nullptr;
+  WaitTicket* ticket = inbox->head;
+  inbox->head = nullptr;
+  while (ticket != nullptr) {
+    WaitTicket* next = ticket->next_notice;
+    if (ticket->waiter == nullptr) {
+      free_ticket(ticket);
+    } else {
+      unlink_from_waiter(ticket);
+      ticket->next_notice = notices;
+      notices = ticket;
+    }
+    ticket = next;
+  }
+  pthread_mutex_unlock(&waitlist->mutex);
+  return notices;
+}
+
+void waitlist_release(WaitTicket* ticket) {
+  free_ticket(ticket);
+}
@@ -0,0 +1,109 @@
+#ifndef SERVER_WAITLIST_H
+#define SERVER_WAITLIST_H
+#include <helper.h>
+#include <pthread.h>
+#include "users.h"
+
+// Instead of retrying a taken seat, a user can queue for it or for any
+// seat of a section ("<first>-<last>"). Cancelling a seat hands it
+// straight to the oldest ticket waiting on it, so it is never free while
+// someone waits, and the worker serving the winner's connection sends it
+// a WAITLIST_NOTICE_SEAT_ASSIGNED frame. A ticket lapses with the login it
+// was queued under, whichever connection ends it.
+
+// Tickets one connection may hold at once, assigned ones not yet
+// announced included
+#define WAITLIST_MAX_TICKETS 16
+
+struct WaitTicket;
+
+// One per seat a ticket covers, linked into that seat's queue
+typedef struct WaitNode {
+  struct WaitTicket* ticket;
+  struct WaitNode* prev;
+  struct WaitNode* next;
+} WaitNode;
+
+// Assigned tickets whose notice the worker still has to send
+typedef struct {
+  struct WaitTicket* head;
+  int32_t wake_fd;  // of that worker
+} NoticeInbox;
+
+// Embedded in a Connection; only the worker serving it changes inbox
+typedef struct {
+  struct WaitTicket* tickets;
+  size_t n_tickets;
+  NoticeInbox* inbox;
+} Waiter;
+
+typedef struct WaitTicket {
+  char* username;   // moves to the seat when it is assigned
+  Waiter* waiter;   // nullptr once the connection has gone
+  const User* user;
+  uint64_t session;  // of user when queued; grants skip it once changed
+  pa3_seat_t first;
+  pa3_seat_t last;
+  pa3_seat_t assigned;  // 0 while waiting
+  WaitNode* nodes;      // one per seat from first to last
+  struct WaitTicket* next_of_waiter;
+  struct WaitTicket* next_notice;
+} WaitTicket;
+
+// Every queue, ticket and inbox is guarded by mutex. It is taken with a
+// seat mutex held, never the other way round, and only by requests that
+// involve a waitlist: waiting[] lets cancels of seats nobody waits for
+// skip it.
+typedef struct {
+  pthread_mutex_t mutex;
+  WaitNode* queues;  // list heads per seat, oldest ticket first
+  size_t* waiting;
+  size_t n_seats;
+  NoticeInbox* inboxes;  // one per worker
+  size_t n_inboxes;
+} Waitlist;
+
+// Inboxes start without a wake_fd, which the caller sets per worker
+void waitlist_init(Waitlist* waitlist, size_t n_seats, size_t n_workers);
+void waitlist_free(Waitlist* waitlist);
+
+// Parses "<seat>" or "<first>-<last>", seats counted from 1
+bool parse_waitlist_range(const char* text,
+                          size_t n_seats,
+                          pa3_seat_t* first,
+                          pa3_seat_t* last);
+
+// Queues a ticket of waiter for the seats first..last; nullptr when the
+// waiter holds WAITLIST_MAX_TICKETS already
+WaitTicket* waitlist_enqueue(Waitlist* waitlist,
+                             Waiter* waiter,
+                             const User* user,
+                             const char* username,
+                             pa3_seat_t first,
+                             pa3_seat_t last);
+
+// Called with the mutex of a free seat held: takes the ticket back and
+// returns true unless a cancellation assigned it a seat meanwhile
+bool waitlist_claim(Waitlist* waitlist, WaitTicket* ticket);
+
+// Called by a cancellation with the mutex of seat held. Assigns it to the
+// oldest ticket waiting on it whose session is current and which is not
+// holder's, and returns that user's name, which the seat takes over;
+// nullptr if nobody such waits.
+char* waitlist_grant(Waitlist* waitlist, pa3_seat_t seat, const char* holder);
+
+// Drops every ticket of waiter; notices it has not been sent are dropped
+// when the worker gets to them
+void waitlist_drop(Waitlist* waitlist, Waiter* waiter);
+
+// A connection moving to another worker is detached before it leaves and
+// adopted by the worker taking it, new ones too. Notices due meanwhile
+// wait on the ticket and are queued for the new worker on adoption.
+void waitlist_detach(Waitlist* waitlist, Waiter* waiter);
+void waitlist_adopt(Waitlist* waitlist, Waiter* waiter, size_t worker);
+
+// Takes the notices queued for worker, chained through next_notice. The
+// caller sends them and passes each to waitlist_release.
+WaitTicket* waitlist_take_notices(Waitlist* waitlist, size_t worker);
+void waitlist_release(WaitTicket* ticket);
+#endif
@@ -0,0 +1,358 @@
+#include "model.h"
+#include <stdlib.h>
+#include <string.h>
+
+// A history this hard to order is reported rather than searched forever
+#define MODEL_MAX_EXPLORED 20'000'000
+
+bool model_states_equal(const ModelState* a, const ModelState* b) {
+  return a->exists == b->exists && a->logged_in == b->logged_in &&
+         a->owner == b->owner && a->booked == b->booked &&
+         a->canceled == b->canceled;
+}
+
+bool model_step(const Op* op, ModelState* state) {
+  switch (op->kind) {
+    case OP_LOGIN:
+      if (op->code == LOGIN_ERROR_ACTIVE_USER)
+        return state->logged_in;
+      if (op->code != LOGIN_ERROR_SUCCESS || state->logged_in)
+        return false;
+      state->exists = true;
+      state->logged_in = true;
+      return true;
+    case OP_LOGIN_WRONG:
+      if (op->code == LOGIN_ERROR_ACTIVE_USER)
+        return state->logged_in;
+      return op->code == LOGIN_ERROR_INCORRECT_PASSWORD && state->exists &&
+             !state->logged_in;
+    case OP_LOGOUT:
+      if (op->code == LOGOUT_ERROR_USER_NOT_FOUND)
+        return !state->exists;
+      if (op->code == LOGOUT_ERROR_USER_NOT_LOGGED_IN)
+        return state->exists && !state->logged_in;
+      if (op->code != LOGOUT_ERROR_SUCCESS || !state->logged_in)
+        return false;
+      state->logged_in = false;
+      return true;
+    case OP_LOGGED_IN:
+      return op->flag == state->logged_in;
+    case OP_BOOK:
+      if (op->code == BOOK_ERROR_SEAT_UNAVAILABLE)
+        return state->owner != SEAT_FREE;
+      if (op->code != BOOK_ERROR_SUCCESS || state->owner != SEAT_FREE)
+        return false;
+      state->owner = op->user;
+      state->booked++;
+      return true;
+    case OP_CANCEL:
+      if (op->code == CANCEL_BOOKING_ERROR_SEAT_NOT_BOOKED_BY_USER)
+        return state->owner != op->user;
+      if (op->code != CANCEL_BOOKING_ERROR_SUCCESS ||
+          state->owner != op->user)
+        return false;
+      state->owner = SEAT_FREE;
+      state->canceled++;
+      return true;
+    case OP_QUERY:
+      return op->flag == (state->owner == SEAT_FREE) &&
+             op->booked == state->booked && op->canceled == state->canceled;
+    case OP_IS_FREE:
+      return op->flag == (state->owner == SEAT_FREE);
+    case OP_IS_MINE:
+      return op->flag == (state->owner == op->user);
+  }
+  return false;
+}
+
+// Only successful logins, logouts, bookings and cancellations change
+// anything; every other answer is a read
+static bool op_mutates(const Op* op) {
+  switch (op->kind) {
+    case OP_LOGIN:
+      return op->code == LOGIN_ERROR_SUCCESS;
+    case OP_LOGOUT:
+      return op->code == LOGOUT_ERROR_SUCCESS;
+    case OP_BOOK:
+      return op->code == BOOK_ERROR_SUCCESS;
+    case OP_CANCEL:
+      return op->code == CANCEL_BOOKING_ERROR_SUCCESS;
+    default:
+      return false;
+  }
+}
+
+// A configuration is the state plus which operations are done. All of
+// them before lo are, and none from lo + window on, so the memo keeps the
+// bits in between.
+#define KEY_HEADER_WORDS 5  // hash, lo, packed flags and owner, counters
+
+typedef struct {
+  const Op* ops;
+  size_t n_ops;
+  uint64_t* done;      // one bit per operation
+  size_t lo;           // first operation not done
+  size_t n_done;
+  size_t window;       // operations a candidate can be ahead of lo
+  size_t window_words;
+  size_t key_words;
+  uint64_t* keys;      // key_words per configuration seen
+  size_t n_keys;
+  size_t keys_capacity;
+  size_t* table;       // key number + 1, 0 when empty
+  size_t table_mask;
+  size_t* reads;       // stack of reads taken greedily
+  size_t n_reads;
+  Linearization* result;
+  bool exhausted;
+} Search;
+
+static bool is_done(const Search* search, size_t i) {
+  return (search->done[i / 64] >> (i % 64)) & 1;
+}
+
+static void mark(Search* search, size_t i, bool done) {
+  if (done) {
+    search->done[i / 64] |= 1ULL << (i % 64);
+    search->n_done++;
+    while (search->lo < search->n_ops && is_done(search, search->lo))
+      search->lo++;
+  } else {
+    search->done[i / 64] &= ~(1ULL << (i % 64));
+    search->n_done--;
+    if (i < search->lo)
+      search->lo = i;
+  }
+}
+
+static void* checked_realloc(void* pointer, size_t size) {
+  pointer = realloc(pointer, size);
+  if (pointer == nullptr) {
+    perror("realloc failed");
+    exit(EXIT_FAILURE);
+  }
+  return pointer;
+}
+
+static uint64_t mix(uint64_t hash, uint64_t word) {
+  hash ^= word + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+  return hash * 0xff51afd7ed558ccdULL;
+}
+
+static void make_key(const Search* search,
+                     const ModelState* state,
+                     uint64_t* key) {
+  key[1] = search->lo;
+  key[2] = (uint64_t)(uint32_t)state->owner << 2 |
+           (uint64_t)state->logged_in << 1 | state->exists;
+  key[3] = state->booked;
+  key[4] = state->canceled;
+  // Bits lo .. lo + 64 * window_words, shifted down to start at bit 0
+  size_t word = search->lo / 64;
+  size_t shift = search->lo % 64;
+  size_t n_words = (search->n_ops + 63) / 64;
+  for (size_t i = 0; i < search->window_words; i++) {
+    uint64_t low = word + i < n_words ? search->done[word + i] : 0;
+    uint64_t high = word + i + 1 < n_words ? search->done[word + i + 1] : 0;
+    key[KEY_HEADER_WORDS + i] =
+        shift == 0 ? low : low >> shift | high << (64 - shift);
+  }
+  uint64_t hash = 0;
+  for (size_t i = 1; i < search->key_words; i++)
+    hash = mix(hash, key[i]);
+  key[0] = hash;
+}
+
+static void grow_table(Search* search) {
+  size_t n_slots = 2 * (search->table_mask + 1);
+  free(search->table);
+  search->table = calloc(n_slots, sizeof(size_t));
+  if (search->table == nullptr) {
+    perror("calloc failed");
+    exit(EXIT_FAILURE);
+  }
+  search->table_mask = n_slots - 1;
+  for (size_t k = 0; k < search->n_keys; k++) {
+    size_t i = search->keys[k * search->key_words] & search->table_mask;
+    while (search->table[i] != 0)
+      i = (i + 1) & search->table_mask;
+    search->table[i] = k + 1;
+  }
+}
+
+// Records the configuration; false if it was seen before
+static bool remember(Search* search, const ModelState* state) {
+  if (search->n_keys == search->keys_capacity) {
+    search->keys_capacity *= 2;
+    search->keys = checked_realloc(
+        search->keys,
+        search->keys_capacity * search->key_words * sizeof(uint64_t));
+  }
+  uint64_t* key = &search->keys[search->n_keys * search->key_words];
+  make_key(search, state, key);
+  size_t i = key[0] & search->table_mask;
+  for (; search->table[i] != 0; i = (i + 1) & search->table_mask) {
+    const uint64_t* seen =
+        &search->keys[(search->table[i] - 1) * search->key_words];
+    if (memcmp(seen, key, search->key_words * sizeof(uint64_t)) == 0)
+      return false;
+  }
+  search->table[i] = ++search->n_keys;
+  if (2 * search->n_keys > search->table_mask + 1)
+    grow_table(search);
+  return true;
+}
+
+// Operations that may go next: not done, and invoked before every
+// operation not done has returned
+static size_t candidates(const Search* search, size_t* list) {
+  size_t n = 0;
+  uint64_t first_return = UINT64_MAX;
+  for (size_t j = search->lo;
+       j < search->n_ops && search->ops[j].invoked < first_return; j++) {
+    if (is_done(search, j))
+      continue;
+    if (search->ops[j].returned < first_return)
+      first_return = search->ops[j].returned;
+    list[n++] = j;
+  }
+  return n;
+}
+
+static void add_end(Linearization* result, const ModelState* state) {
+  for (size_t i = 0; i < result->n_ends; i++)
+    if (model_states_equal(&result->ends[i], state))
+      return;
+  if (result->n_ends < MODEL_MAX_STATES)
+    result->ends[result->n_ends++] = *state;
+}
+
+static void search_from(Search* search, const ModelState* state) {
+  if (search->exhausted)
+    return;
+  // A read that fits now can be taken now: it changes nothing, and
+  // taking it only lets more operations go next
+  size_t* list = malloc(search->window * sizeof(size_t));
+  size_t first_read = search->n_reads;
+  bool took_read;
+  size_t n;
+  do {
+    took_read = false;
+    n = candidates(search, list);
+    for (size_t c = 0; c < n; c++) {
+      const Op* op = &search->ops[list[c]];
+      ModelState next = *state;
+      if (op_mutates(op) || !model_step(op, &next))
+        continue;
+      mark(search, list[c], true);
+      search->reads[search->n_reads++] = list[c];
+      took_read = true;
+    }
+  } while (took_read);
+
+  if (search->n_done > search->result->progress)
+    search->result->progress = search->n_done;
+  if (search->lo == search->n_ops) {
+    add_end(search->result, state);
+  } else if (remember(search, state)) {
+    if (++search->result->explored > MODEL_MAX_EXPLORED)
+      search->exhausted = true;
+    for (size_t c = 0; c < n && !search->exhausted; c++) {
+      const Op* op = &search->ops[list[c]];
+      ModelState next = *state;
+      if (!op_mutates(op) || !model_step(op, &next))
+        continue;
+      mark(search, list[c], true);
+      search_from(search, &next);
+      mark(search, list[c], false);
+    }
+  }
+
+  while (search->n_reads > first_read)
+    mark(search, search->reads[--search->n_reads], false);
+  free(list);
+}
+
+bool linearize(const Op* ops,
+               size_t n_ops,
+               const ModelState* starts,
+               size_t n_starts,
+               Linearization* result) {
+  *result = (Linearization){0};
+  // Whatever is done beyond lo was invoked before lo returned
+  size_t window = 1;
+  for (size_t i = 0, j = 0; i < n_ops; i++) {
+    if (j < i)
+      j = i;
+    while (j + 1 < n_ops && ops[j + 1].invoked < ops[i].returned)
+      j++;
+    if (j - i + 1 > window)
+      window = j - i + 1;
+  }
+
+  Search search = {.ops = ops,
+                   .n_ops = n_ops,
+                   .window = window,
+                   .window_words = (window + 63) / 64,
+                   .keys_capacity = 1024,
+                   .table_mask = 2047,
+                   .result = result};
+  search.key_words = KEY_HEADER_WORDS + search.window_words;
+  search.done = calloc((n_ops + 63) / 64 + 1, sizeof(uint64_t));
+  search.keys = malloc(search.keys_capacity * search.key_words *
+                       sizeof(uint64_t));
+  search.table = calloc(search.table_mask + 1, sizeof(size_t));
+  search.reads = malloc((n_ops + 1) * sizeof(size_t));
+  if (search.done == nullptr || search.keys == nullptr ||
+      search.table == nullptr || search.reads == nullptr) {
+    perror("malloc failed");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < n_starts; i++)
+    search_from(&search, &starts[i]);
+
+  free(search.done);
+  free(search.keys);
+  free(search.table);
+  free(search.reads);
+  if (search.exhausted) {
+    result->n_ends = 0;
+    result->exhausted = true;
+  }
+  return result->n_ends > 0;
+}
+
+static const char* op_names[] = {
+    [OP_LOGIN] = "login",     [OP_LOGIN_WRONG] = "login-wrong",
+    [OP_LOGOUT] = "logout",   [OP_LOGGED_IN] = "logged-in?",
+    [OP_BOOK] = "book",       [OP_CANCEL] = "cancel",
+    [OP_QUERY] = "query",     [OP_IS_FREE] = "listed-free?",
+    [OP_IS_MINE] = "listed-mine?",
+};
+
+void print_op(FILE* out, const Op* op) {
+  fprintf(out, "  [%9lu, %9lu] %-12s", op->invoked, op->returned,
+          op_names[op->kind]);
+  if (op->user >= 0)
+    fprintf(out, " user %d", op->user);
+  switch (op->kind) {
+    case OP_LOGGED_IN:
+    case OP_IS_FREE:
+    case OP_IS_MINE:
+      fprintf(out, " -> %s\n", op->flag ? "yes" : "no");
+      break;
+    case OP_QUERY:
+      fprintf(out, " -> %s, booked %lu, canceled %lu\n",
+              op->flag ? "free" : "taken", op->booked, op->canceled);
+      break;
+    default:
+      fprintf(out, " -> %d\n", op->code);
+  }
+}
+
+void print_state(FILE* out, const ModelState* state) {
+  fprintf(out, "exists %d, logged in %d, owner %d, booked %lu, canceled %lu",
+          state->exists, state->logged_in, state->owner, state->booked,
+          state->canceled);
+}
@@ -0,0 +1,76 @@
+#ifndef STRESS_MODEL_H
+#define STRESS_MODEL_H
+#include <helper.h>
+#include <stdio.h>
+
+// Sequential model of the seat and user state machines, and a checker that
+// decides whether a concurrent history of them is linearizable.
+//
+// Each seat and each user is checked as an object of its own. A request
+// touching both is recorded as one operation on each: book checks that
+// the user is logged in and then locks the seat, so the two are separate
+// steps in the server too. Likewise confirmbooking locks one seat at a
+// time, so its listing is one read per seat, all sharing its interval.
+
+#define SEAT_FREE (-1)
+#define SEAT_FOREIGN (-2)  // booked by someone the harness does not know
+#define MODEL_MAX_STATES 64
+
+typedef enum {
+  // Users
+  OP_LOGIN,        // with the right password; code is a LoginErrorCode
+  OP_LOGIN_WRONG,  // with a wrong one, on a user known to exist
+  OP_LOGOUT,       // code is a LogoutErrorCode
+  OP_LOGGED_IN,    // a seat request saw the user logged in (flag) or not
+  // Seats
+  OP_BOOK,      // code is a BookErrorCode
+  OP_CANCEL,    // code is a CancelBookingErrorCode
+  OP_QUERY,     // flag: found free; booked and canceled as answered
+  OP_IS_FREE,   // flag: listed by "confirmbooking available"
+  OP_IS_MINE,   // flag: listed by "confirmbooking booked" of user
+} OpKind;
+
+typedef struct {
+  OpKind kind;
+  int32_t user;  // harness user index, -1 for none
+  int32_t code;
+  bool flag;
+  uint64_t booked;
+  uint64_t canceled;
+  uint64_t invoked;   // ticks of the history clock
+  uint64_t returned;
+} Op;
+
+// A user uses exists and logged_in, a seat the rest
+typedef struct {
+  bool exists;
+  bool logged_in;
+  int32_t owner;  // SEAT_FREE, SEAT_FOREIGN or a user
+  uint64_t booked;
+  uint64_t canceled;
+} ModelState;
+
+// Applies op to state; false if it could not have answered as it did
+bool model_step(const Op* op, ModelState* state);
+bool model_states_equal(const ModelState* a, const ModelState* b);
+
+typedef struct {
+  size_t n_ends;
+  ModelState ends[MODEL_MAX_STATES];  // every state a linearization ends in
+  size_t explored;                    // configurations visited
+  size_t progress;  // most operations any attempt linearized
+  bool exhausted;   // gave up before deciding
+} Linearization;
+
+// Searches for orders of ops, sorted by invoked, that respect real time
+// and the model, starting from any of starts. Returns false if there is
+// none, which makes the history a violation, or if the search gave up.
+bool linearize(const Op* ops,
+               size_t n_ops,
+               const ModelState* starts,
+               size_t n_starts,
+               Linearization* result);
+
+void print_op(FILE* out, const Op* op);
+void print_state(FILE* out, const ModelState* state);
+#endif
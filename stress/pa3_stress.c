@@ -0,0 +1,787 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "../server/helper.h"
+#include "model.h"
+
+// Drives threads through randomized login, logout, book, cancel, query
+// and confirmbooking requests, records every request with the times it
+// was sent and answered, and checks after each round that the history is
+// linearizable against the sequential model in model.h. Without an
+// address the threads call handle_request directly on seats and users of
+// their own; with one they each hold a connection to a running server
+// and must be its only clients. Throttled requests did nothing and are
+// left out, but a server started with -R ip.login=0,user.login=0 throttles
+// none.
+//
+// Each thread's requests follow from the seed, so a failing seed keeps
+// failing the same way; the interleaving is the scheduler's, shaken up
+// by pauses before a share of the requests.
+
+#define STRESS_DEFAULT_THREADS 8
+#define STRESS_DEFAULT_ROUNDS 50
+#define STRESS_DEFAULT_OPS 400  // per thread and round
+#define STRESS_DEFAULT_USERS 6
+#define STRESS_DEFAULT_SEATS 4
+#define STRESS_DEFAULT_FRESH 4  // users first logging in each round
+#define STRESS_DEFAULT_JITTER 20
+#define STRESS_MAX_USERS 64
+#define STRESS_MAX_SPIN 4096
+#define STRESS_NAME_SIZE 96
+#define STRESS_HISTORY_CONTEXT 40  // operations printed around a violation
+#define WRONG_PASSWORD "not the password"
+
+atomic_bool sigint_received = false;
+
+typedef struct {
+  size_t n_threads;
+  size_t n_rounds;
+  size_t n_ops;
+  size_t n_users;
+  size_t n_seats;  // seats 1..n_seats are booked and cancelled
+  size_t n_fresh;
+  uint64_t seed;
+  uint32_t jitter;  // percent of requests preceded by a pause
+  const char* address;
+  const char* port;  // nullptr for a socket path
+} StressConfig;
+
+// Seats are objects 0..NUM_SEATS-1, then come the users and the fresh
+// users of the round
+typedef struct {
+  size_t object;
+  Op op;
+} Event;
+
+typedef struct {
+  size_t n;
+  ModelState states[MODEL_MAX_STATES];
+} StateSet;
+
+typedef struct {
+  StressConfig config;
+  pthread_barrier_t round_start;
+  pthread_barrier_t round_end;
+  atomic_uint_fast64_t clock;
+  size_t round;
+  char (*names)[STRESS_NAME_SIZE];  // users, then fresh users
+  bool known[STRESS_MAX_USERS];     // users sure to exist
+  bool failed;                      // a request got an unexpected answer
+  bool stopping;                    // no more rounds
+  // Only when driving handle_request directly
+  Users users;
+  Seat* seats;
+  ServerStats stats;
+  Waitlist waitlist;
+} Stress;
+
+typedef struct {
+  Stress* stress;
+  size_t index;
+  uint64_t random;
+  int32_t fd;  // -1 when calling handle_request directly
+  Session session;
+  Event* events;
+  size_t n_events;
+  size_t capacity;
+} Worker;
+
+static size_t n_objects(const StressConfig* config) {
+  return NUM_SEATS + config->n_users + config->n_fresh;
+}
+
+// splitmix64
+static uint64_t next_random(uint64_t* state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [-t threads] [-r rounds] [-n requests per thread and "
+          "round]\n"
+          "          [-u users] [-k seats] [-f fresh users per round] "
+          "[-s seed]\n"
+          "          [-j jitter %%] [<IP address> <port> | <socket path>]\n",
+          program);
+}
+
+static int32_t connect_to_server(const char* address, const char* port) {
+  int32_t fd;
+  if (port == nullptr) {
+    struct sockaddr_un saddr = {.sun_family = AF_UNIX};
+    strncpy(saddr.sun_path, address, sizeof(saddr.sun_path) - 1);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&saddr, sizeof(saddr)) < 0) {
+      perror("connect");
+      exit(EXIT_FAILURE);
+    }
+    return fd;
+  }
+
+  struct sockaddr_in saddr = {.sin_family = AF_INET,
+                              .sin_port = htons(strtoul(port, nullptr, 10))};
+  if (inet_pton(AF_INET, address, &saddr.sin_addr) <= 0) {
+    fprintf(stderr, "Invalid address: %s\n", address);
+    exit(EXIT_FAILURE);
+  }
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, (struct sockaddr*)&saddr, sizeof(saddr)) < 0) {
+    perror("connect");
+    exit(EXIT_FAILURE);
+  }
+  int32_t nodelay = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+  return fd;
+}
+
+static void exchange_over_socket(int32_t fd,
+                                 const Request* request,
+                                 Response* response) {
+  size_t size = request_frame_size(request);
+  uint8_t* frame = malloc(size);
+  encode_request(request, frame);
+  bool sent = sigint_safe_write_all(fd, frame, size) == (ssize_t)size;
+  free(frame);
+
+  uint8_t header[RESPONSE_HEADER_SIZE];
+  if (!sent || sigint_safe_read_all(fd, header, sizeof(header)) <= 0) {
+    fprintf(stderr, "Server closed the connection\n");
+    exit(EXIT_FAILURE);
+  }
+  decode_response_header(header, response);
+  if (response->data_size > MAX_REQUEST_FIELD_SIZE) {
+    fprintf(stderr, "Oversized response from the server\n");
+    exit(EXIT_FAILURE);
+  }
+  if (response->data_size > 0) {
+    response->data = malloc(response->data_size);
+    if (sigint_safe_read_all(fd, response->data, response->data_size) <= 0) {
+      fprintf(stderr, "Server closed the connection\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+// Sends one request and stamps when it went out and came back. False if
+// the server throttled it, which means it did nothing.
+static bool call(Worker* worker,
+                 Action action,
+                 const char* username,
+                 const char* data,
+                 Response* response,
+                 Op* op) {
+  Request request = {.action = action,
+                     .username = (char*)username,
+                     .username_length = strlen(username),
+                     .data = (char*)data,
+                     .data_size = strlen(data)};
+  Stress* stress = worker->stress;
+  default_response(response);
+  op->invoked = atomic_fetch_add(&stress->clock, 1);
+  if (worker->fd >= 0)
+    exchange_over_socket(worker->fd, &request, response);
+  else
+    handle_request(&request, response, &stress->users, stress->seats,
+                   &stress->stats, &stress->waitlist, &worker->session);
+  op->returned = atomic_fetch_add(&stress->clock, 1);
+  op->code = response->code;
+  return op->code != RATE_LIMIT_ERROR_THROTTLED;
+}
+
+static void record(Worker* worker, size_t object, const Op* op) {
+  if (worker->n_events == worker->capacity) {
+    worker->capacity = worker->capacity == 0 ? 1024 : 2 * worker->capacity;
+    worker->events = realloc(worker->events, worker->capacity * sizeof(Event));
+    if (worker->events == nullptr) {
+      perror("realloc failed");
+      exit(EXIT_FAILURE);
+    }
+  }
+  worker->events[worker->n_events++] = (Event){object, *op};
+}
+
+static void unexpected(Worker* worker, const char* what, int32_t code) {
+  fprintf(stderr, "thread %zu: %s answered %d\n", worker->index, what, code);
+  worker->stress->failed = true;
+}
+
+static void pause_randomly(Worker* worker) {
+  uint64_t r = next_random(&worker->random);
+  if (r % 100 >= worker->stress->config.jitter)
+    return;
+  if ((r >> 8) % 4 == 0) {
+    sched_yield();
+    return;
+  }
+  for (uint64_t spin = (r >> 16) % STRESS_MAX_SPIN; spin > 0; spin--)
+    __asm__ volatile("" : : : "memory");
+}
+
+static void password_of(const char* name, char* password) {
+  snprintf(password, STRESS_NAME_SIZE + 4, "pw-%s", name);
+}
+
+static void do_login(Worker* worker, size_t user, bool wrong) {
+  Stress* stress = worker->stress;
+  const char* name = stress->names[user];
+  char password[STRESS_NAME_SIZE + 4];
+  password_of(name, password);
+  Response response;
+  Op op = {.kind = wrong ? OP_LOGIN_WRONG : OP_LOGIN, .user = user};
+  bool answered = call(worker, ACTION_LOGIN, name,
+                       wrong ? WRONG_PASSWORD : password, &response, &op);
+  free_response(&response);
+  if (!answered)
+    return;
+  if (op.code != LOGIN_ERROR_SUCCESS && op.code != LOGIN_ERROR_ACTIVE_USER &&
+      op.code != LOGIN_ERROR_INCORRECT_PASSWORD)
+    unexpected(worker, "login", op.code);
+  record(worker, NUM_SEATS + user, &op);
+}
+
+static void do_logout(Worker* worker, size_t user) {
+  Response response;
+  Op op = {.kind = OP_LOGOUT, .user = user};
+  bool answered = call(worker, ACTION_LOGOUT, worker->stress->names[user],
+                       "", &response, &op);
+  free_response(&response);
+  if (answered)
+    record(worker, NUM_SEATS + user, &op);
+}
+
+// Book and cancel: a refusal for not being logged in reads the user, any
+// other answer also acts on the seat
+static void do_seat_change(Worker* worker,
+                           Action action,
+                           size_t user,
+                           pa3_seat_t seat) {
+  char data[24];
+  snprintf(data, sizeof(data), "%lu", seat);
+  Response response;
+  Op op = {.kind = action == ACTION_BOOK ? OP_BOOK : OP_CANCEL, .user = user};
+  bool answered = call(worker, action, worker->stress->names[user], data,
+                       &response, &op);
+  free_response(&response);
+  if (!answered)
+    return;
+
+  Op logged_in = op;
+  logged_in.kind = OP_LOGGED_IN;
+  // Both actions use 1 for a user not logged in
+  logged_in.flag = op.code != BOOK_ERROR_USER_NOT_LOGGED_IN;
+  record(worker, NUM_SEATS + user, &logged_in);
+  if (logged_in.flag)
+    record(worker, seat - 1, &op);
+}
+
+static void do_confirm(Worker* worker, size_t user, bool available) {
+  Response response;
+  Op op = {.kind = available ? OP_IS_FREE : OP_IS_MINE, .user = user};
+  if (!call(worker, ACTION_CONFIRM_BOOKING, worker->stress->names[user],
+            available ? "available" : "booked", &response, &op)) {
+    free_response(&response);
+    return;
+  }
+  Op logged_in = op;
+  logged_in.kind = OP_LOGGED_IN;
+  logged_in.flag = op.code == CONFIRM_BOOKING_ERROR_SUCCESS;
+  if (op.code != CONFIRM_BOOKING_ERROR_SUCCESS &&
+      op.code != CONFIRM_BOOKING_ERROR_USER_NOT_LOGGED_IN)
+    unexpected(worker, "confirmbooking", op.code);
+  record(worker, NUM_SEATS + user, &logged_in);
+
+  if (logged_in.flag) {
+    bool listed[NUM_SEATS] = {false};
+    const pa3_seat_t* seats = (const pa3_seat_t*)response.data;
+    for (size_t i = 0; i < response.data_size / sizeof(pa3_seat_t); i++)
+      if (seats[i] >= 1 && seats[i] <= NUM_SEATS)
+        listed[seats[i] - 1] = true;
+    for (size_t i = 0; i < NUM_SEATS; i++) {
+      op.flag = listed[i];
+      record(worker, i, &op);
+    }
+  }
+  free_response(&response);
+}
+
+static void do_query(Worker* worker, pa3_seat_t seat) {
+  char data[24];
+  snprintf(data, sizeof(data), "%lu", seat);
+  Response response;
+  Op op = {.kind = OP_QUERY, .user = -1};
+  bool answered = call(worker, ACTION_QUERY, "", data, &response, &op);
+  if (answered && (op.code != QUERY_ERROR_SUCCESS ||
+                   response.data_size != sizeof(Seat)))
+    unexpected(worker, "query", op.code);
+  if (answered && response.data_size == sizeof(Seat)) {
+    // The name pointer is the server's; only whether it is set means
+    // anything here
+    const Seat* copy = (const Seat*)response.data;
+    op.flag = copy->user_who_booked == nullptr;
+    op.booked = copy->amount_of_times_booked;
+    op.canceled = copy->amount_of_times_canceled;
+    record(worker, seat - 1, &op);
+  }
+  free_response(&response);
+}
+
+static void run_request(Worker* worker) {
+  const StressConfig* config = &worker->stress->config;
+  uint64_t r = next_random(&worker->random);
+  size_t user = (r >> 8) % config->n_users;
+  pa3_seat_t seat = 1 + (r >> 24) % config->n_seats;
+  size_t fresh = config->n_users + (r >> 40) % config->n_fresh;
+  uint64_t dice = r % 100;
+  if (dice < 25) {
+    do_seat_change(worker, ACTION_BOOK, user, seat);
+  } else if (dice < 45) {
+    do_seat_change(worker, ACTION_CANCEL_BOOKING, user, seat);
+  } else if (dice < 55) {
+    do_confirm(worker, user, (r >> 32) & 1);
+  } else if (dice < 65) {
+    do_query(worker, seat);
+  } else if (dice < 78) {
+    do_login(worker, user, false);
+  } else if (dice < 88) {
+    do_logout(worker, user);
+  } else if (dice < 93) {
+    // A wrong password would create a user not there yet
+    do_login(worker, user, worker->stress->known[user]);
+  } else if (dice < 98) {
+    do_login(worker, fresh, false);
+  } else {
+    do_logout(worker, fresh);
+  }
+}
+
+static void* run_worker(void* arg) {
+  Worker* worker = arg;
+  Stress* stress = worker->stress;
+  for (;;) {
+    pthread_barrier_wait(&stress->round_start);
+    if (stress->stopping)
+      break;
+    for (size_t i = 0; i < stress->config.n_ops; i++) {
+      pause_randomly(worker);
+      run_request(worker);
+    }
+    pthread_barrier_wait(&stress->round_end);
+    // The checker has the events now and clears them
+    pthread_barrier_wait(&stress->round_end);
+  }
+  return nullptr;
+}
+
+static void name_users(Stress* stress) {
+  const StressConfig* config = &stress->config;
+  // Against a server the names must not collide with an earlier run
+  char prefix[24];
+  if (config->address != nullptr)
+    snprintf(prefix, sizeof(prefix), "%dx", (int32_t)getpid());
+  else
+    prefix[0] = '\0';
+  for (size_t i = 0; i < config->n_users; i++)
+    snprintf(stress->names[i], STRESS_NAME_SIZE, "%ss%luu%zu", prefix,
+             config->seed, i);
+  for (size_t i = 0; i < config->n_fresh; i++)
+    snprintf(stress->names[config->n_users + i], STRESS_NAME_SIZE,
+             "%ss%lur%zuf%zu", prefix, config->seed, stress->round, i);
+}
+
+// What can be seen of each object once every thread is done: everything
+// when the seats and users are ours, a seat's counters and whether it is
+// free when they are behind a server
+typedef struct {
+  ModelState state;
+  bool seen;
+  bool whole;
+} Observation;
+
+static void observe(Stress* stress, Worker* observer, Observation* seen) {
+  const StressConfig* config = &stress->config;
+  for (size_t i = 0; i < n_objects(config); i++)
+    seen[i] = (Observation){.seen = false};
+
+  for (pa3_seat_t seat = 1; seat <= NUM_SEATS; seat++) {
+    Observation* observation = &seen[seat - 1];
+    if (observer->fd >= 0) {
+      char data[24];
+      snprintf(data, sizeof(data), "%lu", seat);
+      Response response;
+      Op op;
+      call(observer, ACTION_QUERY, "", data, &response, &op);
+      if (response.data_size == sizeof(Seat)) {
+        const Seat* copy = (const Seat*)response.data;
+        observation->state.owner =
+            copy->user_who_booked == nullptr ? SEAT_FREE : SEAT_FOREIGN;
+        observation->state.booked = copy->amount_of_times_booked;
+        observation->state.canceled = copy->amount_of_times_canceled;
+        observation->seen = true;
+      }
+      free_response(&response);
+      continue;
+    }
+
+    Seat* copy = &stress->seats[seat - 1];
+    observation->state.owner = SEAT_FREE;
+    if (copy->user_who_booked != nullptr) {
+      observation->state.owner = SEAT_FOREIGN;
+      for (size_t i = 0; i < config->n_users; i++)
+        if (strcmp(copy->user_who_booked, stress->names[i]) == 0)
+          observation->state.owner = i;
+    }
+    observation->state.booked = copy->amount_of_times_booked;
+    observation->state.canceled = copy->amount_of_times_canceled;
+    observation->seen = true;
+    observation->whole = true;
+  }
+
+  if (observer->fd >= 0)
+    return;
+  for (size_t i = 0; i < config->n_users + config->n_fresh; i++) {
+    Observation* observation = &seen[NUM_SEATS + i];
+    ssize_t uid = find_user(&stress->users, stress->names[i]);
+    observation->state = (ModelState){
+        .exists = uid >= 0,
+        .logged_in = uid >= 0 && user_at(&stress->users, uid)->logged_in,
+        .owner = SEAT_FREE};
+    observation->seen = true;
+    observation->whole = true;
+  }
+}
+
+static bool matches(const Observation* observation, const ModelState* state) {
+  if (!observation->seen)
+    return true;
+  if (observation->whole)
+    return model_states_equal(&observation->state, state);
+  return (state->owner == SEAT_FREE) ==
+             (observation->state.owner == SEAT_FREE) &&
+         state->booked == observation->state.booked &&
+         state->canceled == observation->state.canceled;
+}
+
+static int compare_events(const void* a, const void* b) {
+  uint64_t x = ((const Op*)a)->invoked;
+  uint64_t y = ((const Op*)b)->invoked;
+  return (x > y) - (x < y);
+}
+
+static void describe_object(const Stress* stress, size_t object) {
+  if (object < NUM_SEATS)
+    fprintf(stderr, "seat %zu", object + 1);
+  else
+    fprintf(stderr, "user %s", stress->names[object - NUM_SEATS]);
+}
+
+static void report_history(const Op* ops,
+                           size_t n_ops,
+                           const StateSet* starts,
+                           const Linearization* result) {
+  fprintf(stderr, "started in any of:\n");
+  for (size_t i = 0; i < starts->n; i++) {
+    fprintf(stderr, "  ");
+    print_state(stderr, &starts->states[i]);
+    fprintf(stderr, "\n");
+  }
+  size_t from = result->progress > STRESS_HISTORY_CONTEXT
+                    ? result->progress - STRESS_HISTORY_CONTEXT
+                    : 0;
+  size_t to = result->progress + STRESS_HISTORY_CONTEXT;
+  if (to > n_ops)
+    to = n_ops;
+  fprintf(stderr,
+          "no order gets past %zu of its %zu operations; operations %zu-%zu "
+          "by invocation:\n",
+          result->progress, n_ops, from, to);
+  for (size_t i = from; i < to; i++)
+    print_op(stderr, &ops[i]);
+}
+
+// Checks every object's part of the round and moves on to the states the
+// round may have left it in. Returns false on a violation.
+static bool check_round(Stress* stress,
+                        Worker* workers,
+                        StateSet* states,
+                        size_t* explored,
+                        size_t* n_checked) {
+  const StressConfig* config = &stress->config;
+  size_t n = n_objects(config);
+  Observation* seen = malloc(n * sizeof(Observation));
+  size_t* counts = calloc(n, sizeof(size_t));
+  Op** histories = calloc(n, sizeof(Op*));
+  if (seen == nullptr || counts == nullptr || histories == nullptr) {
+    perror("malloc failed");
+    exit(EXIT_FAILURE);
+  }
+  observe(stress, &workers[config->n_threads], seen);
+
+  for (size_t w = 0; w < config->n_threads; w++)
+    for (size_t i = 0; i < workers[w].n_events; i++)
+      counts[workers[w].events[i].object]++;
+  for (size_t i = 0; i < n; i++) {
+    histories[i] = malloc((counts[i] + 1) * sizeof(Op));
+    if (histories[i] == nullptr) {
+      perror("malloc failed");
+      exit(EXIT_FAILURE);
+    }
+    counts[i] = 0;
+  }
+  for (size_t w = 0; w < config->n_threads; w++) {
+    for (size_t i = 0; i < workers[w].n_events; i++) {
+      const Event* event = &workers[w].events[i];
+      histories[event->object][counts[event->object]++] = event->op;
+    }
+    workers[w].n_events = 0;
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < n && ok; i++) {
+    qsort(histories[i], counts[i], sizeof(Op), compare_events);
+    Linearization result;
+    bool linearizable =
+        linearize(histories[i], counts[i], states[i].states, states[i].n,
+                  &result);
+    *explored += result.explored;
+    *n_checked += counts[i];
+    if (!linearizable) {
+      fprintf(stderr, "round %zu: ", stress->round);
+      describe_object(stress, i);
+      fprintf(stderr, result.exhausted
+                          ? " could not be decided within the search limit\n"
+                          : " is not linearizable\n");
+      report_history(histories[i], counts[i], &states[i], &result);
+      ok = false;
+      break;
+    }
+
+    StateSet next = {0};
+    for (size_t e = 0; e < result.n_ends; e++)
+      if (matches(&seen[i], &result.ends[e]))
+        next.states[next.n++] = result.ends[e];
+    if (next.n == 0) {
+      fprintf(stderr, "round %zu: ", stress->round);
+      describe_object(stress, i);
+      fprintf(stderr, " ended up in ");
+      print_state(stderr, &seen[i].state);
+      fprintf(stderr, ", which no order of its operations leads to:\n");
+      for (size_t e = 0; e < result.n_ends; e++) {
+        fprintf(stderr, "  ");
+        print_state(stderr, &result.ends[e]);
+        fprintf(stderr, "\n");
+      }
+      ok = false;
+      break;
+    }
+    states[i] = next;
+  }
+
+  for (size_t i = 0; i < n; i++)
+    free(histories[i]);
+  free(histories);
+  free(counts);
+  free(seen);
+  return ok;
+}
+
+// Fresh users start out unknown each round; the others carry on
+static void start_round(Stress* stress, StateSet* states) {
+  const StressConfig* config = &stress->config;
+  for (size_t i = 0; i < config->n_users; i++) {
+    bool exists = true;
+    for (size_t s = 0; s < states[NUM_SEATS + i].n; s++)
+      exists = exists && states[NUM_SEATS + i].states[s].exists;
+    stress->known[i] = exists;
+  }
+  for (size_t i = 0; i < config->n_fresh; i++)
+    states[NUM_SEATS + config->n_users + i] =
+        (StateSet){1, {{.exists = false, .owner = SEAT_FREE}}};
+  name_users(stress);
+}
+
+static void setup_direct(Stress* stress) {
+  // Logins are not what is tested, so they hash as cheaply as argon2 allows
+  hash_params = (HashParams){.time_cost = 1, .memory_kib = 8, .parallelism = 1};
+  setup_users(&stress->users);
+  stress->seats = default_seats();
+  stats_init(&stress->stats, 1);
+  waitlist_init(&stress->waitlist, NUM_SEATS, 1);
+  listing_cache_init(&listing_cache);
+}
+
+static void free_direct(Stress* stress) {
+  for (size_t i = 0; i < NUM_SEATS; i++) {
+    pthread_mutex_destroy(&stress->seats[i].mutex);
+    free((void*)stress->seats[i].user_who_booked);
+  }
+  free(stress->seats);
+  free_users(&stress->users);
+  stats_free(&stress->stats);
+  waitlist_free(&stress->waitlist);
+  listing_cache_free(&listing_cache);
+}
+
+static bool parse_size(const char* text, size_t* value) {
+  char* end;
+  unsigned long long parsed = strtoull(text, &end, 10);
+  if (end == text || *end != '\0' || parsed == 0)
+    return false;
+  *value = parsed;
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  StressConfig config = {.n_threads = STRESS_DEFAULT_THREADS,
+                         .n_rounds = STRESS_DEFAULT_ROUNDS,
+                         .n_ops = STRESS_DEFAULT_OPS,
+                         .n_users = STRESS_DEFAULT_USERS,
+                         .n_seats = STRESS_DEFAULT_SEATS,
+                         .n_fresh = STRESS_DEFAULT_FRESH,
+                         .seed = 1,
+                         .jitter = STRESS_DEFAULT_JITTER};
+  bool valid = true;
+  size_t jitter = 0;
+  int32_t opt;
+  while ((opt = getopt(argc, argv, "t:r:n:u:k:f:s:j:")) != -1) {
+    switch (opt) {
+      case 't':
+        valid = valid && parse_size(optarg, &config.n_threads);
+        break;
+      case 'r':
+        valid = valid && parse_size(optarg, &config.n_rounds);
+        break;
+      case 'n':
+        valid = valid && parse_size(optarg, &config.n_ops);
+        break;
+      case 'u':
+        valid = valid && parse_size(optarg, &config.n_users) &&
+                config.n_users <= STRESS_MAX_USERS;
+        break;
+      case 'k':
+        valid = valid && parse_size(optarg, &config.n_seats) &&
+                config.n_seats <= NUM_SEATS;
+        break;
+      case 'f':
+        valid = valid && parse_size(optarg, &config.n_fresh);
+        break;
+      case 's':
+        config.seed = strtoull(optarg, nullptr, 10);
+        break;
+      case 'j':
+        valid = valid && (strcmp(optarg, "0") == 0 ||
+                          (parse_size(optarg, &jitter) && jitter <= 100));
+        config.jitter = jitter;
+        break;
+      default:
+        valid = false;
+    }
+  }
+  if (optind + 2 == argc) {
+    config.address = argv[optind];
+    config.port = argv[optind + 1];
+  } else if (optind + 1 == argc) {
+    config.address = argv[optind];
+  } else if (optind != argc) {
+    valid = false;
+  }
+  if (!valid) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  Stress* stress = calloc(1, sizeof(Stress));
+  size_t n = n_objects(&config);
+  stress->names = calloc(config.n_users + config.n_fresh, STRESS_NAME_SIZE);
+  StateSet* states = malloc(n * sizeof(StateSet));
+  // One more worker, for observing the seats between rounds
+  Worker* workers = calloc(config.n_threads + 1, sizeof(Worker));
+  pthread_t* threads = malloc(config.n_threads * sizeof(pthread_t));
+  if (stress == nullptr || stress->names == nullptr || states == nullptr ||
+      workers == nullptr || threads == nullptr) {
+    perror("malloc failed");
+    exit(EXIT_FAILURE);
+  }
+  stress->config = config;
+  pthread_barrier_init(&stress->round_start, nullptr, config.n_threads + 1);
+  pthread_barrier_init(&stress->round_end, nullptr, config.n_threads + 1);
+
+  if (config.address == nullptr)
+    setup_direct(stress);
+  for (size_t i = 0; i <= config.n_threads; i++) {
+    workers[i] = (Worker){.stress = stress,
+                          .index = i,
+                          .random = config.seed ^ (i + 1) * 0x9e37'79b9ULL,
+                          .fd = -1};
+    if (config.address != nullptr)
+      workers[i].fd = connect_to_server(config.address, config.port);
+  }
+
+  // Users do not exist yet; seats are free unless a server says otherwise
+  for (size_t i = 0; i < n; i++)
+    states[i] = (StateSet){1, {{.exists = false, .owner = SEAT_FREE}}};
+  if (config.address != nullptr) {
+    Observation* seen = malloc(n * sizeof(Observation));
+    observe(stress, &workers[config.n_threads], seen);
+    for (size_t i = 0; i < NUM_SEATS; i++)
+      states[i].states[0] = seen[i].state;
+    free(seen);
+  }
+
+  for (size_t i = 0; i < config.n_threads; i++) {
+    if (pthread_create(&threads[i], nullptr, run_worker, &workers[i]) != 0) {
+      perror("pthread_create");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  size_t explored = 0;
+  size_t n_checked = 0;
+  bool ok = true;
+  size_t round = 0;
+  for (; round < config.n_rounds && ok; round++) {
+    stress->round = round;
+    start_round(stress, states);
+    pthread_barrier_wait(&stress->round_start);
+    pthread_barrier_wait(&stress->round_end);
+    ok = !stress->failed &&
+         check_round(stress, workers, states, &explored, &n_checked);
+    pthread_barrier_wait(&stress->round_end);
+  }
+  stress->stopping = true;
+  pthread_barrier_wait(&stress->round_start);
+  for (size_t i = 0; i < config.n_threads; i++)
+    pthread_join(threads[i], nullptr);
+
+  for (size_t i = 0; i <= config.n_threads; i++) {
+    if (config.address == nullptr)
+      end_session(&workers[i].session, stress->seats, &stress->waitlist);
+    free(workers[i].events);
+    if (workers[i].fd >= 0)
+      close(workers[i].fd);
+  }
+  if (config.address == nullptr)
+    free_direct(stress);
+  pthread_barrier_destroy(&stress->round_start);
+  pthread_barrier_destroy(&stress->round_end);
+
+  printf("seed %lu: %zu threads, %zu rounds, %zu operations checked, "
+         "%zu configurations explored, %s\n",
+         config.seed, config.n_threads, round, n_checked, explored,
+         ok ? "no violations" : "VIOLATION");
+  free(threads);
+  free(workers);
+  free(states);
+  free(stress->names);
+  free(stress);
+  return ok ? 0 : 1;
+}
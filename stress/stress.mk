@@ -0,0 +1,10 @@
+STRESS_SRCS := $(wildcard stress/*.c)
+STRESS_OBJS := $(STRESS_SRCS:.c=.o)
+SERVER_LIB_OBJS := $(filter-out server/pa3_server.o,$(SERVER_OBJS))
+
+pa3_stress: LDFLAGS += -largon2 -pthread
+pa3_stress: $(STRESS_OBJS) $(SERVER_LIB_OBJS) $(COMMON_OBJS)
+	$(CC) $(CFLAGS) -o $@ $^ $(LDFLAGS)
+
+clean_pa3_stress:
+	rm -f $(STRESS_OBJS) pa3_stress
@@ -0,0 +1,371 @@
+#include <arpa/inet.h>
+#include <capture.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <helper.h>
+#include <histogram.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+// Re-drives a pa3_server capture against a server. Every captured
+// connection gets its own connection and its requests are sent in order,
+// each one after the previous response (as the original blocking clients
+// did) and no earlier than its captured time divided by the speed factor.
+
+atomic_bool sigint_received = false;
+
+typedef struct {
+  const CaptureRecordHeader* header;
+  char* username;
+  char* data;
+} TraceRecord;
+
+typedef struct {
+  uint64_t id;
+  int32_t fd;
+  size_t* records;  // indices into the record array, in capture order
+  size_t n_records;
+  size_t capacity;
+  size_t next;      // next record to send
+  bool busy;
+  uint64_t sent_ns;
+} ReplayConnection;
+
+typedef struct {
+  TraceRecord* records;
+  size_t n_records;
+  ReplayConnection* connections;
+  size_t n_connections;
+} Trace;
+
+static void print_usage(const char* program) {
+  fprintf(stderr,
+          "usage: %s [-s <speed> | -f] <capture file> <IP address> <port>\n"
+          "       %s [-s <speed> | -f] <capture file> <socket path>\n",
+          program, program);
+}
+
+static int32_t connect_to_server(const char* address, const char* port) {
+  int32_t sockfd;
+  if (port == nullptr) {
+    struct sockaddr_un servaddr = {.sun_family = AF_UNIX};
+    strncpy(servaddr.sun_path, address, sizeof(servaddr.sun_path) - 1);
+    sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sockfd < 0 ||
+        connect(sockfd, (struct sockaddr*)&servaddr, sizeof(servaddr)) < 0) {
+      perror("connect failed");
+      exit(EXIT_FAILURE);
+    }
+    return sockfd;
+  }
+
+  struct sockaddr_in servaddr = {.sin_family = AF_INET,
+                                 .sin_port = htons(strtoul(port, nullptr, 10))};
+  if (inet_pton(AF_INET, address, &servaddr.sin_addr) <= 0) {
+    perror("inet_pton failed");
+    exit(EXIT_FAILURE);
+  }
+  sockfd = socket(AF_INET, SOCK_STREAM, 0);
+  if (sockfd < 0 ||
+      connect(sockfd, (struct sockaddr*)&servaddr, sizeof(servaddr)) < 0) {
+    perror("connect failed");
+    exit(EXIT_FAILURE);
+  }
+  int32_t nodelay = 1;
+  setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+  return sockfd;
+}
+
+static ReplayConnection* find_connection(Trace* trace, uint64_t id) {
+  for (size_t i = trace->n_connections; i > 0; i--) {
+    if (trace->connections[i - 1].id == id)
+      return &trace->connections[i - 1];
+  }
+  trace->connections = realloc(trace->connections, sizeof(ReplayConnection) *
+                                                       (trace->n_connections + 1));
+  ReplayConnection* conn = &trace->connections[trace->n_connections++];
+  *conn = (ReplayConnection){.id = id, .fd = -1};
+  return conn;
+}
+
+// Workers flush their rings independently, so records are only ordered per
+// worker in the file; sort by timestamp (stable, which keeps connection order)
+static int32_t compare_records(const void* a, const void* b) {
+  const TraceRecord* lhs = a;
+  const TraceRecord* rhs = b;
+  if (lhs->header->timestamp_ns != rhs->header->timestamp_ns)
+    return lhs->header->timestamp_ns < rhs->header->timestamp_ns ? -1 : 1;
+  return lhs < rhs ? -1 : (lhs > rhs);
+}
+
+static bool load_trace(const char* path, Trace* trace, uint8_t** mapping,
+                       size_t* mapping_size) {
+  int32_t fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) < 0) {
+    perror("open failed");
+    return false;
+  }
+  *mapping_size = st.st_size;
+  if ((size_t)st.st_size < sizeof(CaptureFileHeader)) {
+    fprintf(stderr, "%s is not a pa3 capture\n", path);
+    close(fd);
+    return false;
+  }
+  // Private writable mapping so strings can be NUL-terminated in place
+  *mapping = mmap(nullptr, *mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                  fd, 0);
+  close(fd);
+  if (*mapping == MAP_FAILED) {
+    perror("mmap failed");
+    return false;
+  }
+
+  const CaptureFileHeader* file_header = (const CaptureFileHeader*)*mapping;
+  if (memcmp(file_header->magic, CAPTURE_MAGIC, sizeof(file_header->magic)) !=
+          0 ||
+      file_header->version != CAPTURE_VERSION) {
+    fprintf(stderr, "%s is not a version %d pa3 capture\n", path,
+            CAPTURE_VERSION);
+    return false;
+  }
+
+  // Every record grows by at least its header, so this bounds the count
+  size_t max_records =
+      (*mapping_size - sizeof(CaptureFileHeader)) / sizeof(CaptureRecordHeader);
+  trace->records = malloc(sizeof(TraceRecord) * (max_records + 1));
+  trace->n_records = 0;
+
+  // The record header is 32 bytes and followed by unaligned strings, so
+  // strings are copied out and the header is read through an aligned copy
+  size_t offset = sizeof(CaptureFileHeader);
+  while (offset + sizeof(CaptureRecordHeader) <= *mapping_size) {
+    CaptureRecordHeader* header = malloc(sizeof(CaptureRecordHeader));
+    memcpy(header, *mapping + offset, sizeof(CaptureRecordHeader));
+    size_t record_size = sizeof(CaptureRecordHeader) +
+                         header->username_length + header->data_size;
+    if (offset + record_size > *mapping_size) {
+      free(header);
+      break;
+    }
+
+    const uint8_t* strings = *mapping + offset + sizeof(CaptureRecordHeader);
+    TraceRecord* record = &trace->records[trace->n_records++];
+    record->header = header;
+    record->username = strndup((const char*)strings, header->username_length);
+    record->data = strndup((const char*)strings + header->username_length,
+                           header->data_size);
+    offset += record_size;
+  }
+
+  qsort(trace->records, trace->n_records, sizeof(TraceRecord),
+        compare_records);
+
+  for (size_t i = 0; i < trace->n_records; i++) {
+    ReplayConnection* conn =
+        find_connection(trace, trace->records[i].header->connection_id);
+    if (conn->n_records == conn->capacity) {
+      conn->capacity = conn->capacity ? conn->capacity * 2 : 16;
+      conn->records = realloc(conn->records, sizeof(size_t) * conn->capacity);
+    }
+    conn->records[conn->n_records++] = i;
+  }
+  return true;
+}
+
+static void send_record(ReplayConnection* conn, const TraceRecord* record) {
+  // The capture keeps no resume token, so a resume logs in with the
+  // redacted password instead; both answer 0 on success
+  Action action = record->header->action == ACTION_RESUME
+                      ? ACTION_LOGIN
+                      : (Action)record->header->action;
+  Request request = {.action = action,
+                     .username_length = record->header->username_length,
+                     .username = record->username,
+                     .data_size = record->header->data_size,
+                     .data = record->data};
+  struct iovec request_iov[5] = {
+      {.iov_base = &request.action, .iov_len = sizeof(Action)},
+      {.iov_base = &request.username_length, .iov_len = sizeof(uint64_t)},
+      {.iov_base = request.username, .iov_len = request.username_length},
+      {.iov_base = &request.data_size, .iov_len = sizeof(uint64_t)},
+      {.iov_base = request.data, .iov_len = request.data_size}};
+  if (sigint_safe_writev_all(conn->fd, request_iov, 5) < 0) {
+    perror("write request failed");
+    exit(EXIT_FAILURE);
+  }
+  conn->busy = true;
+  conn->sent_ns = monotonic_ns();
+}
+
+// Waitlist notices arriving ahead of the response are skipped
+static int32_t receive_code(ReplayConnection* conn) {
+  uint8_t header[RESPONSE_HEADER_SIZE];
+  Response response;
+  do {
+    if (sigint_safe_read_all(conn->fd, header, sizeof(header)) <= 0) {
+      perror("read response failed");
+      exit(EXIT_FAILURE);
+    }
+    decode_response_header(header, &response);
+
+    uint8_t sink[4096];
+    for (uint64_t left = response.data_size; left > 0;) {
+      size_t chunk = left < sizeof(sink) ? left : sizeof(sink);
+      if (sigint_safe_read_all(conn->fd, sink, chunk) <= 0) {
+        perror("read response data failed");
+        exit(EXIT_FAILURE);
+      }
+      left -= chunk;
+    }
+  } while (response.code == WAITLIST_NOTICE_SEAT_ASSIGNED);
+  conn->busy = false;
+  return response.code;
+}
+
+int main(int argc, char* argv[]) {
+  setup_sigint_handler();
+
+  double speed = 1.0;
+  bool as_fast_as_possible = false;
+  int32_t opt;
+  while ((opt = getopt(argc, argv, "s:f")) != -1) {
+    switch (opt) {
+      case 's':
+        speed = strtod(optarg, nullptr);
+        break;
+      case 'f':
+        as_fast_as_possible = true;
+        break;
+      default:
+        print_usage(argv[0]);
+        return 1;
+    }
+  }
+  int32_t n_args = argc - optind;
+  if ((n_args != 2 && n_args != 3) || speed <= 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+  const char* address = argv[optind + 1];
+  const char* port = (n_args == 3) ? argv[optind + 2] : nullptr;
+
+  Trace trace = {0};
+  uint8_t* mapping;
+  size_t mapping_size;
+  if (!load_trace(argv[optind], &trace, &mapping, &mapping_size))
+    return 1;
+
+  for (size_t i = 0; i < trace.n_connections; i++) {
+    trace.connections[i].fd = connect_to_server(address, port);
+  }
+
+  Histogram latency;
+  Histogram lateness;
+  histogram_init(&latency);
+  histogram_init(&lateness);
+  uint64_t mismatches = 0;
+  uint64_t replayed = 0;
+
+  struct pollfd* fds = calloc(trace.n_connections, sizeof(struct pollfd));
+  size_t* fd_conn = calloc(trace.n_connections, sizeof(size_t));
+  // Schedule relative to the first captured request, not to server start
+  uint64_t first_ns =
+      trace.n_records > 0 ? trace.records[0].header->timestamp_ns : 0;
+  uint64_t start_ns = monotonic_ns();
+
+  while (!sigint_received && replayed < trace.n_records) {
+    uint64_t now_ns = monotonic_ns();
+    uint64_t next_due_ns = UINT64_MAX;
+
+    // Send every due head-of-line record whose connection is idle
+    for (size_t i = 0; i < trace.n_connections; i++) {
+      ReplayConnection* conn = &trace.connections[i];
+      if (conn->busy || conn->next == conn->n_records)
+        continue;
+      const TraceRecord* record = &trace.records[conn->records[conn->next]];
+      uint64_t offset_ns = record->header->timestamp_ns - first_ns;
+      uint64_t due_ns = as_fast_as_possible
+                            ? start_ns
+                            : start_ns + (uint64_t)(offset_ns / speed);
+      if (due_ns <= now_ns) {
+        histogram_record(&lateness, now_ns - due_ns);
+        send_record(conn, record);
+      } else if (due_ns < next_due_ns) {
+        next_due_ns = due_ns;
+      }
+    }
+
+    size_t n_fds = 0;
+    for (size_t i = 0; i < trace.n_connections; i++) {
+      if (!trace.connections[i].busy)
+        continue;
+      fds[n_fds].fd = trace.connections[i].fd;
+      fds[n_fds].events = POLLIN;
+      fd_conn[n_fds++] = i;
+    }
+
+    uint64_t timeout_ns =
+        next_due_ns == UINT64_MAX ? 100'000'000
+                                  : (next_due_ns > now_ns ? next_due_ns - now_ns
+                                                          : 0);
+    struct timespec timeout = {.tv_sec = timeout_ns / 1'000'000'000,
+                               .tv_nsec = timeout_ns % 1'000'000'000};
+    if (ppoll(fds, n_fds, &timeout, nullptr) <= 0)
+      continue;
+
+    for (size_t i = 0; i < n_fds; i++) {
+      if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+      ReplayConnection* conn = &trace.connections[fd_conn[i]];
+      const TraceRecord* record = &trace.records[conn->records[conn->next]];
+      int32_t code = receive_code(conn);
+      histogram_record(&latency, monotonic_ns() - conn->sent_ns);
+      if (code != record->header->response_code)
+        mismatches++;
+      conn->next++;
+      replayed++;
+    }
+  }
+
+  double elapsed_s = (monotonic_ns() - start_ns) / 1e9;
+  printf("Replayed %lu of %lu requests over %zu connections in %.3f s "
+         "(%.1f req/s)\n",
+         replayed, trace.n_records, trace.n_connections, elapsed_s,
+         replayed / (elapsed_s > 0 ? elapsed_s : 1));
+  printf("Response codes differing from the capture: %lu\n", mismatches);
+  printf("Latency us: p50 %.1f p99 %.1f p999 %.1f max %.1f\n",
+         histogram_percentile(&latency, 50.0) / 1e3,
+         histogram_percentile(&latency, 99.0) / 1e3,
+         histogram_percentile(&latency, 99.9) / 1e3, latency.max / 1e3);
+  if (!as_fast_as_possible)
+    printf("Send lag behind schedule us: p50 %.1f p99 %.1f max %.1f\n",
+           histogram_percentile(&lateness, 50.0) / 1e3,
+           histogram_percentile(&lateness, 99.0) / 1e3, lateness.max / 1e3);
+
+  for (size_t i = 0; i < trace.n_connections; i++) {
+    close(trace.connections[i].fd);
+    free(trace.connections[i].records);
+  }
+  for (size_t i = 0; i < trace.n_records; i++) {
+    free((void*)trace.records[i].header);
+    free(trace.records[i].username);
+    free(trace.records[i].data);
+  }
+  free(fds);
+  free(fd_conn);
+  free(trace.connections);
+  free(trace.records);
+  munmap(mapping, mapping_size);
+  return mismatches == 0 ? 0 : 2;
+}
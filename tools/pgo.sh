@@ -0,0 +1,58 @@
+#!/bin/sh
+# Profile-guided release build:
+#   1. build the release configuration instrumented (PGO=generate)
+#   2. train it with a booking and login workload against a local server
+#   3. rebuild with the recorded profile (PGO=use)
+# The profile (.gcda files) stays in build/release/ next to the objects.
+#
+# PGO_DURATION (seconds of load, default 10) and PGO_SOCKET tune the run.
+set -e
+
+cd "$(dirname "$0")/.."
+OUT=build/release
+DURATION=${PGO_DURATION:-10}
+SOCKET=${PGO_SOCKET:-/tmp/pa3_pgo.$$.sock}
+TRACE=$(mktemp /tmp/pa3_pgo.XXXXXX)
+JOBS=$(nproc 2>/dev/null || echo 4)
+trap 'rm -f "$TRACE" "$TRACE.console" "$SOCKET"' EXIT
+
+echo "== stage 1: instrumented build"
+rm -rf "$OUT"
+make -j"$JOBS" BUILD=release PGO=generate all
+
+echo "== stage 2: training run (${DURATION}s)"
+# Sessions that log in, book, look around, cancel and log out again
+i=0
+while [ $i -lt 2000 ]; do
+  seat=$((i % 100 + 1))
+  echo "login pgo$((i % 200)) secret$((i % 200))"
+  echo "book $seat"
+  echo "confirmbooking booked"
+  echo "query $seat"
+  echo "confirmbooking available"
+  echo "cancelbooking $seat"
+  echo "logout"
+  i=$((i + 1))
+done > "$TRACE"
+
+# The server writes its profile when it exits through the console
+CONSOLE=$TRACE.console
+mkfifo "$CONSOLE"
+# Logins repeat per user far faster than the default limit allows, and
+# the profile should cover hashing rather than refusals
+"$OUT/pa3_server" -u "$SOCKET" -R user.login=0 < "$CONSOLE" > /dev/null &
+SERVER=$!
+exec 3> "$CONSOLE"
+while [ ! -S "$SOCKET" ]; do sleep 0.1; done
+
+"$OUT/pa3_client" "$SOCKET" --bench -c 16 -t 4 -d "$DURATION"
+"$OUT/pa3_client" "$SOCKET" "$TRACE" 16 > /dev/null
+echo exit >&3
+exec 3>&-
+wait $SERVER
+
+echo "== stage 3: optimised build with the profile"
+find "$OUT" -name '*.o' -delete
+rm -f "$OUT/pa3_server" "$OUT/pa3_client" "$OUT/pa3_replay" \
+      "$OUT/pa3_bench" "$OUT/libpa3client.a"
+make -j"$JOBS" BUILD=release PGO=use all
@@ -0,0 +1,8 @@
+TOOLS_SRCS := $(wildcard tools/*.c)
+TOOLS_OBJS := $(TOOLS_SRCS:.c=.o)
+
+pa3_replay: $(TOOLS_OBJS) $(COMMON_OBJS)
+	$(CC) $(CFLAGS) -o $@ $^ $(LDFLAGS)
+
+clean_pa3_replay:
+	rm -f $(TOOLS_OBJS) pa3_replay
\ No newline at end of file